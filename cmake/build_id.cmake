@@ -0,0 +1,17 @@
+# writes OUTPUT, a header defining BUILD_ID as the hash of the files in SOURCES (separated by '|'). Run with
+# cmake -P at build time, see CMakeLists.txt. The header is only rewritten when the hash changes
+string(REPLACE "|" ";" source_list "${SOURCES}")
+set(hashes "")
+foreach(source ${source_list})
+    file(SHA256 "${source}" hash)
+    string(APPEND hashes "${hash}\n")
+endforeach()
+string(SHA256 build_id "${hashes}")
+
+set(content "// generated by cmake/build_id.cmake from the compiler sources\n#define BUILD_ID_HASH \"${build_id}\"\n")
+if(EXISTS "${OUTPUT}")
+    file(READ "${OUTPUT}" old_content)
+endif()
+if(NOT "${content}" STREQUAL "${old_content}")
+    file(WRITE "${OUTPUT}" "${content}")
+endif()
@@ -1,9 +1,18 @@
 #pragma once
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
 #include <iostream>
 #include <map>
 #include <memory>
+#include <new>
+#include <span>
 #include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 #include "Visitor.h"
 
@@ -19,180 +28,172 @@ class Visitor;
 
 namespace AST {
 
-class AST_node {
-   public:
-    virtual void accept(Visitor& v) = 0;
-    virtual ~AST_node() {}
-};
+// interned identifier, equal names have equal symbols
+using Symbol = uint32_t;
+
+class SymbolTable {
+    std::unordered_map<std::string_view, Symbol> ids_;
+    std::vector<std::string_view> names_;
 
-class Statement : public AST_node {
    public:
-    virtual string tostring() {
-        return "statment";
+    // the name has to outlive the table, the parser interns views into the source
+    Symbol intern(std::string_view name) {
+        auto [iter, inserted] = ids_.try_emplace(name, (Symbol) names_.size());
+        if (inserted)
+            names_.push_back(name);
+        return iter->second;
+    }
+    std::string_view name(Symbol symbol) const {
+        return names_[symbol];
     }
-    
-    virtual ~Statement() override {}
-    
 };
 
-class Program : public AST_node {
-   public:
-    vector<Statement*> children;
-    virtual void accept(Visitor& v) override {
-        v.visit(*this);
-    }
-    string tostring() {
-        string res = "program";
-        for (auto c : children)
-            res = res + "[" + c->tostring() + "]";
+// bump allocator for the nodes of a program. Nodes are never destroyed on their own, the memory of the whole
+// tree is released at once together with the arena
+class Arena {
+    static constexpr size_t CHUNK_SIZE = 64 * 1024;
+
+    std::vector<std::unique_ptr<char[]>> chunks_;
+    char* next_{nullptr};
+    size_t left_{0};
+
+    void* allocate(size_t size, size_t align) {
+        size_t pad = (align - (uintptr_t) next_ % align) % align;
+        if (pad + size > left_) {
+            size_t chunk_size = std::max(CHUNK_SIZE, size + align);
+            chunks_.push_back(std::make_unique<char[]>(chunk_size));
+            next_ = chunks_.back().get();
+            left_ = chunk_size;
+            pad = (align - (uintptr_t) next_ % align) % align;
+        }
+        void* res = next_ + pad;
+        next_ += pad + size;
+        left_ -= pad + size;
         return res;
     }
-    void addChild(Statement* child) {
-        children.push_back(child);
-    }
-    virtual ~Program() override {
-    	for (auto& c : children) {
-    		// c->~Statement();
-    		delete c;
-    	}
+
+   public:
+    template <typename T, typename... Args>
+    T* make(Args&&... args) {
+        static_assert(std::is_trivially_destructible_v<T>, "arena objects are never destroyed");
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+    template <typename T>
+    std::span<T> copy(const std::vector<T>& items) {
+        static_assert(std::is_trivially_destructible_v<T>, "arena objects are never destroyed");
+        if (items.empty())
+            return {};
+        T* data = static_cast<T*>(allocate(sizeof(T) * items.size(), alignof(T)));
+        std::uninitialized_copy(items.begin(), items.end(), data);
+        return {data, items.size()};
+    }
+    std::string_view copy(std::string_view str) {
+        char* data = static_cast<char*>(allocate(str.size(), 1));
+        std::copy(str.begin(), str.end(), data);
+        return {data, str.size()};
     }
 };
 
-class Block : Statement {
+class AST_node {
    public:
-    vector<Statement*> children;
-    string tostring() override {
-        string res = "block";
-        for (auto c : children)
-            res = res + "[" + c->tostring() + "]";
-        return res;
-    }
-    virtual void accept(Visitor& v) override {
-        v.visit(*this);
-    }
-    void addChild(Statement* child) {
-        children.push_back(child);
-    }
-    virtual ~Block() override {
-    	for (auto& c : children) {
-    		// c->~Statement();
-    		delete c;
-    	}
-    }
+    virtual void accept(Visitor& v) = 0;
+
+   protected:
+    ~AST_node() = default;
 };
 
+class Statement : public AST_node {};
+
 class Expression : public AST_node {
    public:
-    virtual string tostring() {
-        return "expression";
-    }
     virtual bool isFieldDereference() {
         return false;
     }
     virtual bool isIndexExpression() {
         return false;
     }
-    virtual bool isStringConstant() {
+    virtual bool isName() {
         return false;
     }
-    virtual ~Expression() override {};
 };
 
-class BinaryExpression : Expression {
+class Block : Statement {
    public:
-    vector<Expression*> children;
-    string op;
-    string tostring() override {
-        string res = "binaryexpression" + op;
-        for (auto c : children)
-            res = res + "[" + c->tostring() + "]";
-        return res;
+    std::span<Statement*> children;
+    virtual void accept(Visitor& v) override {
+        v.visit(*this);
     }
-    void addChild(Expression* child) {
-        children.push_back(child);
+};
+
+// the root of the tree, owns the memory of all nodes. Texts of the nodes point into the source, which has to
+// outlive the program
+class Program final : public AST_node {
+   public:
+    Arena arena;
+    SymbolTable symbols;
+    std::span<Statement*> children;
+    virtual void accept(Visitor& v) override {
+        v.visit(*this);
     }
-    void addOp(string o) {
+    ~Program() = default;
+};
+
+class BinaryExpression : Expression {
+   public:
+    Expression* children[2];
+    std::string_view op;
+    void addOp(std::string_view o) {
         op = o;
     }
     virtual void accept(Visitor& v) override {
         v.visit(*this);
     }
-    virtual ~BinaryExpression() override {
-    	for (auto& c : children) {
-    		// c->~Expression();
-    		delete c;
-    	}
-    }
 };
 
 class UnaryExpression : Expression {
    public:
-    vector<Expression*> children;
-    string op;
-    string tostring() override {
-        string res = "unaryexpression" + op;
-        for (auto c : children)
-            res = res + "[" + c->tostring() + "]";
-        return res;
-    }
-    void addChild(Expression* child) {
-        children.push_back(child);
-    }
-    void addOp(string o) {
+    Expression* child;
+    std::string_view op;
+    void addOp(std::string_view o) {
         op = o;
     }
     virtual void accept(Visitor& v) override {
         v.visit(*this);
     }
-    virtual ~UnaryExpression() override {
-    	for (auto& c : children) {
-    		// c->~Expression();
-    		delete c;
-    	}
-    }
+};
+
+// names a function binds and captures, filled in for every function by ScopeAnalysis
+struct Scope {
+    // declared with `global` in the body
+    std::span<Symbol> globals;
+    // assigned in the body itself, with the number of assignments
+    std::span<std::pair<Symbol, int>> assigned;
+    // referenced in the body or captured by a nested function
+    std::span<Symbol> free;
+    // captured by nested functions, bound here or further out
+    std::span<Symbol> captured;
+    // captured locals and arguments that are no longer assigned once the first closure over them exists
+    std::span<Symbol> value_captures;
 };
 
 class FunctionDeclaration : Expression {
    public:
-    vector<string> arguments;
+    std::span<Symbol> arguments;
     AST::Block* block;
-    string tostring() override {
-        string res = "function(";
-        for (auto c : arguments)
-            res = res + c + ",";
-        res = res + ")[" + block->tostring() + "]";
-        return res;
-    }
-    void addArg(string child) {
-        arguments.push_back(child);
-    }
+    Scope scope;
     void addBody(AST::Block* blk) {
         block = blk;
     }
     virtual void accept(Visitor& v) override {
         v.visit(*this);
     }
-    virtual ~FunctionDeclaration() override {
-    	// block->~Block();
-    	delete block;
-    }
 };
 
 class Call : Expression, Statement {
    public:
-    vector<Expression*> arguments;
+    std::span<Expression*> arguments;
     Expression* expr;
     bool isStatement = false;
-    string tostring() override {
-        string res = "call " + expr->tostring() + " with (";
-        for (auto c : arguments)
-            res = res + c->tostring() + ",";
-        res = res + ")";
-        return res;
-    }
-    void addArg(Expression* child) {
-        arguments.push_back(child);
-    }
     void addExpr(Expression* exp) {
         expr = exp;
     }
@@ -202,38 +203,24 @@ class Call : Expression, Statement {
     virtual void accept(Visitor& v) override {
         v.visit(*this);
     }
-    virtual ~Call() override {
-    	for (auto& c : arguments) {
-    		// c->~Expression();
-    		delete c;
-    	}
-    	// expr->~Expression();
-    	delete expr;
-    }
 };
 
 class FieldDereference : Expression {
    public:
     Expression* baseexpr;
-    string field;
+    Symbol field;
     void addBaseexpr(Expression* be) {
         baseexpr = be;
     }
-    void addField(string f) {
+    void addField(Symbol f) {
         field = f;
     }
-    virtual string tostring() override {
-        return baseexpr->tostring() + "." + field;
-    }
     virtual void accept(Visitor& v) override {
         v.visit(*this);
     }
     bool isFieldDereference() override {
         return true;
     }
-    virtual ~FieldDereference() override {
-    	delete baseexpr;
-    }
 };
 
 class IndexExpression : Expression {
@@ -246,152 +233,113 @@ class IndexExpression : Expression {
     void addIndex(Expression* idx) {
         index = idx;
     }
-    virtual string tostring() override {
-        return baseexpr->tostring() + "[" + index->tostring() + "]";
-    }
     virtual void accept(Visitor& v) override {
         v.visit(*this);
     }
     bool isIndexExpression() override {
         return true;
     }
-    virtual ~IndexExpression() override {
-    	delete baseexpr;
-    	delete index;
-    }
 };
 
 class Record : Expression {
    public:
-    vector<pair<string, Expression*>> dict;
-
-    void addMap(string str, Expression* expr) {
-        dict.push_back({str, expr});
-    }
-    string tostring() override {
-        string res = "{";
-        for (auto p : dict)
-            res = res + p.first + "->" + p.second->tostring() + ",";
-        res = res + "}";
-        return res;
-    }
+    std::span<pair<Symbol, Expression*>> dict;
     virtual void accept(Visitor& v) override {
         v.visit(*this);
     }
-    virtual ~Record() override {
-    	for (auto& p : dict) {
-    		delete p.second;
-    	}
-    }
 };
 
 class IntegerConstant : Expression {
    public:
-    string val;  //enough ?
-    void addVal(string v) {
+    std::string_view val;
+    void addVal(std::string_view v) {
         val = v;
     }
-    string tostring() override {
-        return val;
-    }
     virtual void accept(Visitor& v) override {
         v.visit(*this);
     }
     int getVal() {
-        return stoi(val);
+        return stoi(string(val));
     }
-    virtual ~IntegerConstant() override {}
 };
 
 class StringConstant : Expression {
    public:
-    string val;
-    void addVal(string v) {
+    // without the quotes and with escape sequences replaced
+    std::string_view val;
+    void addVal(std::string_view v) {
         val = v;
     }
-    virtual string tostring() override {
-        return val;
-    }
     virtual void accept(Visitor& v) override {
         v.visit(*this);
     }
-    string getVal() {
+    std::string_view getVal() {
         return val;
     }
-    bool isStringConstant() override {
+};
+
+// a variable
+class Name : Expression {
+   public:
+    Symbol name;
+    void addName(Symbol n) {
+        name = n;
+    }
+    virtual void accept(Visitor& v) override {
+        v.visit(*this);
+    }
+    bool isName() override {
         return true;
     }
-    virtual ~StringConstant() override {}
 };
 
 class BoolConstant : Expression {
    public:
-    string val;
-    void addVal(string v) {
+    bool val;
+    void addVal(bool v) {
         val = v;
     }
-    string tostring() override {
-        return val;
-    }
     virtual void accept(Visitor& v) override {
         v.visit(*this);
     }
     bool getVal() {
-        return val == "true";
+        return val;
     }
-    virtual ~BoolConstant() override {}
 };
 
 class NoneConstant : Expression {
    public:
-    string tostring() override {
-        return "None";
-    }
     virtual void accept(Visitor& v) override {
         v.visit(*this);
     }
-    virtual ~NoneConstant() override {}
 };
 
 class Global : Statement {
    public:
-    string name;
-    string tostring() override {
-        return "global";
-    }
-    void addName(string n) {
+    Symbol name;
+    void addName(Symbol n) {
         name = n;
     }
     virtual void accept(Visitor& v) override {
         v.visit(*this);
     }
-    virtual ~Global() override {}
 };
 
 class Return : Statement {
    public:
     AST::Expression* Expr;
-    string tostring() override {
-        return "return " + Expr->tostring();
-    }
     void addExpr(AST::Expression* expr) {
         Expr = expr;
     }
     virtual void accept(Visitor& v) override {
         v.visit(*this);
     }
-    virtual ~Return() override {
-    	delete Expr;
-    }
 };
 
 class Assignment : Statement {
    public:
     AST::Expression* Lhs;
     AST::Expression* Expr;
-    string tostring() override {
-        return "assignment " + Lhs->tostring() + " = " + Expr->tostring();
-    }
     void addLhs(AST::Expression* lhs) {
         Lhs = lhs;
     }
@@ -401,65 +349,32 @@ class Assignment : Statement {
     virtual void accept(Visitor& v) override {
         v.visit(*this);
     }
-    virtual ~Assignment() override {
-    	delete Lhs;
-    	delete Expr;
-    }
 };
 
 class IfStatement : Statement {
    public:
-    vector<Block*> children;
+    Block* block;
+    // nullptr without an else branch
+    Block* else_block = nullptr;
     Expression* Expr;
-    string tostring() override {
-        string res = "if " + Expr->tostring() + " statement";
-        for (auto c : children)
-            res = res + "[" + c->tostring() + "]";
-        return res;
-    }
-    void addChild(Block* child) {
-        children.push_back(child);
-    }
     void addExpr(AST::Expression* expr) {
         Expr = expr;
     }
     virtual void accept(Visitor& v) override {
         v.visit(*this);
     }
-    virtual ~IfStatement() override {
-    	delete Expr;
-    	for (auto& c : children) {
-    		delete c;
-    	}
-    }
 };
 
 class WhileLoop : Statement {
    public:
-    vector<Block*> children;
+    Block* block;
     Expression* Expr;
-    string tostring() override {
-        string res = "while " + Expr->tostring() + " do";
-        for (auto c : children)
-            res = res + "[" + c->tostring() + "]";
-        return res;
-    }
-    void addChild(Block* child) {
-        children.push_back(child);
-    }
     void addExpr(AST::Expression* expr) {
         Expr = expr;
     }
     virtual void accept(Visitor& v) override {
         v.visit(*this);
     }
-    virtual ~WhileLoop() override {
-    	delete Expr;
-    	for (auto& c : children) {
-    		delete c;
-    	}
-    	
-    }
 };
 
 }
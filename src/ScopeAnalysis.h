@@ -0,0 +1,167 @@
+#pragma once
+
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "AST.h"
+#include "Visitor.h"
+
+using namespace std;
+
+// Fills in the scope of every function in one walk over the program. Each function only sees its own body,
+// what nested functions capture is handed to the function around them once their body is done, so no part
+// of the tree is visited more than once however deep functions are nested.
+class ScopeAnalysis : public Visitor {
+    struct Frame {
+        // index of the statement of the body that is being visited
+        int statement = 0;
+        vector<AST::Symbol> globals;
+        vector<pair<AST::Symbol, int>> assigned;
+        unordered_map<AST::Symbol, size_t> assigned_index;
+        vector<AST::Symbol> free;
+        unordered_set<AST::Symbol> free_set;
+        vector<AST::Symbol> captured;
+        // statement of the last assignment and of the first closure capturing each name, arguments are
+        // assigned before the first statement
+        unordered_map<AST::Symbol, int> last_assign;
+        unordered_map<AST::Symbol, int> first_capture;
+    };
+
+    AST::Arena& arena_;
+    vector<Frame> frames_;
+
+    void reference(AST::Symbol s) {
+        Frame& frame = frames_.back();
+        if (frame.free_set.insert(s).second)
+            frame.free.push_back(s);
+    }
+
+   public:
+    explicit ScopeAnalysis(AST::Program& program) : arena_(program.arena) {}
+
+    void visit(AST::Program& expr) {
+        frames_.emplace_back();
+        for (auto c : expr.children)
+            c->accept(*((Visitor*)this));
+        frames_.pop_back();
+    }
+
+    void visit(AST::Block& expr) {
+        for (auto c : expr.children)
+            c->accept(*((Visitor*)this));
+    }
+
+    void visit(AST::Global& expr) {
+        frames_.back().globals.push_back(expr.name);
+    }
+
+    void visit(AST::Return& expr) {
+        expr.Expr->accept(*((Visitor*)this));
+    }
+
+    void visit(AST::Assignment& expr) {
+        expr.Expr->accept(*((Visitor*)this));
+        expr.Lhs->accept(*((Visitor*)this));
+        if (expr.Lhs->isName()) {
+            AST::Symbol s = ((AST::Name*)expr.Lhs)->name;
+            Frame& frame = frames_.back();
+            auto [iter, inserted] = frame.assigned_index.try_emplace(s, frame.assigned.size());
+            if (inserted)
+                frame.assigned.push_back({s, 0});
+            frame.assigned[iter->second].second++;
+            frame.last_assign[s] = frame.statement;
+        }
+    }
+
+    void visit(AST::IfStatement& expr) {
+        expr.Expr->accept(*((Visitor*)this));
+        expr.block->accept(*((Visitor*)this));
+        if (expr.else_block)
+            expr.else_block->accept(*((Visitor*)this));
+    }
+
+    void visit(AST::WhileLoop& expr) {
+        expr.Expr->accept(*((Visitor*)this));
+        expr.block->accept(*((Visitor*)this));
+    }
+
+    void visit(AST::BinaryExpression& expr) {
+        for (auto c : expr.children)
+            c->accept(*((Visitor*)this));
+    }
+
+    void visit(AST::UnaryExpression& expr) {
+        expr.child->accept(*((Visitor*)this));
+    }
+
+    void visit(AST::FunctionDeclaration& expr) {
+        frames_.emplace_back();
+        for (auto s : expr.arguments)
+            frames_.back().last_assign[s] = -1;
+        for (size_t i = 0; i < expr.block->children.size(); i++) {
+            frames_.back().statement = (int) i;
+            expr.block->children[i]->accept(*((Visitor*)this));
+        }
+        Frame frame = std::move(frames_.back());
+        frames_.pop_back();
+
+        // captured variables that are never assigned once the first closure over them exists. Closures only
+        // ever see one value of them, so they can get a copy instead of a reference. Statements are the unit,
+        // a variable assigned and captured in the same statement (like a loop body) stays shared
+        vector<AST::Symbol> value_captures;
+        for (auto s : frame.captured) {
+            auto last = frame.last_assign.find(s);
+            if (last != frame.last_assign.end() && last->second < frame.first_capture[s])
+                value_captures.push_back(s);
+        }
+
+        unordered_set<AST::Symbol> bound(frame.globals.begin(), frame.globals.end());
+        bound.insert(expr.arguments.begin(), expr.arguments.end());
+        for (const auto& p : frame.assigned)
+            bound.insert(p.first);
+        Frame& outer = frames_.back();
+        for (auto s : frame.free) {
+            if (bound.contains(s))
+                continue;
+            reference(s);
+            if (outer.first_capture.try_emplace(s, outer.statement).second)
+                outer.captured.push_back(s);
+        }
+
+        expr.scope.globals = arena_.copy(frame.globals);
+        expr.scope.assigned = arena_.copy(frame.assigned);
+        expr.scope.free = arena_.copy(frame.free);
+        expr.scope.captured = arena_.copy(frame.captured);
+        expr.scope.value_captures = arena_.copy(value_captures);
+    }
+
+    void visit(AST::Call& expr) {
+        expr.expr->accept(*((Visitor*)this));
+        for (auto c : expr.arguments)
+            c->accept(*((Visitor*)this));
+    }
+
+    void visit(AST::FieldDereference& expr) {
+        expr.baseexpr->accept(*((Visitor*)this));
+    }
+
+    void visit(AST::IndexExpression& expr) {
+        expr.baseexpr->accept(*((Visitor*)this));
+        expr.index->accept(*((Visitor*)this));
+    }
+
+    void visit(AST::Record& expr) {
+        for (auto p : expr.dict)
+            p.second->accept(*((Visitor*)this));
+    }
+
+    void visit(AST::Name& expr) {
+        reference(expr.name);
+    }
+
+    void visit(AST::StringConstant& expr) {}
+    void visit(AST::IntegerConstant& expr) {}
+    void visit(AST::BoolConstant& expr) {}
+    void visit(AST::NoneConstant& expr) {}
+};
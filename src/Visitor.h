@@ -21,6 +21,7 @@ class IndexExpression;
 class Record;
 class IntegerConstant;
 class StringConstant;
+class Name;
 class BoolConstant;
 class NoneConstant;
 class Global;
@@ -44,6 +45,7 @@ class Visitor {
     virtual void visit(AST::Record& expr) = 0;
     virtual void visit(AST::IntegerConstant& expr) = 0;
     virtual void visit(AST::StringConstant& expr) = 0;
+    virtual void visit(AST::Name& expr) = 0;
     virtual void visit(AST::BoolConstant& expr) = 0;
     virtual void visit(AST::NoneConstant& expr) = 0;
     virtual void visit(AST::Global& expr) = 0;
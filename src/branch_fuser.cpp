@@ -0,0 +1,95 @@
+#include "value.h"
+#include "ir.h"
+#include "branch_fuser.h"
+#include <utility>
+
+BranchFuser::BranchFuser(IR::Program* prog) : prog_(prog){}
+
+static bool is_compare(IR::Operation op) {
+    return op == IR::Operation::GT || op == IR::Operation::GEQ || op == IR::Operation::EQ_INT ||
+           op == IR::Operation::GT_UNBOXED || op == IR::Operation::GEQ_UNBOXED;
+}
+
+void BranchFuser::fuse_function(IR::Function& fun) {
+    // uses of each register other than asserting that it is a bool, which a comparison always is
+    std::vector<int> uses(fun.virt_reg_count, 0);
+    auto use = [&](const IR::Operand& op) {
+        if (op.type == IR::Operand::VIRT_REG)
+            uses[op.index]++;
+    };
+    for (const auto& block : fun.blocks) {
+        for (const auto& pn : block.phi_nodes)
+            for (const auto& arg : pn.args)
+                use(arg.second);
+        for (const auto& ins : block.instructions)
+            if (ins.op != IR::Operation::ASSERT_BOOL)
+                for (const auto& arg : ins.args)
+                    use(arg);
+    }
+    for (const auto& state : fun.deopt_states) {
+        for (const auto& value : state.values)
+            use(value.second);
+        for (const auto& operand : state.operands)
+            use(operand);
+    }
+
+    // index of the instruction defining a register in the block, or -1
+    auto find_def = [](const IR::BasicBlock& block, size_t end, const IR::Operand& reg) {
+        for (size_t k = end; k-- > 0;)
+            if (block.instructions[k].out == reg)
+                return (int) k;
+        return -1;
+    };
+    std::vector<bool> fused(fun.virt_reg_count, false);
+    for (auto& block : fun.blocks) {
+        if (block.instructions.empty() || block.instructions.back().op != IR::Operation::BRANCH)
+            continue;
+        IR::Operand cond = block.instructions.back().args[0];
+        if (cond.type != IR::Operand::VIRT_REG || uses[cond.index] != 1)
+            continue;
+        int def = find_def(block, block.instructions.size() - 1, cond);
+        if (def == -1)
+            continue;
+        // `a < b` is compiled as NOT(a >= b), branch on the comparison with the targets swapped
+        int negation = -1;
+        if (block.instructions[def].op == IR::Operation::NOT) {
+            IR::Operand negated = block.instructions[def].args[0];
+            if (negated.type != IR::Operand::VIRT_REG || uses[negated.index] != 1)
+                continue;
+            negation = def;
+            def = find_def(block, negation, negated);
+            if (def == -1)
+                continue;
+        }
+        const IR::Instruction cmp = block.instructions[def];
+        if (!is_compare(cmp.op))
+            continue;
+
+        // the comparison moves down to the branch, its operands are not reassigned in between
+        fused[cond.index] = true;
+        fused[cmp.out.index] = true;
+        block.instructions.back() = {IR::Operation::CMP_BRANCH, {}, {cmp.args[0], cmp.args[1], {IR::Operand::LOGICAL, (int) cmp.op}}};
+        if (negation != -1) {
+            std::swap(block.successors.front(), block.successors.back());
+            block.instructions.erase(block.instructions.begin() + negation);
+        }
+        block.instructions.erase(block.instructions.begin() + def);
+    }
+
+    for (auto& block : fun.blocks) {
+        std::vector<IR::Instruction> new_ins;
+        for (const auto& ins : block.instructions) {
+            if (ins.op == IR::Operation::ASSERT_BOOL && ins.args[0].type == IR::Operand::VIRT_REG && fused[ins.args[0].index])
+                continue;
+            new_ins.push_back(ins);
+        }
+        block.instructions = new_ins;
+    }
+}
+
+IR::Program* BranchFuser::optimize() {
+    for (size_t i = 0; i < prog_->functions.size(); i++)
+        if (prog_->optimizes(i))
+            fuse_function(prog_->functions[i]);
+    return prog_;
+}
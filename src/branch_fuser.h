@@ -0,0 +1,15 @@
+#pragma once
+
+#include "value.h"
+#include "ir.h"
+
+class BranchFuser {
+private:
+    IR::Program* prog_;
+public:
+    BranchFuser(IR::Program* prog);
+    // runs last, turns a comparison only used by the BRANCH of its block into a CMP_BRANCH
+    IR::Program* optimize();
+
+    void fuse_function(IR::Function& fun);
+};
@@ -1,9 +1,27 @@
 #include "codegen.h"
+#include <algorithm>
 #include <stack>
 #include "value.h"
 #include <cassert>
 #include <cstddef>
 #include <bitset>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <type_traits>
+#include "build_id.h"
+#include "branch_fuser.h"
+#include "const_propagator.h"
+#include "dead_code_remover.h"
+#include "escape_analysis.h"
+#include "inliner.h"
+#include "invariant_hoister.h"
+#include "irprinter.h"
+#include "shape_analysis.h"
+#include "speculator.h"
+#include "type_inferer.h"
+#include "unboxer.h"
+#include "value_numberer.h"
 
 namespace codegen {
 
@@ -14,45 +32,561 @@ class MyErrorHandler : public asmjit::ErrorHandler {
     }
 };
 
-Executable::Executable(IR::Program program, bool emit_code) : ctx_ptr(program.ctx_ptr) {
+// offset of the layout pointer from a tagged record pointer
+const int32_t RECORD_LAYOUT_OFFSET = (int32_t) offsetof(runtime::Record, layout) - runtime::RECORD_TAG;
+
+// runtime functions called by generated code, images refer to them by their index here
+const void* const EXTERN_FUNCTIONS[] = {
+    reinterpret_cast<const void*>(runtime::value_add_nonint),
+    reinterpret_cast<const void*>(runtime::extern_eq),
+    reinterpret_cast<const void*>(runtime::extern_rec_load_name),
+    reinterpret_cast<const void*>(runtime::extern_rec_load_name_cached),
+    reinterpret_cast<const void*>(runtime::extern_rec_load_index),
+    reinterpret_cast<const void*>(runtime::extern_rec_store_name),
+    reinterpret_cast<const void*>(runtime::extern_rec_store_name_cached),
+    reinterpret_cast<const void*>(runtime::extern_rec_store_index),
+    reinterpret_cast<const void*>(runtime::extern_print),
+    reinterpret_cast<const void*>(runtime::extern_input),
+    reinterpret_cast<const void*>(runtime::extern_intcast),
+    reinterpret_cast<const void*>(runtime::extern_remember),
+    reinterpret_cast<const void*>(runtime::extern_alloc_traced),
+    reinterpret_cast<const void*>(runtime::trace_collect),
+};
+
+// images are only valid for the build of the compiler that wrote them. The hash covers the compiler sources, see
+// cmake/build_id.cmake
+const char BUILD_ID[] = BUILD_ID_HASH;
+const std::string_view IMAGE_MAGIC{"mitscriptc image"};
+
+// address a relocation refers to, without the addend
+static auto relocation_target(runtime::ProgramContext* ctx, const std::vector<runtime::Value>& immediates,
+                              const Relocation& reloc) -> uint64_t {
+    switch (reloc.kind) {
+        case Relocation::CONTEXT:
+            return reinterpret_cast<uint64_t>(ctx);
+        case Relocation::GLOBALS:
+            return reinterpret_cast<uint64_t>(ctx->globals);
+        case Relocation::FUNCTION_ENTRY:
+            return reinterpret_cast<uint64_t>(&ctx->function_table[reloc.index]);
+        case Relocation::LAYOUT_TABLE:
+            return reinterpret_cast<uint64_t>(ctx->layout_tables[reloc.index]);
+        case Relocation::INLINE_CACHE:
+            return reinterpret_cast<uint64_t>(&ctx->inline_caches[reloc.index]);
+        case Relocation::IMMEDIATE:
+            return immediates[reloc.index];
+        case Relocation::NURSERY_PAGE:
+            return ctx->nursery_page;
+        case Relocation::EXTERN_FUNCTION:
+            return reinterpret_cast<uint64_t>(EXTERN_FUNCTIONS[reloc.index]);
+    }
+    assert(false);
+    return 0;
+}
+
+Executable::Executable(IR::Program program1, const CompileOptions& options1)
+    : program(std::move(program1)), ctx_ptr(program.ctx_ptr), options(options1) {
     using namespace asmjit;
     MyErrorHandler handler;
     FileLogger logger(stdout);
 
+    if (options.aot || options.optimized_ir) {
+        // an image holds the final code of every function, and optimized IR can only be compiled as it is
+        options.use_tiering = false;
+        options.use_speculation = false;
+    }
+
+    size_t num_functions = program.functions.size();
+    Speculator speculator(&program);
+    for (size_t sites : speculator.number_sites()) {
+        ctx_ptr->type_feedback.emplace_back(sites, 0);
+    }
+    original_functions = program.functions;
+
+    // the top level function runs only once and there is no on stack replacement, so if it contains
+    // loops it has to start out optimized
+    bool optimize_top_level = !options.use_tiering;
+    for (const auto& block : program.functions.back().blocks) {
+        optimize_top_level = optimize_top_level || block.is_loop_header;
+    }
+    if (optimize_top_level && !options.optimized_ir) {
+        optimize_program(options.use_tiering ? (int) num_functions - 1 : -1);
+    }
+
+    std::vector<bool> baseline(num_functions, options.use_tiering);
+    baseline.back() = !optimize_top_level;
+    std::vector<IR::Function> functions;
+    for (size_t i = 0; i < num_functions; ++i) {
+        if (baseline[i]) {
+            functions.push_back(original_functions[i]);
+            IR::assign_stack_slots(functions[i]);
+        } else {
+            functions.push_back(program.functions[i]);
+            allocate_optimized(functions[i]);
+        }
+    }
+
+    ctx_ptr->init_globals(program.num_globals);
+    ctx_ptr->init_layouts(program.struct_layouts);
+    ctx_ptr->function_table.resize(num_functions, runtime::FunctionEntry{0, TIER_UP_HOTNESS});
+    ctx_ptr->start_dynamic_alloc();
+
     CodeHolder code;
     code.init(jit_rt.environment());
     code.setErrorHandler(&handler);
-    if (emit_code) {
+    if (options.emit_code) {
         code.setLogger(&logger);
     }
 
-    CodeGenerator generator{program, &code};
-    program.ctx_ptr = nullptr;
+    CodeGenerator generator{program, &code, options.aot};
+    generator.generate_prelude(options.use_tiering ? this : nullptr);
+    for (size_t i = 0; i < num_functions; ++i) {
+        generator.process_function(i, functions[i], baseline[i]);
+    }
+
+    // the prelude comes first and starts with the entry point
+    uint64_t base = add_code(code, generator);
+    this->function = reinterpret_cast<int (*)()>(base);
+    if (options.aot) {
+        image_code_size = code.codeSize();
+        relocations = generator.get_relocations();
+    }
+    for (size_t i = 0; i < num_functions; ++i) {
+        ctx_ptr->function_table[i].code = base + code.labelOffsetFromBase(generator.get_function_label(i));
+    }
+    if (options.use_tiering) {
+        for (const auto& label : generator.get_prelude_labels()) {
+            prelude_addresses.push_back(base + code.labelOffsetFromBase(label));
+        }
+        baseline_code.resize(num_functions);
+        for (size_t i = 0; i < num_functions; ++i) {
+            baseline_code[i].entry = ctx_ptr->function_table[i].code;
+            // rounded up as in process_function
+            baseline_code[i].frame_slots = functions[i].stack_slots + functions[i].stack_slots % 2;
+            baseline_code[i].sites.resize(ctx_ptr->type_feedback[i].size());
+        }
+        for (const auto& [func_index, site, label] : generator.get_site_labels()) {
+            baseline_code[func_index].sites[site] = base + code.labelOffsetFromBase(label);
+        }
+        program.functions.back() = original_functions.back();
+    }
+}
 
-    Error err = this->jit_rt.add(&this->function, &code);
+Executable::~Executable() {
+    for (void* buffer : code_buffers) {
+        this->jit_rt.release(buffer);
+    }
+}
+
+auto Executable::add_code(asmjit::CodeHolder& code, const CodeGenerator& generator) -> uint64_t {
+    using namespace asmjit;
+    void* buffer{nullptr};
+    Error err = this->jit_rt.add(&buffer, &code);
     if (err) {
         std::cout << DebugUtils::errorAsString(err) << std::endl;
     }
+    code_buffers.push_back(buffer);
+    // stack maps are keyed by the absolute return address of each safepoint
+    auto base = reinterpret_cast<uint64_t>(buffer);
+    for (const auto& [label, offsets] : generator.get_safepoints()) {
+        ctx_ptr->stack_maps[base + code.labelOffsetFromBase(label)] = offsets;
+    }
+    return base;
 }
 
-Executable::~Executable() {
-    this->jit_rt.release(this->function);
-    delete this->ctx_ptr;
+auto Executable::get_program() const -> const IR::Program& {
+    return program;
+}
+
+auto Executable::save_image(uint64_t key) const -> std::string {
+    assert(options.aot && code_buffers.size() == 1);
+    auto base = reinterpret_cast<uint64_t>(code_buffers.front());
+    serialize::Writer out;
+    out.put_bytes(IMAGE_MAGIC);
+    out.put(key);
+    out.put_string({reinterpret_cast<const char*>(base), image_code_size});
+    out.put<uint32_t>(relocations.size());
+    for (const Relocation& reloc : relocations) {
+        out.put(reloc.offset);
+        out.put(reloc.kind);
+        out.put(reloc.index);
+        out.put(reloc.addend);
+    }
+    out.put<uint32_t>(ctx_ptr->function_table.size());
+    for (const runtime::FunctionEntry& entry : ctx_ptr->function_table) {
+        out.put<uint32_t>(entry.code - base);
+    }
+    out.put<uint32_t>(ctx_ptr->stack_maps.size());
+    for (const auto& [address, offsets] : ctx_ptr->stack_maps) {
+        out.put<uint32_t>(address - base);
+        out.put<uint32_t>(offsets.size());
+        for (int32_t offset : offsets) {
+            out.put(offset);
+        }
+    }
+    out.put<uint32_t>(ctx_ptr->inline_caches.size());
+    out.put<uint32_t>(program.num_globals);
+    out.put<uint32_t>(program.immediates.size());
+    for (runtime::Value val : program.immediates) {
+        out.put_value(ctx_ptr, val);
+    }
+    out.put<uint32_t>(program.struct_layouts.size());
+    for (const auto& fields : program.struct_layouts) {
+        out.put<uint32_t>(fields.size());
+        for (runtime::Value field : fields) {
+            out.put_value(ctx_ptr, field);
+        }
+    }
+    return out.data();
+}
+
+auto Image::read(std::string_view data) -> bool {
+    serialize::Reader reader(data);
+    if (reader.get_bytes(IMAGE_MAGIC.size()) != IMAGE_MAGIC) {
+        return false;
+    }
+    key = reader.get<uint64_t>();
+    code = reader.get_string();
+    relocations.resize(reader.get_count());
+    for (Relocation& reloc : relocations) {
+        reloc.offset = reader.get<uint32_t>();
+        reloc.kind = reader.get<Relocation::Kind>();
+        reloc.index = reader.get<uint32_t>();
+        reloc.addend = reader.get<int64_t>();
+    }
+    function_offsets.resize(reader.get_count());
+    for (uint32_t& offset : function_offsets) {
+        offset = reader.get<uint32_t>();
+    }
+    safepoints.resize(reader.get_count());
+    for (auto& [offset, stack_words] : safepoints) {
+        offset = reader.get<uint32_t>();
+        stack_words.resize(reader.get_count());
+        for (int32_t& word : stack_words) {
+            word = reader.get<int32_t>();
+        }
+    }
+    num_inline_caches = reader.get<uint32_t>();
+    num_globals = reader.get<uint32_t>();
+    immediates.resize(reader.get_count());
+    for (serialize::SavedValue& val : immediates) {
+        val = reader.get_value();
+    }
+    struct_layouts.resize(reader.get_count());
+    for (auto& fields : struct_layouts) {
+        fields.resize(reader.get_count());
+        for (serialize::SavedValue& field : fields) {
+            field = reader.get_value();
+        }
+    }
+    if (!reader.done() || function_offsets.empty()) {
+        return false;
+    }
+
+    // everything the loader indexes or patches has to be within the image
+    for (uint32_t offset : function_offsets) {
+        if (offset >= code.size()) {
+            return false;
+        }
+    }
+    for (const auto& [offset, stack_words] : safepoints) {
+        if (offset > code.size()) {
+            return false;
+        }
+    }
+    for (const Relocation& reloc : relocations) {
+        size_t size = reloc.kind == Relocation::NURSERY_PAGE ? 4 : 8;
+        size_t limit = 1;
+        if (reloc.kind == Relocation::FUNCTION_ENTRY) {
+            limit = function_offsets.size();
+        } else if (reloc.kind == Relocation::LAYOUT_TABLE) {
+            limit = struct_layouts.size();
+        } else if (reloc.kind == Relocation::INLINE_CACHE) {
+            limit = num_inline_caches;
+        } else if (reloc.kind == Relocation::IMMEDIATE) {
+            limit = immediates.size();
+        } else if (reloc.kind == Relocation::EXTERN_FUNCTION) {
+            limit = std::size(EXTERN_FUNCTIONS);
+        } else if (reloc.kind > Relocation::EXTERN_FUNCTION) {
+            return false;
+        }
+        if (reloc.index >= limit || reloc.offset > code.size() || code.size() - reloc.offset < size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+auto cache_key(std::string_view source, const CompileOptions& options, size_t heap_size) -> uint64_t {
+    // 64 bit FNV-1a
+    uint64_t hash = 0xcbf29ce484222325;
+    auto add = [&hash](const void* data, size_t size) {
+        for (size_t i = 0; i < size; ++i) {
+            hash = (hash ^ static_cast<const uint8_t*>(data)[i]) * 0x100000001b3;
+        }
+    };
+    static_assert(std::has_unique_object_representations_v<CompileOptions>, "options are hashed by their bytes");
+    bool use_avx512 = asmjit::CpuInfo::host().hasFeature(asmjit::x86::Features::kAVX512_F);
+    add(source.data(), source.size());
+    add(&options, sizeof(options));
+    add(&heap_size, sizeof(heap_size));
+    add(&use_avx512, sizeof(use_avx512));
+    add(BUILD_ID, sizeof(BUILD_ID));
+    return hash;
+}
+
+Executable::Executable(const Image& image, size_t heap_size)
+    : program(heap_size), ctx_ptr(program.ctx_ptr) {
+    using namespace asmjit;
+    options.aot = true;
+    options.use_tiering = false;
+    options.use_speculation = false;
+
+    program.num_globals = (int) image.num_globals;
+    // strings are allocated while the context is still in static allocation mode, like the constants of a
+    // compiled program
+    for (const serialize::SavedValue& val : image.immediates) {
+        program.immediates.push_back(serialize::to_value(ctx_ptr, val));
+    }
+    for (const auto& fields : image.struct_layouts) {
+        std::vector<runtime::Value>& layout = program.struct_layouts.emplace_back();
+        for (const serialize::SavedValue& field : fields) {
+            layout.push_back(serialize::to_value(ctx_ptr, field));
+        }
+    }
+
+    ctx_ptr->init_globals(program.num_globals);
+    ctx_ptr->init_layouts(program.struct_layouts);
+    ctx_ptr->function_table.resize(image.function_offsets.size(), runtime::FunctionEntry{0, TIER_UP_HOTNESS});
+    ctx_ptr->inline_caches.resize(image.num_inline_caches);
+    ctx_ptr->start_dynamic_alloc();
+
+    std::string code_bytes(image.code);
+    for (const Relocation& reloc : image.relocations) {
+        uint64_t address = relocation_target(ctx_ptr, program.immediates, reloc) + reloc.addend;
+        if (reloc.kind == Relocation::NURSERY_PAGE) {
+            assert(address <= (uint64_t) std::numeric_limits<int32_t>::max());
+            auto page = (int32_t) address;
+            std::memcpy(&code_bytes[reloc.offset], &page, sizeof(page));
+        } else {
+            std::memcpy(&code_bytes[reloc.offset], &address, sizeof(address));
+        }
+    }
+    relocations = image.relocations;
+    image_code_size = code_bytes.size();
+
+    CodeHolder code;
+    code.init(jit_rt.environment());
+    x86::Assembler assembler(&code);
+    assembler.embed(code_bytes.data(), code_bytes.size());
+    void* buffer{nullptr};
+    Error err = this->jit_rt.add(&buffer, &code);
+    if (err) {
+        std::cout << DebugUtils::errorAsString(err) << std::endl;
+    }
+    code_buffers.push_back(buffer);
+
+    auto base = reinterpret_cast<uint64_t>(buffer);
+    this->function = reinterpret_cast<int (*)()>(base);
+    for (size_t i = 0; i < image.function_offsets.size(); ++i) {
+        ctx_ptr->function_table[i].code = base + image.function_offsets[i];
+    }
+    for (const auto& [offset, stack_words] : image.safepoints) {
+        ctx_ptr->stack_maps[base + offset] = stack_words;
+    }
+}
+
+void Executable::optimize_program(int only_function) {
+    IR::Program* prog = &program;
+    prog->only_function = only_function;
+    Speculator speculator(prog);
+    if (options.use_tiering && options.use_speculation) {
+        prog = speculator.insert_guards(ctx_ptr->type_feedback);
+    }
+    if (options.emit_code) {
+        std::cout << *prog << std::endl;
+    }
+    if (options.use_inlining) {
+        Inliner inliner(prog);
+        prog = inliner.optimize();
+    }
+    if (options.use_const_propagation) {
+        ConstPropagator c_prop(prog);
+        prog = c_prop.optimize();
+    }
+    if (options.use_dead_code_removal) {
+        DeadCodeRemover dc_opt(prog);
+        prog = dc_opt.optimize();
+    }
+    if (options.use_type_inference) {
+        TypeInferer ti_opt(prog);
+        prog = ti_opt.optimize();
+    }
+    if (options.use_shape_analysis) {
+        ShapeAnalysis sa_opt(prog);
+        prog = sa_opt.optimize();
+    }
+    if (options.use_escape_analysis) {
+        EscapeAnalysis ea_opt(prog);
+        prog = ea_opt.optimize();
+    }
+    // also specializes on ints known from assertions when nothing was speculated
+    prog = speculator.specialize();
+    if (options.use_gvn) {
+        ValueNumberer numberer(prog);
+        prog = numberer.optimize();
+    }
+    if (options.use_licm) {
+        InvariantHoister hoister(prog);
+        prog = hoister.optimize();
+    }
+    if (options.use_unboxing) {
+        Unboxer unboxer(prog);
+        prog = unboxer.optimize();
+    }
+    if (options.use_branch_fusion) {
+        BranchFuser fuser(prog);
+        prog = fuser.optimize();
+    }
+    if (options.emit_code) {
+        std::cout << *prog << std::endl;
+    }
+    prog->only_function = -1;
+}
+
+void Executable::allocate_optimized(IR::Function& func) const {
+    // linear scan splits values around the uses of their register, which inside a loop means moves on every
+    // iteration. Functions without loops gain little from coloring. Coloring never splits either, so in a
+    // loop with a call everything live across the call stays in a stack slot for the whole loop, where
+    // linear scan only spills it around the call
+    auto depths = IR::compute_loop_depths(func);
+    bool has_loop = false;
+    bool calls_in_loop = false;
+    for (size_t i = 0; i < func.blocks.size(); ++i) {
+        has_loop = has_loop || depths[i] > 0;
+        for (const IR::Instruction& instr : func.blocks[i].instructions) {
+            calls_in_loop = calls_in_loop || (depths[i] > 0 && instr.op == IR::Operation::EXEC_CALL);
+        }
+    }
+    if (options.use_graph_coloring && has_loop && !calls_in_loop
+        && func.virt_reg_count <= GRAPH_COLORING_MAX_REGS) {
+        IR::allocate_registers_coloring(func);
+    } else {
+        IR::allocate_registers(func);
+    }
+}
+
+auto Executable::compile_optimized(size_t func_index) -> uint64_t {
+    using namespace asmjit;
+    MyErrorHandler handler;
+    FileLogger logger(stdout);
+
+    IR::Function& func = optimized_functions.emplace_back(program.functions[func_index]);
+    allocate_optimized(func);
+
+    CodeHolder code;
+    code.init(jit_rt.environment());
+    code.setErrorHandler(&handler);
+    if (options.emit_code) {
+        code.setLogger(&logger);
+    }
+
+    CodeGenerator generator{program, &code, options.aot};
+    generator.link_prelude(this, prelude_addresses);
+    generator.process_function(func_index, func, false);
+
+    uint64_t base = add_code(code, generator);
+    return base + code.labelOffsetFromBase(generator.get_function_label(func_index));
+}
+
+auto Executable::tier_up(Executable* executable, uint64_t func_index) -> uint64_t {
+    runtime::ProgramContext* ctx = executable->ctx_ptr;
+    runtime::FunctionEntry& entry = ctx->function_table[func_index];
+    // baseline frames of the function which are still running keep counting down
+    entry.hotness = std::numeric_limits<int64_t>::max();
+
+    // only this function is optimized, with the feedback gathered so far. Afterwards it goes back to the
+    // original IR, which is what the inliner copies into other functions
+    // constants folded by the passes end up in generated code, so they must not be allocated on the heap
+    int region = ctx->current_region;
+    ctx->current_region = runtime::STATIC_REGION;
+    executable->optimize_program((int) func_index);
+    entry.code = executable->compile_optimized(func_index);
+    executable->program.functions[func_index] = executable->original_functions[func_index];
+    ctx->current_region = region;
+    return entry.code;
+}
+
+auto Executable::deoptimize(Executable* executable, uint64_t func_index, uint64_t site, const IR::DeoptState* map,
+                            const uint64_t* saved_regs, uint64_t* frame) -> const DeoptExit* {
+    runtime::ProgramContext* ctx = executable->ctx_ptr;
+    const BaselineCode& baseline = executable->baseline_code[func_index];
+    auto read = [&](const IR::Operand& op) -> runtime::Value {
+        switch (op.type) {
+            case IR::Operand::MACHINE_REG:
+                return saved_regs[op.index];
+            case IR::Operand::STACK_SLOT:
+                return frame[-op.index - 1];
+            case IR::Operand::IMMEDIATE:
+                return executable->program.immediates[op.index];
+            default:
+                assert(false && "invalid deopt value");
+                return 0;
+        }
+    };
+
+    // the baseline frame overlaps the optimized one, so read everything before writing
+    std::vector<runtime::Value> values;
+    values.reserve(map->values.size());
+    for (size_t i = 0; i < map->values.size(); ++i) {
+        runtime::Value value = read(map->values[i].second);
+        if (!map->unboxed_values.empty() && map->unboxed_values[i]) {
+            value = runtime::unboxed_to_value(value);
+        }
+        values.push_back(value);
+    }
+    DeoptExit& exit = executable->deopt_exit;
+    exit.rsi = read(map->operands[0]);
+    exit.rdx = read(map->operands[1]);
+    if (map->unboxed_operands[0]) {
+        exit.rsi = runtime::unboxed_to_value(exit.rsi);
+    }
+    if (map->unboxed_operands[1]) {
+        exit.rdx = runtime::unboxed_to_value(exit.rdx);
+    }
+    for (int i = 0; i < baseline.frame_slots; ++i) {
+        frame[-i - 1] = 0;
+    }
+    for (size_t i = 0; i < values.size(); ++i) {
+        frame[-map->values[i].first - 1] = values[i];
+    }
+    exit.rsp = reinterpret_cast<uint64_t>(frame - baseline.frame_slots);
+    exit.target = baseline.sites[site];
+
+    // don't speculate on the site again, the function gets recompiled once it is hot again
+    ctx->type_feedback[func_index][site] |= runtime::FEEDBACK_OTHER;
+    ctx->function_table[func_index].code = baseline.entry;
+    ctx->function_table[func_index].hotness = TIER_UP_HOTNESS;
+    return &exit;
+}
+
+auto Executable::get_baseline_frame(size_t func_index) const -> int {
+    return baseline_code[func_index].frame_slots;
 }
 
-void CodeGenerator::process_function(size_t func_index) {
+void CodeGenerator::process_function(size_t func_index, const IR::Function& func, bool baseline) {
 //    std::cout << "------- function " << func_index << "---------" << std::endl;
     using namespace asmjit;
     assembler.bind(function_labels[func_index]);
-    const IR::Function& func = this->program.functions[func_index];
     assert(!func.blocks.empty());
     // traverse blocks of function
     auto order = get_block_dfs_order(func);
     assembler.push(x86::rbp);
     assembler.mov(x86::rbp, x86::rsp);
+    if (baseline) {
+        count_hotness(func_index, true);
+    }
 
     // reserve stack slots. To ensure 16-byte alignment at function call time, align stack to 16 bytes + 8
-    int allocated_stack_slots;
     if (func.stack_slots % 2 == 0) {
         assembler.sub(x86::rsp, 8 * func.stack_slots);
         allocated_stack_slots = func.stack_slots;
@@ -72,10 +606,12 @@ void CodeGenerator::process_function(size_t func_index) {
 
     for (size_t block_index = 0; block_index < func.blocks.size(); ++block_index) {
         const IR::BasicBlock& block = func.blocks[block_index];
-        process_block(func, block_index, block_labels);
+        process_block(func, func_index, block_index, block_labels, baseline);
         // process branch instruction if block has multiple successors
         size_t num_successors = block.successors.size();
-        if (num_successors == 2) {
+        if (num_successors == 2 && block.instructions.back().op == IR::Operation::CMP_BRANCH) {
+            process_cmp_branch(block, block_index, block_labels);
+        } else if (num_successors == 2) {
             const IR::Instruction& instr = block.instructions.back();
             load(x86::r10, instr.args[0]);
             assembler.shr(x86::r10, 4);
@@ -96,17 +632,148 @@ void CodeGenerator::process_function(size_t func_index) {
             assert(false);
         }
     }
+
+    // out of line allocation slow paths, kept away from the hot code
+    for (const auto& [slow_label, resume_label, data_size] : alloc_slow_paths) {
+        assembler.bind(slow_label);
+        assembler.mov(x86::r11, Imm(data_size));
+        assembler.call(alloc_label);
+        assembler.jmp(resume_label);
+    }
+    alloc_slow_paths.clear();
+
+    for (const auto& [slow_label, resume_label, at_entry] : tier_up_slow_paths) {
+        assembler.bind(slow_label);
+        assembler.mov(x86::r11, Imm(func_index));
+        assembler.call(tier_up_label);
+        if (at_entry) {
+            // restart the call in the optimized code, with the arguments and return address untouched
+            assembler.pop(x86::rbp);
+            assembler.jmp(x86::r11);
+        } else {
+            // no on stack replacement, the current call finishes in baseline code
+            assembler.jmp(resume_label);
+        }
+    }
+    tier_up_slow_paths.clear();
+
+    for (const auto& [deopt_label, site, map] : deopt_paths) {
+        assembler.bind(deopt_label);
+        deoptimize(func_index, site, map);
+    }
+    deopt_paths.clear();
+}
+
+void CodeGenerator::count_hotness(size_t func_index, bool at_entry) {
+    // only emitted where no values are held in registers other than the arguments, as the tier up
+    // stub preserves just those
+    using namespace asmjit;
+    Label slow_label = assembler.newLabel();
+    Label resume_label = assembler.newLabel();
+    runtime::FunctionEntry* entry = &program.ctx_ptr->function_table[func_index];
+    assembler.mov(x86::r11, Imm(&entry->hotness));
+    assembler.dec(x86::qword_ptr(x86::r11));
+    assembler.jz(slow_label);
+    assembler.bind(resume_label);
+    tier_up_slow_paths.emplace_back(slow_label, resume_label, at_entry);
+}
+
+void CodeGenerator::record_feedback(size_t func_index, int site) {
+    // operands in RSI and RDX, as for ADD and EQ
+    using namespace asmjit;
+    Label other_label = assembler.newLabel();
+    Label end_label = assembler.newLabel();
+    uint8_t* feedback = &program.ctx_ptr->type_feedback[func_index][site];
+    assembler.mov(x86::r11, Imm(feedback));
+    assembler.mov(x86::r10, x86::rsi);
+    assembler.and_(x86::r10, Imm(runtime::TAG_MASK));
+    assembler.cmp(x86::r10, Imm(runtime::INT_TAG));
+    assembler.jne(other_label);
+    assembler.mov(x86::r10, x86::rdx);
+    assembler.and_(x86::r10, Imm(runtime::TAG_MASK));
+    assembler.cmp(x86::r10, Imm(runtime::INT_TAG));
+    assembler.jne(other_label);
+    assembler.or_(x86::byte_ptr(x86::r11), Imm(runtime::FEEDBACK_INT));
+    assembler.jmp(end_label);
+    assembler.bind(other_label);
+    assembler.or_(x86::byte_ptr(x86::r11), Imm(runtime::FEEDBACK_OTHER));
+    assembler.bind(end_label);
+}
+
+void CodeGenerator::deoptimize(size_t func_index, int site, const IR::DeoptState* map) {
+    // keep the helper's stack clear of the baseline frame it writes, one more slot for alignment
+    using namespace asmjit;
+    assembler.sub(x86::rsp, 8 * (executable->get_baseline_frame(func_index) + 1));
+    for (size_t i = IR::MACHINE_REG_COUNT; i > 0; --i) {
+        assembler.push(to_reg(i - 1));
+    }
+    assembler.mov(x86::rdi, Imm(executable));
+    assembler.mov(x86::rsi, Imm(func_index));
+    assembler.mov(x86::rdx, Imm(site));
+    assembler.mov(x86::rcx, Imm(map));
+    assembler.mov(x86::r8, x86::rsp);
+    assembler.mov(x86::r9, x86::rbp);
+    assembler.call(Imm(Executable::deoptimize));
+    assembler.mov(x86::rsp, x86::ptr_64(x86::rax, offsetof(DeoptExit, rsp)));
+    assembler.mov(x86::rsi, x86::ptr_64(x86::rax, offsetof(DeoptExit, rsi)));
+    assembler.mov(x86::rdx, x86::ptr_64(x86::rax, offsetof(DeoptExit, rdx)));
+    assembler.jmp(x86::ptr_64(x86::rax, offsetof(DeoptExit, target)));
+}
+
+void CodeGenerator::process_cmp_branch(const IR::BasicBlock& block,
+                                       size_t block_index,
+                                       const std::vector<asmjit::Label>& block_labels) {
+    // the operands are in r10 and r11, see generate_instr_mapping
+    using namespace asmjit;
+    const IR::Instruction& instr = block.instructions.back();
+    auto cmp_op = static_cast<IR::Operation>(instr.args[2].index);
+    uint32_t cond;
+    if (cmp_op == IR::Operation::GT || cmp_op == IR::Operation::GEQ) {
+        assembler.shr(x86::r10, 4);
+        assembler.shr(x86::r11, 4);
+        assembler.cmp(x86::r10d, x86::r11d);
+    } else {
+        assembler.cmp(x86::r10, x86::r11);
+    }
+    if (cmp_op == IR::Operation::GT || cmp_op == IR::Operation::GT_UNBOXED) {
+        cond = x86::Condition::kG;
+    } else if (cmp_op == IR::Operation::GEQ || cmp_op == IR::Operation::GEQ_UNBOXED) {
+        cond = x86::Condition::kGE;
+    } else {
+        cond = x86::Condition::kE;
+    }
+    size_t if_true = block.successors.front();
+    size_t if_false = block.successors.back();
+    if (if_false == block_index + 1) {
+        assembler.j(cond, block_labels[if_true]);
+    } else {
+        assembler.j(x86::Condition::negate(cond), block_labels[if_false]);
+        if (if_true != block_index + 1) {
+            assembler.jmp(block_labels[if_true]);
+        }
+    }
 }
 
 void CodeGenerator::process_block(
                                const IR::Function& func,
+                               size_t func_index,
                                size_t block_index,
-                               std::vector<asmjit::Label>& block_labels) {
+                               std::vector<asmjit::Label>& block_labels,
+                               bool baseline) {
 //    std::cout << "------- block " << block_index << "---------" << std::endl;
     using namespace asmjit;
     const IR::BasicBlock block = func.blocks[block_index];
     assembler.bind(block_labels[block_index]);
+    if (baseline && block.is_loop_header) {
+        count_hotness(func_index, false);
+    }
     for (const auto& instr : block.instructions) {
+        if (baseline && (instr.op == IR::Operation::ADD || instr.op == IR::Operation::EQ)) {
+            Label site_label = assembler.newLabel();
+            assembler.bind(site_label);
+            site_labels.emplace_back(func_index, instr.args[2].index, site_label);
+            record_feedback(func_index, instr.args[2].index);
+        }
         if (instr.op == IR::Operation::ADD) {
             Label extern_call = assembler.newLabel();
             Label end = assembler.newLabel();
@@ -130,8 +797,8 @@ void CodeGenerator::process_block(
             assembler.jmp(end);
 
             assembler.bind(extern_call);
-            assembler.mov(x86::rdi, Imm(program.ctx_ptr));
-            assembler.call(Imm(runtime::value_add_nonint));
+            mov_address(x86::rdi, Imm(program.ctx_ptr), Relocation::CONTEXT);
+            call_extern(Imm(runtime::value_add_nonint));
 
             assembler.bind(end);
             store(instr.out, x86::rax);
@@ -165,8 +832,16 @@ void CodeGenerator::process_block(
             assembler.or_(x86::rax, Imm(runtime::INT_TAG));
             store(instr.out, x86::rax);
         } else if (instr.op == IR::Operation::EQ) {
-            assembler.call(Imm(runtime::value_eq));
+            mov_address(x86::rdi, Imm(program.ctx_ptr), Relocation::CONTEXT);
+            call_extern(Imm(runtime::extern_eq));
             store(instr.out, x86::rax);
+        } else if (instr.op == IR::Operation::EQ_INT) {
+            assembler.cmp(x86::r10, x86::r11);
+            assembler.sete(x86::r10b);
+            assembler.and_(x86::r10, Imm(0b1));
+            assembler.shl(x86::r10, 4);
+            assembler.or_(x86::r10, Imm(runtime::BOOL_TAG));
+            store(instr.out, x86::r10);
         } else if (instr.op == IR::Operation::GT) {
             assembler.shr(x86::r10, Imm(4));
             assembler.shr(x86::r11, Imm(4));
@@ -194,10 +869,53 @@ void CodeGenerator::process_block(
         } else if (instr.op == IR::Operation::NOT) {
             assembler.xor_(x86::r10, 0b10000);
             store(instr.out, x86::r10);
+        } else if (instr.op == IR::Operation::ADD_UNBOXED) {
+            // the lower half is zero, so 64 bit arithmetic wraps like int32 arithmetic
+            assembler.add(x86::r10, x86::r11);
+            store(instr.out, x86::r10);
+        } else if (instr.op == IR::Operation::SUB_UNBOXED) {
+            assembler.sub(x86::r10, x86::r11);
+            store(instr.out, x86::r10);
+        } else if (instr.op == IR::Operation::MUL_UNBOXED) {
+            assembler.sar(x86::r10, runtime::UNBOXED_SHIFT);
+            assembler.imul(x86::r10, x86::r11);
+            store(instr.out, x86::r10);
+        } else if (instr.op == IR::Operation::DIV_UNBOXED) {
+            assembler.test(x86::r10, x86::r10);
+            assembler.je(illegal_arith_label);
+            assembler.sar(x86::rax, runtime::UNBOXED_SHIFT);
+            assembler.sar(x86::r10, runtime::UNBOXED_SHIFT);
+            assembler.cdq();
+            assembler.idiv(x86::r10d);
+            assembler.shl(x86::rax, runtime::UNBOXED_SHIFT);
+            store(instr.out, x86::rax);
+        } else if (instr.op == IR::Operation::GT_UNBOXED) {
+            assembler.cmp(x86::r10, x86::r11);
+            assembler.setg(x86::r10b);
+            assembler.and_(x86::r10, Imm(0b1));
+            assembler.shl(x86::r10, 4);
+            assembler.or_(x86::r10, Imm(runtime::BOOL_TAG));
+            store(instr.out, x86::r10);
+        } else if (instr.op == IR::Operation::GEQ_UNBOXED) {
+            assembler.cmp(x86::r10, x86::r11);
+            assembler.setge(x86::r10b);
+            assembler.and_(x86::r10, Imm(0b1));
+            assembler.shl(x86::r10, 4);
+            assembler.or_(x86::r10, Imm(runtime::BOOL_TAG));
+            store(instr.out, x86::r10);
+        } else if (instr.op == IR::Operation::BOX_INT) {
+            assembler.shr(x86::r10, runtime::UNBOXED_SHIFT - 4);
+            assembler.or_(x86::r10, Imm(runtime::INT_TAG));
+            store(instr.out, x86::r10);
+        } else if (instr.op == IR::Operation::UNBOX_INT) {
+            assembler.shr(x86::r10, 4);
+            assembler.shl(x86::r10, runtime::UNBOXED_SHIFT);
+            store(instr.out, x86::r10);
         } else if (instr.op == IR::Operation::LOAD_ARG) {
             // +2 because saved rbp and rip are at rbp
             size_t arg_id = instr.args[0].index;
-            if (arg_id > 6) {
+            // the first six arguments are passed in registers, see SET_ARG
+            if (arg_id >= 6) {
                 int32_t offset = 8 * (instr.args[0].index - 4);
                 assembler.mov(x86::r10, x86::ptr_64(x86::rbp, offset));
                 store(instr.out, x86::r10);
@@ -213,51 +931,145 @@ void CodeGenerator::process_block(
             store(instr.out, x86::r10);
         } else if (instr.op == IR::Operation::REF_STORE) {
             assembler.mov(x86::Mem(x86::r10, -runtime::REFERENCE_TAG), x86::r11);
+            write_barrier();
         } else if (instr.op == IR::Operation::REC_LOAD_NAME) {
             // record in r10, index of name is second arg
             Label extern_call = assembler.newLabel();
             Label end = assembler.newLabel();
+            Label hit_label = assembler.newLabel();
+            Label megamorphic_label = assembler.newLabel();
+            size_t cache_index = program.ctx_ptr->inline_caches.size();
+            runtime::InlineCache* cache = &program.ctx_ptr->inline_caches.emplace_back();
 
-            // broadcast name into zmm0
-            assembler.mov(x86::r11, Imm(program.immediates[instr.args[1].index]));
-            assembler.vmovq(x86::xmm0, x86::r11);
-            assembler.vpbroadcastq(x86::ymm0, x86::xmm0);
-            // load label address into r11
-            assembler.lea(x86::r11, x86::ptr_256(layout_base_label));
-            assembler.add(x86::r11, x86::ptr_64(x86::r10, -runtime::RECORD_TAG));
-            // perform comparison with layout as memory operand
-            assembler.vpcmpeqq(x86::ymm0, x86::ymm0, x86::ptr_256(x86::r11));
-            assembler.vpmovmskb(x86::r11d, x86::ymm0);
-            assembler.test(x86::r11, x86::r11);
-            // if not found jump to extern call
-            assembler.jz(extern_call);
-            // find index
-            assembler.bsf(x86::r11, x86::r11); // offset of *8 is already included
+            // check cached layouts, leaving the matching entry in rdi
+            assembler.mov(x86::r11, x86::ptr_64(x86::r10, RECORD_LAYOUT_OFFSET));
+            inline_cache_lookup(cache_index, hit_label);
+            mov_address(x86::rdi, Imm(cache), Relocation::INLINE_CACHE, cache_index);
+            assembler.cmp(x86::qword_ptr(x86::rdi, offsetof(runtime::InlineCache, misses)),
+                          Imm(runtime::INLINE_CACHE_ENTRIES));
+            assembler.jae(megamorphic_label);
+            assembler.mov(x86::rcx, x86::rdi);
+            mov_address(x86::rdi, Imm(program.ctx_ptr), Relocation::CONTEXT);
+            assembler.mov(x86::rsi, x86::r10);
+            load(x86::rdx, instr.args[1]);
+            call_extern(Imm(runtime::extern_rec_load_name_cached));
+            assembler.jmp(end);
+
+            assembler.bind(hit_label);
+            assembler.mov(x86::r11, x86::ptr_64(x86::rdi, offsetof(runtime::InlineCache::Entry, offset)));
+            assembler.mov(x86::rax, x86::ptr_64(x86::r10, x86::r11));
+            assembler.jmp(end);
+
+            // megamorphic site, generic lookup
+            assembler.bind(megamorphic_label);
+
+            load(x86::r11, instr.args[1]);
+            layout_lookup(x86::r10, x86::r11, extern_call);
             assembler.mov(x86::rax,
-                          x86::ptr_64(x86::r10, x86::r11, 0,
+                          x86::ptr_64(x86::r10, x86::rax, 0,
                                       sizeof(runtime::Record) - runtime::RECORD_TAG));
             assembler.jmp(end);
 
             // not found, need call
             assembler.bind(extern_call);
-            assembler.mov(x86::rdi, Imm(program.ctx_ptr));
+            mov_address(x86::rdi, Imm(program.ctx_ptr), Relocation::CONTEXT);
             assembler.mov(x86::rsi, x86::r10);
-            assembler.mov(x86::rdx, Imm(program.immediates[instr.args[1].index]));
-            assembler.call(Imm(runtime::extern_rec_load_name));
+            load(x86::rdx, instr.args[1]);
+            call_extern(Imm(runtime::extern_rec_load_name));
 
             // store result
             assembler.bind(end);
             store(instr.out, x86::rax);
         } else if (instr.op == IR::Operation::REC_LOAD_INDX) {
-            assembler.mov(x86::rdi, Imm(program.ctx_ptr));
-            assembler.call(Imm(runtime::extern_rec_load_index));
+            Label slow_label = assembler.newLabel();
+            Label end_label = assembler.newLabel();
+            dense_array_lookup(slow_label);
+            assembler.mov(x86::r10, x86::ptr_64(x86::r11, x86::r10, 3, offsetof(runtime::DenseArray, data)));
+            store(instr.out, x86::r10);
+            assembler.jmp(end_label);
+
+            assembler.bind(slow_label);
+            mov_address(x86::rdi, Imm(program.ctx_ptr), Relocation::CONTEXT);
+            call_extern(Imm(runtime::extern_rec_load_index));
             store(instr.out, x86::rax);
+            assembler.bind(end_label);
         } else if (instr.op == IR::Operation::REC_STORE_NAME) {
-            assembler.mov(x86::rdi, Imm(program.ctx_ptr));
-            assembler.call(Imm(runtime::extern_rec_store_name));
+            // record in rsi, name in rdx, value in rcx
+            Label extern_call = assembler.newLabel();
+            Label end = assembler.newLabel();
+            Label hit_label = assembler.newLabel();
+            Label store_label = assembler.newLabel();
+            Label miss_label = assembler.newLabel();
+            Label megamorphic_label = assembler.newLabel();
+            size_t cache_index = program.ctx_ptr->inline_caches.size();
+            runtime::InlineCache* cache = &program.ctx_ptr->inline_caches.emplace_back();
+
+            assembler.mov(x86::r11, x86::ptr_64(x86::rsi, RECORD_LAYOUT_OFFSET));
+            inline_cache_lookup(cache_index, hit_label);
+            assembler.bind(miss_label);
+            mov_address(x86::r8, Imm(cache), Relocation::INLINE_CACHE, cache_index);
+            assembler.cmp(x86::qword_ptr(x86::r8, offsetof(runtime::InlineCache, misses)),
+                          Imm(runtime::INLINE_CACHE_ENTRIES));
+            assembler.jae(megamorphic_label);
+            mov_address(x86::rdi, Imm(program.ctx_ptr), Relocation::CONTEXT);
+            call_extern(Imm(runtime::extern_rec_store_name_cached));
+            assembler.jmp(end);
+
+            // megamorphic site, generic lookup of the static fields before the call
+            assembler.bind(megamorphic_label);
+            layout_lookup(x86::rsi, x86::rdx, extern_call);
+            assembler.mov(x86::ptr_64(x86::rsi, x86::rax, 0, sizeof(runtime::Record) - runtime::RECORD_TAG),
+                          x86::rcx);
+            assembler.mov(x86::r10, x86::rsi);
+            assembler.mov(x86::r11, x86::rcx);
+            write_barrier();
+            assembler.jmp(end);
+
+            assembler.bind(extern_call);
+            mov_address(x86::rdi, Imm(program.ctx_ptr), Relocation::CONTEXT);
+            call_extern(Imm(runtime::extern_rec_store_name));
+            assembler.jmp(end);
+
+            // cached store, which possibly moves the record to a new layout first. The name might
+            // already be a dynamic field in that case, so leave records with any to the runtime, as
+            // well as records without room for another field
+            assembler.bind(hit_label);
+            assembler.mov(x86::rax, x86::ptr_64(x86::rdi, offsetof(runtime::InlineCache::Entry, new_layout)));
+            assembler.test(x86::rax, x86::rax);
+            assembler.jz(store_label);
+            assembler.cmp(x86::qword_ptr(x86::rsi, offsetof(runtime::Record, dynamic_fields) - runtime::RECORD_TAG),
+                          Imm(0));
+            assembler.jne(miss_label);
+            assembler.mov(x86::r10d,
+                          x86::dword_ptr(x86::rsi, offsetof(runtime::Record, static_field_count) - runtime::RECORD_TAG));
+            assembler.cmp(x86::r10d, x86::dword_ptr(x86::rsi, offsetof(runtime::Record, capacity) - runtime::RECORD_TAG));
+            assembler.jae(miss_label);
+            assembler.mov(x86::ptr_64(x86::rsi, RECORD_LAYOUT_OFFSET), x86::rax);
+            assembler.mov(x86::eax, x86::dword_ptr(x86::rdi, offsetof(runtime::InlineCache::Entry, new_layout_index)));
+            assembler.mov(x86::dword_ptr(x86::rsi, offsetof(runtime::Record, layout_index) - runtime::RECORD_TAG),
+                          x86::eax);
+            assembler.inc(x86::dword_ptr(x86::rsi, offsetof(runtime::Record, static_field_count) - runtime::RECORD_TAG));
+            assembler.bind(store_label);
+            assembler.mov(x86::rax, x86::ptr_64(x86::rdi, offsetof(runtime::InlineCache::Entry, offset)));
+            assembler.mov(x86::ptr_64(x86::rsi, x86::rax), x86::rcx);
+            assembler.mov(x86::r10, x86::rsi);
+            assembler.mov(x86::r11, x86::rcx);
+            write_barrier();
+            assembler.bind(end);
         } else if (instr.op == IR::Operation::REC_STORE_INDX) {
-            assembler.mov(x86::rdi, Imm(program.ctx_ptr));
-            assembler.call(Imm(runtime::extern_rec_store_index));
+            Label slow_label = assembler.newLabel();
+            Label end_label = assembler.newLabel();
+            dense_array_lookup(slow_label);
+            assembler.mov(x86::ptr_64(x86::r11, x86::r10, 3, offsetof(runtime::DenseArray, data)), x86::rcx);
+            assembler.mov(x86::r10, x86::rsi);
+            assembler.mov(x86::r11, x86::rcx);
+            write_barrier();
+            assembler.jmp(end_label);
+
+            assembler.bind(slow_label);
+            mov_address(x86::rdi, Imm(program.ctx_ptr), Relocation::CONTEXT);
+            call_extern(Imm(runtime::extern_rec_store_index));
+            assembler.bind(end_label);
         } else if (instr.op == IR::Operation::REC_LOAD_STATIC) {
             int32_t offset = (int32_t)sizeof(runtime::Record) + 8 * instr.args[1].index - runtime::RECORD_TAG;
             assembler.mov(x86::r10, x86::ptr_64(x86::r10, offset));
@@ -265,30 +1077,49 @@ void CodeGenerator::process_block(
         } else if (instr.op == IR::Operation::REC_STORE_STATIC) {
             int32_t offset = (int32_t)sizeof(runtime::Record) + 8 * instr.args[1].index - runtime::RECORD_TAG;
             assembler.mov(x86::ptr_64(x86::r10, offset), x86::r11);
+            write_barrier();
         } else if (instr.op == IR::Operation::ALLOC_REF) {
-            assembler.mov(x86::rdi, Imm(program.ctx_ptr));
-            assembler.call(Imm(runtime::extern_alloc_ref));
-            store(instr.out, x86::rax);
+            inline_alloc(sizeof(runtime::Value));
+            assembler.mov(x86::qword_ptr(x86::r11, 8), Imm(0));
+            assembler.lea(x86::r10, x86::ptr(x86::r11, 8 + runtime::REFERENCE_TAG));
+            store(instr.out, x86::r10);
         } else if (instr.op == IR::Operation::ALLOC_REC) {
-            assembler.mov(x86::rdi, Imm(program.ctx_ptr));
-            assembler.mov(x86::rsi, Imm(instr.args[0].index));
-            assembler.mov(x86::rdx, Imm(instr.args[1].index));
-            assembler.call(Imm(runtime::extern_alloc_record));
-            store(instr.out, x86::rax);
+            int32_t num_static = instr.args[0].index;
+            int32_t layout = instr.args[1].index;
+            int32_t alloc_site = instr.args[2].index;
+            uint32_t capacity = program.ctx_ptr->record_site_capacity(num_static, alloc_site);
+            inline_alloc(sizeof(runtime::Record) + sizeof(runtime::Value) * capacity);
+            mov_address(x86::r10, Imm(program.ctx_ptr->layout_tables[layout]), Relocation::LAYOUT_TABLE, layout);
+            assembler.mov(x86::qword_ptr(x86::r11, 8 + offsetof(runtime::Record, layout)), x86::r10);
+            assembler.mov(x86::dword_ptr(x86::r11, 8 + offsetof(runtime::Record, static_field_count)),
+                          Imm(num_static));
+            assembler.mov(x86::dword_ptr(x86::r11, 8 + offsetof(runtime::Record, layout_index)), Imm(layout));
+            assembler.mov(x86::qword_ptr(x86::r11, 8 + offsetof(runtime::Record, dynamic_fields)), Imm(0));
+            assembler.mov(x86::qword_ptr(x86::r11, 8 + offsetof(runtime::Record, elements)), Imm(0));
+            assembler.mov(x86::dword_ptr(x86::r11, 8 + offsetof(runtime::Record, capacity)), Imm(capacity));
+            assembler.mov(x86::dword_ptr(x86::r11, 8 + offsetof(runtime::Record, alloc_site)), Imm(alloc_site));
+            for (uint32_t i = 0; i < capacity; ++i) {
+                assembler.mov(x86::qword_ptr(x86::r11, 8 + sizeof(runtime::Record) + 8 * i), Imm(0));
+            }
+            assembler.lea(x86::r10, x86::ptr(x86::r11, 8 + runtime::RECORD_TAG));
+            store(instr.out, x86::r10);
         } else if (instr.op == IR::Operation::ALLOC_CLOSURE) {
             int32_t fn_id = instr.args[0].index;
-            assembler.mov(x86::rdi, Imm(program.ctx_ptr));
             // arg2 is number of free vars
-            assembler.mov(x86::rsi, instr.args[2].index);
-            assembler.call(Imm(runtime::extern_alloc_closure));
-            // load function address
-            assembler.lea(x86::r10, x86::ptr(function_labels[fn_id]));
-            assembler.mov(x86::Mem(x86::rax, -runtime::CLOSURE_TAG), x86::r10);
-            assembler.mov(x86::qword_ptr(x86::rax, 8 - runtime::CLOSURE_TAG), Imm(instr.args[1].index));
-            store(instr.out, x86::rax);
+            int32_t num_free = instr.args[2].index;
+            inline_alloc(sizeof(runtime::Closure) + sizeof(runtime::Value) * num_free);
+            // closures point to the function table entry, which tracks the current code of the function
+            mov_address(x86::r10, Imm(&program.ctx_ptr->function_table[fn_id]), Relocation::FUNCTION_ENTRY, fn_id);
+            assembler.mov(x86::qword_ptr(x86::r11, 8 + offsetof(runtime::Closure, fnptr)), x86::r10);
+            assembler.mov(x86::qword_ptr(x86::r11, 8 + offsetof(runtime::Closure, n_args)),
+                          Imm(instr.args[1].index));
+            assembler.mov(x86::qword_ptr(x86::r11, 8 + offsetof(runtime::Closure, n_free_vars)), Imm(num_free));
+            assembler.lea(x86::r10, x86::ptr(x86::r11, 8 + runtime::CLOSURE_TAG));
+            store(instr.out, x86::r10);
         } else if (instr.op == IR::Operation::SET_CAPTURE) {
             int32_t offset = 24 + 8 * instr.args[0].index - runtime::CLOSURE_TAG;
             assembler.mov(x86::Mem(x86::r10, offset), x86::r11);
+            write_barrier();
         } else if (instr.op == IR::Operation::INIT_CALL) {
             current_args = instr.args[0].index;
             int32_t stack_args = std::max(current_args - 6, 0);
@@ -315,11 +1146,26 @@ void CodeGenerator::process_block(
             load(x86::rbx, instr.args[0]);
             assembler.and_(x86::rbx, Imm(runtime::DATA_MASK));
 
-            // validate number of arguments
-            assembler.cmp(x86::ptr_64(x86::rbx, 8), Imm(current_args));
-            assembler.jne(rt_exception_label);
+            if (instr.args[2].type == IR::Operand::LOGICAL) {
+                // callee known from the inliner, the number of arguments was checked then
+                size_t callee = instr.args[2].index;
+                if (executable == nullptr) {
+                    // all code is in this buffer and never replaced
+                    assembler.call(function_labels[callee]);
+                } else {
+                    mov_address(x86::r11, Imm(&program.ctx_ptr->function_table[callee]), Relocation::FUNCTION_ENTRY,
+                                callee);
+                    assembler.call(x86::ptr_64(x86::r11, offsetof(runtime::FunctionEntry, code)));
+                }
+            } else {
+                // validate number of arguments
+                assembler.cmp(x86::ptr_64(x86::rbx, 8), Imm(current_args));
+                assembler.jne(rt_exception_label);
 
-            assembler.call(x86::Mem(x86::rbx, 0));
+                assembler.mov(x86::r11, x86::ptr_64(x86::rbx, offsetof(runtime::Closure, fnptr)));
+                assembler.call(x86::ptr_64(x86::r11, offsetof(runtime::FunctionEntry, code)));
+            }
+            add_safepoint(func.stack_maps[instr.args[1].index], 0);
             if (instr.out.type != IR::Operand::NONE) {
                 store(instr.out, x86::rax);
             }
@@ -346,14 +1192,15 @@ void CodeGenerator::process_block(
             }
         } else if (instr.op == IR::Operation::LOAD_GLOBAL) {
             int32_t offset = 8 * instr.args[0].index;
-            assembler.mov(x86::r11, Imm(program.ctx_ptr->globals));
+            mov_address(x86::r11, Imm(program.ctx_ptr->globals), Relocation::GLOBALS);
             assembler.mov(x86::r10, x86::qword_ptr(x86::r11, offset));
             store(instr.out, x86::r10);
             assembler.cmp(x86::r10, Imm(0b10000));
             assembler.je(uninit_var_label);
         } else if (instr.op == IR::Operation::STORE_GLOBAL) {
+            // globals are scanned as roots by every collection, no write barrier required
             int32_t offset = 8 * instr.args[0].index;
-            assembler.mov(x86::r11, Imm(program.ctx_ptr->globals));
+            mov_address(x86::r11, Imm(program.ctx_ptr->globals), Relocation::GLOBALS);
             assembler.mov(x86::ptr_64(x86::r11, offset), x86::r10);
         } else if (instr.op == IR::Operation::ASSERT_BOOL) {
             assembler.and_(x86::r10, Imm(runtime::TAG_MASK));
@@ -363,6 +1210,12 @@ void CodeGenerator::process_block(
             assembler.and_(x86::r10, Imm(runtime::TAG_MASK));
             assembler.cmp(x86::r10, Imm(runtime::INT_TAG));
             assembler.jne(illegal_cast_label);
+        } else if (instr.op == IR::Operation::GUARD_INT) {
+            Label deopt_label = assembler.newLabel();
+            assembler.and_(x86::r10, Imm(runtime::TAG_MASK));
+            assembler.cmp(x86::r10, Imm(runtime::INT_TAG));
+            assembler.jne(deopt_label);
+            deopt_paths.emplace_back(deopt_label, instr.args[1].index, &func.deopt_maps[instr.args[2].index]);
         } else if (instr.op == IR::Operation::ASSERT_STRING) {
             // TODO implement or maybe remove, think about this
         } else if (instr.op == IR::Operation::ASSERT_RECORD) {
@@ -378,15 +1231,15 @@ void CodeGenerator::process_block(
             assembler.cmp(x86::r10, Imm(runtime::INT_TAG));
             assembler.je(illegal_arith_label);
         } else if (instr.op == IR::Operation::PRINT) {
-            assembler.mov(x86::rdi, Imm(program.ctx_ptr));
-            assembler.call(Imm(runtime::extern_print));
+            mov_address(x86::rdi, Imm(program.ctx_ptr), Relocation::CONTEXT);
+            call_extern(Imm(runtime::extern_print));
         } else if (instr.op == IR::Operation::INPUT) {
-            assembler.mov(x86::rdi, Imm(program.ctx_ptr));
-            assembler.call(Imm(runtime::extern_input));
+            mov_address(x86::rdi, Imm(program.ctx_ptr), Relocation::CONTEXT);
+            call_extern(Imm(runtime::extern_input));
             store(instr.out, x86::rax);
         } else if (instr.op == IR::Operation::INTCAST) {
-            assembler.mov(x86::rdi, Imm(program.ctx_ptr));
-            assembler.call(Imm(runtime::extern_intcast));
+            mov_address(x86::rdi, Imm(program.ctx_ptr), Relocation::CONTEXT);
+            call_extern(Imm(runtime::extern_intcast));
             assembler.cmp(x86::rax, 0b10000);
             assembler.je(illegal_cast_label);
             store(instr.out, x86::rax);
@@ -396,7 +1249,7 @@ void CodeGenerator::process_block(
                 assert(false && "emitted swap with stack slots");
             }
             assembler.xchg(to_reg(instr.args[0].index), to_reg(instr.args[1].index));
-        } else if (instr.op == IR::Operation::BRANCH) {
+        } else if (instr.op == IR::Operation::BRANCH || instr.op == IR::Operation::CMP_BRANCH) {
             break;
         } else if (instr.op == IR::Operation::RETURN) {
             assembler.mov(x86::rsp, x86::rbp);
@@ -404,11 +1257,11 @@ void CodeGenerator::process_block(
             assembler.ret();
         } else if (instr.op == IR::Operation::GC) {
             Label skip_gc_label = assembler.newLabel();
-            assembler.mov(x86::r10, Imm(&program.ctx_ptr->current_alloc));
+            mov_address(x86::r10, Imm(&program.ctx_ptr->nursery_head), Relocation::CONTEXT);
             assembler.mov(x86::r10, x86::ptr_64(x86::r10));
-            assembler.mov(x86::r11, Imm(program.ctx_ptr->region_size));
-            assembler.cmp(x86::r10, x86::r11);
-            assembler.jl(skip_gc_label);
+            mov_address(x86::r11, Imm(&program.ctx_ptr->nursery_limit), Relocation::CONTEXT);
+            assembler.cmp(x86::r10, x86::ptr_64(x86::r11));
+            assembler.jb(skip_gc_label);
             std::bitset<IR::MACHINE_REG_COUNT> live_regs(instr.args[0].index);
             int num_live = 0;
             for (int i = 0; i < IR::MACHINE_REG_COUNT; ++i) {
@@ -420,11 +1273,14 @@ void CodeGenerator::process_block(
             if (num_live % 2 != 0) {
                 assembler.push(0);
             }
-            // call tracer to perform gc
-            assembler.mov(x86::rdi, Imm(program.ctx_ptr));
+            // call tracer to perform gc, passing the return address to look up the stack map
+            Label return_label = assembler.newLabel();
+            mov_address(x86::rdi, Imm(program.ctx_ptr), Relocation::CONTEXT);
             assembler.mov(x86::rsi, x86::rbp);
-            assembler.mov(x86::rdx, x86::rsp);
-            assembler.call(Imm(runtime::trace_collect));
+            assembler.lea(x86::rdx, x86::ptr(return_label));
+            call_extern(Imm(runtime::trace_collect));
+            assembler.bind(return_label);
+            add_safepoint(func.stack_maps[instr.args[1].index], num_live);
             if (num_live % 2 != 0) {
                 assembler.add(x86::rsp, Imm(8));
             }
@@ -440,11 +1296,186 @@ void CodeGenerator::process_block(
     }
 }
 
+void CodeGenerator::layout_lookup(const asmjit::x86::Gp& rec, const asmjit::x86::Gp& name,
+                                  asmjit::Label not_found) {
+    // vectorized scan of the layout table of rec for name, leaving the byte offset of the field in
+    // rax. Clobbers rdi, r11 and the first two vector registers
+    using namespace asmjit;
+    Label loop_label = assembler.newLabel();
+    Label found_label = assembler.newLabel();
+    size_t chunk_size = use_avx512 ? 64 : 32;
+    assembler.mov(x86::rdi, x86::ptr_64(rec, RECORD_LAYOUT_OFFSET));
+    if (use_avx512) {
+        assembler.vpbroadcastq(x86::zmm0, name);
+    } else {
+        assembler.vmovq(x86::xmm0, name);
+        assembler.vpbroadcastq(x86::ymm0, x86::xmm0);
+    }
+    assembler.xor_(x86::eax, x86::eax);
+    assembler.bind(loop_label);
+    if (use_avx512) {
+        assembler.vpcmpeqq(x86::k1, x86::zmm0, x86::ptr(x86::rdi, x86::rax));
+        assembler.kmovw(x86::r11d, x86::k1);
+    } else {
+        assembler.vpcmpeqq(x86::ymm1, x86::ymm0, x86::ptr(x86::rdi, x86::rax));
+        assembler.vpmovmskb(x86::r11d, x86::ymm1);
+    }
+    assembler.test(x86::r11d, x86::r11d);
+    assembler.jnz(found_label);
+    assembler.add(x86::rax, Imm(chunk_size));
+    assembler.cmp(x86::rax, x86::ptr_64(x86::rdi, -8));
+    assembler.jb(loop_label);
+    assembler.jmp(not_found);
+
+    assembler.bind(found_label);
+    assembler.bsf(x86::r11d, x86::r11d);
+    if (use_avx512) {
+        // the mask has one bit per field, the byte mask above already includes the factor 8
+        assembler.shl(x86::r11d, 3);
+    }
+    assembler.add(x86::rax, x86::r11);
+}
+
+void CodeGenerator::inline_cache_lookup(size_t cache_index, asmjit::Label hit_label) {
+    // layout of the record in r11. On a hit jumps to hit_label with the matching entry in rdi
+    using namespace asmjit;
+    mov_address(x86::rdi, Imm(&program.ctx_ptr->inline_caches[cache_index]), Relocation::INLINE_CACHE, cache_index);
+    for (size_t i = 0; i < runtime::INLINE_CACHE_ENTRIES; ++i) {
+        if (i > 0) {
+            assembler.add(x86::rdi, Imm(sizeof(runtime::InlineCache::Entry)));
+        }
+        assembler.cmp(x86::r11, x86::ptr_64(x86::rdi, offsetof(runtime::InlineCache::Entry, layout)));
+        assembler.je(hit_label);
+    }
+}
+
+void CodeGenerator::dense_array_lookup(asmjit::Label slow_label) {
+    // record in rsi, index in rdx. If the index is an integer within the dense array of the record,
+    // leaves the array in r11 and the untagged index in r10, otherwise jumps to slow_label
+    using namespace asmjit;
+    assembler.mov(x86::r10, x86::rdx);
+    assembler.and_(x86::r10, Imm(runtime::TAG_MASK));
+    assembler.cmp(x86::r10, Imm(runtime::INT_TAG));
+    assembler.jne(slow_label);
+    assembler.mov(x86::r11, x86::ptr_64(x86::rsi, offsetof(runtime::Record, elements) - runtime::RECORD_TAG));
+    assembler.test(x86::r11, x86::r11);
+    assembler.jz(slow_label);
+    assembler.mov(x86::r10, x86::rdx);
+    assembler.sar(x86::r10, 4);
+    // unsigned comparison also rejects negative indices
+    assembler.cmp(x86::r10, x86::ptr_64(x86::r11, offsetof(runtime::DenseArray, size)));
+    assembler.jae(slow_label);
+}
+
+void CodeGenerator::inline_alloc(size_t data_size) {
+    // bump allocate in the nursery, leaving the new HeapObject in r11 and clobbering r10. When the
+    // nursery is exhausted, the runtime allocates in the old space and schedules a collection
+    using namespace asmjit;
+    size_t alloc_size = ((sizeof(runtime::HeapObject) + data_size - 1) | 0b1111) + 1;
+    int32_t end_offset = (int32_t)(reinterpret_cast<char*>(&program.ctx_ptr->nursery_end) -
+                                   reinterpret_cast<char*>(&program.ctx_ptr->nursery_head));
+    Label slow_label = assembler.newLabel();
+    Label resume_label = assembler.newLabel();
+    mov_address(x86::r10, Imm(&program.ctx_ptr->nursery_head), Relocation::CONTEXT);
+    assembler.mov(x86::r11, x86::ptr_64(x86::r10));
+    assembler.add(x86::r11, Imm(alloc_size));
+    assembler.cmp(x86::r11, x86::ptr_64(x86::r10, end_offset));
+    assembler.ja(slow_label);
+    assembler.mov(x86::ptr_64(x86::r10), x86::r11);
+    assembler.sub(x86::r11, Imm(alloc_size));
+    // region byte and cleared remembered flag
+    assembler.mov(x86::qword_ptr(x86::r11), Imm(runtime::NURSERY_REGION));
+    assembler.bind(resume_label);
+    alloc_slow_paths.emplace_back(slow_label, resume_label, data_size);
+}
+
+void CodeGenerator::add_safepoint(const std::vector<int>& live_slots, int pushed_regs) {
+    // offsets are in words relative to rbp. Registers pushed at a gc site sit right below the
+    // stack slots of the frame
+    std::vector<int32_t> offsets;
+    for (int slot : live_slots) {
+        offsets.push_back(-slot - 1);
+    }
+    for (int i = 0; i < pushed_regs; ++i) {
+        offsets.push_back(-allocated_stack_slots - i - 1);
+    }
+    asmjit::Label label = assembler.newLabel();
+    assembler.bind(label);
+    safepoints.emplace_back(label, std::move(offsets));
+}
+
+auto CodeGenerator::get_safepoints() const -> const std::vector<std::pair<asmjit::Label, std::vector<int32_t>>>& {
+    return safepoints;
+}
+
+void CodeGenerator::mov_address(const asmjit::x86::Gp& reg, const asmjit::Imm& address, Relocation::Kind kind,
+                                uint32_t index) {
+    using namespace asmjit;
+    if (!image) {
+        assembler.mov(reg, address);
+        return;
+    }
+    // the long form keeps all 64 bits of the immediate at the end of the instruction, whatever the address
+    assert(reg.size() == 8);
+    assembler.long_().mov(reg, address);
+    Relocation reloc{(uint32_t) assembler.offset() - 8, kind, index, 0};
+    reloc.addend = (int64_t) (address.valueAs<uint64_t>() - relocation_target(program.ctx_ptr, program.immediates, reloc));
+    relocations.push_back(reloc);
+}
+
+void CodeGenerator::call_extern(const asmjit::Imm& function) {
+    using namespace asmjit;
+    if (!image) {
+        assembler.call(function);
+        return;
+    }
+    // called through r11, which is never an argument. A direct call would be relative to the address the
+    // code was generated at
+    auto* const* iter = std::find(std::begin(EXTERN_FUNCTIONS), std::end(EXTERN_FUNCTIONS),
+                                  reinterpret_cast<const void*>(function.valueAs<uint64_t>()));
+    assert(iter != std::end(EXTERN_FUNCTIONS));
+    mov_address(x86::r11, function, Relocation::EXTERN_FUNCTION, iter - std::begin(EXTERN_FUNCTIONS));
+    assembler.call(x86::r11);
+}
+
+void CodeGenerator::cmp_nursery_page(const asmjit::x86::Gp& reg) {
+    using namespace asmjit;
+    if (!image) {
+        assembler.cmp(reg, Imm(program.ctx_ptr->nursery_page));
+        return;
+    }
+    // the long form keeps a 32 bit immediate, as with a JIT the page of a new nursery has to fit
+    assembler.long_().cmp(reg, Imm(program.ctx_ptr->nursery_page));
+    relocations.push_back({(uint32_t) assembler.offset() - 4, Relocation::NURSERY_PAGE, 0, 0});
+}
+
+void CodeGenerator::write_barrier() {
+    // object written to in r10, stored value in r11, both are clobbered.
+    // values are compared by nursery page only, an integer that happens to alias the nursery just
+    // causes a spurious (harmless) entry in the remembered set
+    using namespace asmjit;
+    Label done = assembler.newLabel();
+    assembler.shr(x86::r11, program.ctx_ptr->nursery_shift);
+    cmp_nursery_page(x86::r11);
+    assembler.jne(done);
+    assembler.mov(x86::r11, x86::r10);
+    assembler.shr(x86::r11, program.ctx_ptr->nursery_shift);
+    cmp_nursery_page(x86::r11);
+    assembler.je(done);
+    assembler.call(remember_label);
+    assembler.bind(done);
+}
+
 void CodeGenerator::load(const asmjit::x86::Gp& reg, const IR::Operand& op) {
     using namespace asmjit;
     switch (op.type) {
         case IR::Operand::IMMEDIATE: {
-            assembler.mov(reg, Imm(program.immediates[op.index]));
+            runtime::Value val = program.immediates[op.index];
+            if (runtime::value_get_type(val) == runtime::ValueType::HeapString) {
+                mov_address(reg, Imm(val), Relocation::IMMEDIATE, op.index);
+            } else {
+                assembler.mov(reg, Imm(val));
+            }
         } break;
         case IR::Operand::MACHINE_REG:
             if (to_reg(op.index) != reg) {
@@ -546,45 +1577,20 @@ auto to_mem(int32_t stack_slot) -> asmjit::x86::Mem {
     return {asmjit::x86::rbp, 8 * (-stack_slot - 1)};
 }
 
-CodeGenerator::CodeGenerator(const IR::Program& program1, asmjit::CodeHolder* code_holder)
-    : program(program1), assembler(code_holder) {
-
-    program.ctx_ptr->init_globals(program.num_globals);
-    program.ctx_ptr->init_layouts(program.struct_layouts);
-    program.ctx_ptr->start_dynamic_alloc();
+CodeGenerator::CodeGenerator(const IR::Program& program1, asmjit::CodeHolder* code_holder, bool image1)
+    : program(program1), assembler(code_holder), image(image1) {
 
-    // after prelude but before functions, we need to generate layouts
-    std::vector<uint64_t> layouts;
-    for (const auto& layout : program.struct_layouts) {
-        this->layout_offsets.push_back((int32_t)layouts.size() * 8);
-        layouts.insert(layouts.end(), layout.begin(), layout.end());
-        while (layouts.size() % 4 != 0) {
-            layouts.push_back(0);
-        }
-    }
-    // make available at runtime
-    program.ctx_ptr->layout_offsets = this->layout_offsets;
+    use_avx512 = asmjit::CpuInfo::host().hasFeature(asmjit::x86::Features::kAVX512_F);
 
     // TODO maybe remove this in release builds, although speed difference should be small
     assembler.addValidationOptions(asmjit::BaseEmitter::kValidationOptionAssembler);
 
     init_labels();
-    generate_prelude();
-
-
-    for (size_t i = 0; i < program.functions.size(); ++i) {
-        process_function(i);
-    }
-
-    // align to 32 bytes (4 uint64_t values, 256 bit)
-    assembler.align(asmjit::AlignMode::kAlignData, 32);
-    // TODO CHECK THIS
-    assembler.bind(this->layout_base_label);
-    assembler.embedDataArray(asmjit::Type::kIdU64, layouts.data(), layouts.size(), 1);
 }
 
-void CodeGenerator::generate_prelude() {
+void CodeGenerator::generate_prelude(Executable* tiering) {
     using namespace asmjit;
+    executable = tiering;
     auto reg_restore_label = assembler.newLabel();
 
     save_volatile();
@@ -612,6 +1618,109 @@ void CodeGenerator::generate_prelude() {
     assembler.bind(reg_restore_label);
     restore_volatile();
     assembler.ret();
+
+    // write barrier slow path, adds object in r10 to remembered set. Preserves all registers
+    // since barriers are emitted in between register allocated instructions
+    assembler.bind(remember_label);
+    assembler.push(x86::rdi);
+    assembler.push(x86::rsi);
+    assembler.push(x86::rdx);
+    assembler.push(x86::rcx);
+    assembler.push(x86::r8);
+    assembler.push(x86::r9);
+    assembler.push(x86::rax);
+    assembler.push(x86::r10);
+    // with return address, 9 pushes keep the stack 16-byte aligned
+    assembler.push(x86::r11);
+    mov_address(x86::rdi, Imm(program.ctx_ptr), Relocation::CONTEXT);
+    assembler.mov(x86::rsi, x86::r10);
+    call_extern(Imm(runtime::extern_remember));
+    assembler.pop(x86::r11);
+    assembler.pop(x86::r10);
+    assembler.pop(x86::rax);
+    assembler.pop(x86::r9);
+    assembler.pop(x86::r8);
+    assembler.pop(x86::rcx);
+    assembler.pop(x86::rdx);
+    assembler.pop(x86::rsi);
+    assembler.pop(x86::rdi);
+    assembler.ret();
+
+    // allocation slow path, data size in r11 and resulting HeapObject returned in r11. Preserves all
+    // allocatable registers
+    assembler.bind(alloc_label);
+    assembler.push(x86::rdi);
+    assembler.push(x86::rsi);
+    assembler.push(x86::rdx);
+    assembler.push(x86::rcx);
+    assembler.push(x86::r8);
+    assembler.push(x86::r9);
+    assembler.push(x86::rax);
+    mov_address(x86::rdi, Imm(program.ctx_ptr), Relocation::CONTEXT);
+    assembler.mov(x86::rsi, x86::r11);
+    call_extern(Imm(runtime::extern_alloc_traced));
+    assembler.mov(x86::r11, x86::rax);
+    assembler.pop(x86::rax);
+    assembler.pop(x86::r9);
+    assembler.pop(x86::r8);
+    assembler.pop(x86::rcx);
+    assembler.pop(x86::rdx);
+    assembler.pop(x86::rsi);
+    assembler.pop(x86::rdi);
+    assembler.ret();
+
+    if (executable != nullptr) {
+        // recompiles the function with the index in r11 and returns its new code in r11. Called at
+        // function entry and loop headers of baseline code, preserves the argument registers
+        assembler.bind(tier_up_label);
+        assembler.push(x86::rdi);
+        assembler.push(x86::rsi);
+        assembler.push(x86::rdx);
+        assembler.push(x86::rcx);
+        assembler.push(x86::r8);
+        assembler.push(x86::r9);
+        assembler.push(x86::rax);
+        assembler.mov(x86::rdi, Imm(executable));
+        assembler.mov(x86::rsi, x86::r11);
+        assembler.call(Imm(Executable::tier_up));
+        assembler.mov(x86::r11, x86::rax);
+        assembler.pop(x86::rax);
+        assembler.pop(x86::r9);
+        assembler.pop(x86::r8);
+        assembler.pop(x86::rcx);
+        assembler.pop(x86::rdx);
+        assembler.pop(x86::rsi);
+        assembler.pop(x86::rdi);
+        assembler.ret();
+    }
+}
+
+void CodeGenerator::link_prelude(Executable* tiering, const std::vector<uint64_t>& addresses) {
+    using namespace asmjit;
+    executable = tiering;
+    auto labels = get_prelude_labels();
+    assert(labels.size() == addresses.size());
+    for (size_t i = 0; i < labels.size(); ++i) {
+        assembler.bind(labels[i]);
+        assembler.jmp(Imm(addresses[i]));
+    }
+}
+
+auto CodeGenerator::get_relocations() const -> const std::vector<Relocation>& {
+    return relocations;
+}
+
+auto CodeGenerator::get_site_labels() const -> const std::vector<std::tuple<size_t, int, asmjit::Label>>& {
+    return site_labels;
+}
+
+auto CodeGenerator::get_prelude_labels() const -> std::vector<asmjit::Label> {
+    return {uninit_var_label, illegal_cast_label, illegal_arith_label, rt_exception_label,
+            remember_label,   alloc_label,        tier_up_label};
+}
+
+auto CodeGenerator::get_function_label(size_t func_index) const -> asmjit::Label {
+    return function_labels[func_index];
 }
 
 void CodeGenerator::save_volatile() {
@@ -624,13 +1733,13 @@ void CodeGenerator::save_volatile() {
     assembler.push(x86::r14);
     assembler.push(x86::r15);
 
-    assembler.mov(x86::r10, Imm(&program.ctx_ptr->saved_rsp));
+    mov_address(x86::r10, Imm(&program.ctx_ptr->saved_rsp), Relocation::CONTEXT);
     assembler.mov(x86::ptr_64(x86::r10), x86::rsp);
 }
 
 void CodeGenerator::restore_volatile() {
     using namespace asmjit;
-    assembler.mov(x86::r10, Imm(&program.ctx_ptr->saved_rsp));
+    mov_address(x86::r10, Imm(&program.ctx_ptr->saved_rsp), Relocation::CONTEXT);
     assembler.mov(x86::rsp, x86::ptr_64(x86::r10));
 
     assembler.pop(x86::r15);
@@ -647,11 +1756,13 @@ void CodeGenerator::init_labels() {
     for (auto& label : function_labels) {
         label = assembler.newLabel();
     }
-    layout_base_label = assembler.newLabel();
     uninit_var_label = assembler.newLabel();
     illegal_cast_label = assembler.newLabel();
     illegal_arith_label = assembler.newLabel();
     rt_exception_label = assembler.newLabel();
+    remember_label = assembler.newLabel();
+    alloc_label = assembler.newLabel();
+    tier_up_label = assembler.newLabel();
 }
 
 auto ExecutionError::code_to_text(int i) -> const char* {
@@ -1,8 +1,11 @@
 #pragma once
 
 #include <ostream>
+#include <string_view>
+#include <tuple>
 #include "ir.h"
 #include "regalloc.h"
+#include "serialize.h"
 #include "x86.h"
 
 namespace codegen {
@@ -24,43 +27,222 @@ class ExecutionError : public std::runtime_error {
     explicit ExecutionError(int kind);
 };
 
+// calls plus loop iterations of a baseline function before it is recompiled by the optimizing tier
+const int64_t TIER_UP_HOTNESS = 1000;
+// functions with more virtual registers use linear scan even with graph coloring enabled, building the
+// interference graph is quadratic
+const int GRAPH_COLORING_MAX_REGS = 2000;
+
+struct CompileOptions {
+    // passes of the optimizing tier
+    bool use_inlining{false};
+    bool use_const_propagation{false};
+    bool use_dead_code_removal{false};
+    bool use_type_inference{false};
+    bool use_shape_analysis{false};
+    bool use_escape_analysis{false};
+    bool use_gvn{false};
+    bool use_licm{false};
+    bool use_unboxing{false};
+    bool use_branch_fusion{false};
+    // register allocation by graph coloring for optimized functions with loops that make no calls, see
+    // allocate_registers_coloring
+    bool use_graph_coloring{false};
+    // start functions in the baseline tier, otherwise the whole program is optimized up front
+    bool use_tiering{true};
+    // let optimized code assume the operand types baseline code has seen, guarded by deoptimization
+    bool use_speculation{true};
+    bool emit_code{false};
+    // generate code that can be saved as an image, see Executable::save_image. Implies optimizing the
+    // whole program up front without speculation
+    bool aot{false};
+    // the program is already the output of the optimization passes, as read from an IR cache. Implies
+    // compiling the whole program up front
+    bool optimized_ir{false};
+};
+
+// absolute address in generated code, recorded for images so that loading one can patch in the address
+// of the same thing in the new context
+struct Relocation {
+    enum Kind : uint8_t {
+        CONTEXT,          // the program context, the addend is the offset of a member
+        GLOBALS,
+        FUNCTION_ENTRY,   // entry of function index in the function table
+        LAYOUT_TABLE,     // table of layout index
+        INLINE_CACHE,     // cache index in the context
+        IMMEDIATE,        // heap string immediate index
+        NURSERY_PAGE,     // 32 bit immediate, all other kinds are 64 bit
+        EXTERN_FUNCTION,  // runtime function index of EXTERN_FUNCTIONS in codegen.cpp
+    };
+
+    uint32_t offset;  // of the immediate in the code
+    Kind kind;
+    uint32_t index;
+    int64_t addend;
+};
+
+// contents of an image written by Executable::save_image
+struct Image {
+    // identifies the source, the options and the build of the compiler, see cache_key
+    uint64_t key{0};
+    std::string_view code;
+    std::vector<Relocation> relocations;
+    // entry point of each function, the prelude with the entry of the program is at offset 0
+    std::vector<uint32_t> function_offsets;
+    // return address offset and live stack words of each safepoint
+    std::vector<std::pair<uint32_t, std::vector<int32_t>>> safepoints;
+    uint32_t num_inline_caches{0};
+    uint32_t num_globals{0};
+    std::vector<serialize::SavedValue> immediates;
+    std::vector<std::vector<serialize::SavedValue>> struct_layouts;
+
+    // parses the image, which has to outlive this. Returns false if it is not a complete image
+    auto read(std::string_view data) -> bool;
+};
+
+// hash of everything cached images and IR depend on: the source, the options, the heap size and the
+// build of the compiler and the CPU it runs on
+auto cache_key(std::string_view source, const CompileOptions& options, size_t heap_size) -> uint64_t;
+
+class Executable;
+
 class CodeGenerator {
     const IR::Program& program;
     asmjit::x86::Assembler assembler;
+    // target of the tier up stub, set when generating the prelude
+    Executable* executable{nullptr};
 
-    std::vector<int32_t> layout_offsets;
     std::vector<asmjit::Label> function_labels;
-    asmjit::Label layout_base_label;
     asmjit::Label uninit_var_label, illegal_cast_label, illegal_arith_label, rt_exception_label;
+    asmjit::Label remember_label, alloc_label, tier_up_label;
 
     int current_args{0};
+    int allocated_stack_slots{0};
+    // layout lookups compare 8 fields at a time instead of 4
+    bool use_avx512{false};
+    // record the absolute addresses in the code, for saving it as an image
+    bool image{false};
+    std::vector<Relocation> relocations;
+
+    // return address label of each call or gc site, and the live stack words at that point
+    std::vector<std::pair<asmjit::Label, std::vector<int32_t>>> safepoints;
+    // allocation slow paths of the current function: entry label, resume label and data size
+    std::vector<std::tuple<asmjit::Label, asmjit::Label, size_t>> alloc_slow_paths;
+    // tier up slow paths of the current function: entry label, resume label and whether the check is
+    // in the prologue
+    std::vector<std::tuple<asmjit::Label, asmjit::Label, bool>> tier_up_slow_paths;
+    // deoptimization paths of the current function: entry label, site and deopt map of the guard
+    std::vector<std::tuple<asmjit::Label, int, const IR::DeoptState*>> deopt_paths;
+    // start of each ADD and EQ in baseline code: function, site and label
+    std::vector<std::tuple<size_t, int, asmjit::Label>> site_labels;
 
     void process_instruction(const IR::Instruction& instr);
-    void process_block(const IR::Function& func, size_t block_index, std::vector<asmjit::Label>& block_labels);
-    void process_function(size_t func_index);
+    void process_block(const IR::Function& func, size_t func_index, size_t block_index,
+                       std::vector<asmjit::Label>& block_labels, bool baseline);
+    void process_cmp_branch(const IR::BasicBlock& block, size_t block_index,
+                            const std::vector<asmjit::Label>& block_labels);
+    void count_hotness(size_t func_index, bool at_entry);
+    void record_feedback(size_t func_index, int site);
+    void deoptimize(size_t func_index, int site, const IR::DeoptState* map);
 
     void load(const asmjit::x86::Gp& reg, const IR::Operand& op);
     void store(const IR::Operand& op, const asmjit::x86::Gp& reg);
 
-    void generate_prelude();
+    void mov_address(const asmjit::x86::Gp& reg, const asmjit::Imm& address, Relocation::Kind kind,
+                     uint32_t index = 0);
+    void call_extern(const asmjit::Imm& function);
+    void cmp_nursery_page(const asmjit::x86::Gp& reg);
+
+    void inline_alloc(size_t data_size);
+    void dense_array_lookup(asmjit::Label slow_label);
+    void layout_lookup(const asmjit::x86::Gp& rec, const asmjit::x86::Gp& name, asmjit::Label not_found);
+    void inline_cache_lookup(size_t cache_index, asmjit::Label hit_label);
+    void add_safepoint(const std::vector<int>& live_slots, int pushed_regs);
+    void write_barrier();
+
     void save_volatile();
     void restore_volatile();
     void init_labels();
 
    public:
-    CodeGenerator(const IR::Program& program1, asmjit::CodeHolder* code_holder);
+    CodeGenerator(const IR::Program& program1, asmjit::CodeHolder* code_holder, bool image1 = false);
+
+    // entry point and out of line code shared by all functions, in the first code buffer
+    void generate_prelude(Executable* tiering);
+    // for code buffers added later, makes the shared code reachable by jumping to its absolute addresses
+    void link_prelude(Executable* tiering, const std::vector<uint64_t>& addresses);
+    // baseline functions count their calls and loop iterations and call the tier up stub when hot
+    void process_function(size_t func_index, const IR::Function& func, bool baseline);
+
+    auto get_prelude_labels() const -> std::vector<asmjit::Label>;
+    auto get_function_label(size_t func_index) const -> asmjit::Label;
+    auto get_safepoints() const -> const std::vector<std::pair<asmjit::Label, std::vector<int32_t>>>&;
+    auto get_site_labels() const -> const std::vector<std::tuple<size_t, int, asmjit::Label>>&;
+    auto get_relocations() const -> const std::vector<Relocation>&;
+};
+
+// baseline code of a function, where frames of optimized code continue after a failed guard
+struct BaselineCode {
+    uint64_t entry{0};
+    int frame_slots{0};
+    // address of each ADD and EQ site, expecting the operands in RSI and RDX
+    std::vector<uint64_t> sites;
+};
+
+// where a deoptimized frame continues, read by the deoptimization path of a guard
+struct DeoptExit {
+    uint64_t rsp;
+    uint64_t rsi;
+    uint64_t rdx;
+    uint64_t target;
 };
 
 class Executable {
     asmjit::JitRuntime jit_rt;
+    IR::Program program;
     runtime::ProgramContext* ctx_ptr;
+    CompileOptions options;
+    // the program before any pass, which baseline code and deopt states are in terms of. With tiering,
+    // program.functions is kept the same outside of a tier up, so that the passes inline the originals
+    std::vector<IR::Function> original_functions;
+    std::vector<BaselineCode> baseline_code;
+    // optimized functions after register allocation, their deopt maps are referenced by generated code
+    std::deque<IR::Function> optimized_functions;
+    DeoptExit deopt_exit{};
+    // absolute addresses of the prelude labels, for linking code buffers added later
+    std::vector<uint64_t> prelude_addresses;
+    std::vector<void*> code_buffers;
     int (*function)(){nullptr};
+    // of the code generated with the aot option, which is all in the first buffer
+    size_t image_code_size{0};
+    std::vector<Relocation> relocations;
+
+    // runs the passes on one function, or on all of them if only_function is -1
+    void optimize_program(int only_function);
+    void allocate_optimized(IR::Function& func) const;
+    auto add_code(asmjit::CodeHolder& code, const CodeGenerator& generator) -> uint64_t;
+    auto compile_optimized(size_t func_index) -> uint64_t;
 
    public:
-    explicit Executable(IR::Program program1, bool emit_code=false);
+    Executable(IR::Program program1, const CompileOptions& options1);
+    // loads an image instead of compiling, the heap size has to be the one the image key was made with
+    Executable(const Image& image, size_t heap_size);
     ~Executable();
     void run();
 
+    // code and context of a program compiled with the aot option, in the format read by Image::read. Has
+    // to be called before the program runs
+    auto save_image(uint64_t key) const -> std::string;
+    // without tiering, the program after the optimization passes and before register allocation
+    auto get_program() const -> const IR::Program&;
+
+    // called by baseline code once a function is hot, returns the address of the optimized code
+    static auto tier_up(Executable* executable, uint64_t func_index) -> uint64_t;
+    // called by optimized code when a guard fails, rewrites its frame into the baseline frame and sends
+    // the function back to the baseline tier
+    static auto deoptimize(Executable* executable, uint64_t func_index, uint64_t site, const IR::DeoptState* map,
+                           const uint64_t* saved_regs, uint64_t* frame) -> const DeoptExit*;
+    auto get_baseline_frame(size_t func_index) const -> int;
 };
 
 auto get_block_dfs_order(const IR::Function& func) -> std::vector<size_t>;
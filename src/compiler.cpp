@@ -4,8 +4,7 @@
 #include <string>
 #include <vector>
 #include "AST.h"
-#include "Assigns.h"
-#include "FreeVariables.h"
+#include "ScopeAnalysis.h"
 #include "ir.h"
 #include "irprinter.h"
 #include "value.h"
@@ -15,6 +14,7 @@ using namespace std;
 Compiler::Compiler(size_t heap_size) {
     program_ = new IR::Program(heap_size);
     layout_map_cnt_ = 0;
+    alloc_site_cnt_ = 0;
 
     IR::Function print_ = {
         {{{},
@@ -60,13 +60,6 @@ Compiler::Compiler(size_t heap_size) {
     fun_ = new IR::Function();  // this is the global scope
     block_ = IR::BasicBlock();
 
-    names_["print"] = 0;
-    names_["input"] = 1;
-    names_["intcast"] = 2;
-    globals_.insert("print");
-    globals_.insert("input");
-    globals_.insert("intcast");
-
     program_->immediates.push_back(0);                         // NONE
     program_->immediates.push_back(runtime::to_value(true));   // TRUE
     program_->immediates.push_back(runtime::to_value(false));  // FALSE
@@ -120,7 +113,27 @@ IR::Program* Compiler::get_program() {
     return program_;
 }
 
+// string constant as an immediate, shared with all equal strings of the program
+int Compiler::string_immediate(std::string_view str) {
+    std::string key(str);
+    if (!str_const_.count(key)) {
+        program_->immediates.push_back(program_->ctx_ptr->intern(runtime::to_value(program_->ctx_ptr, key)));
+        str_const_[key] = imm_cnt_++;
+    }
+    return str_const_[key];
+}
+
 void Compiler::visit(AST::Program& expr) {
+    symbols_ = &expr.symbols;
+    ScopeAnalysis scopes(expr);
+    expr.accept(scopes);
+
+    const char* builtins[] = {"print", "input", "intcast"};
+    for (int i = 0; i < 3; i++) {
+        names_[expr.symbols.intern(builtins[i])] = i;
+        globals_.insert(expr.symbols.intern(builtins[i]));
+    }
+
     for (auto c : expr.children)
         c->accept(*((Visitor*)this));
 
@@ -151,8 +164,8 @@ void Compiler::visit(AST::Return& expr) {
 }
 
 void Compiler::visit(AST::Assignment& expr) {
-    if (expr.Lhs->isStringConstant()) {
-        string s = ((AST::StringConstant*)expr.Lhs)->getVal();
+    if (expr.Lhs->isName()) {
+        AST::Symbol s = ((AST::Name*)expr.Lhs)->name;
 
         if (global_scope_ && !globals_.count(s)) {
             if (!names_.count(s))
@@ -200,12 +213,7 @@ void Compiler::visit(AST::Assignment& expr) {
         if (!is_opr_)
             opr_ = {IR::Operand::OpType::VIRT_REG, ret_reg_};
 
-        int idx;
-        if (!str_const_.count(exp->field)) {
-            program_->immediates.push_back(runtime::to_value(program_->ctx_ptr, exp->field));
-            str_const_[exp->field] = imm_cnt_++;
-        }
-        idx = str_const_[exp->field];
+        int idx = string_immediate(symbols_->name(exp->field));
 
         IR::Instruction store_field;
         store_field.op = IR::Operation::REC_STORE_NAME;
@@ -261,24 +269,24 @@ void Compiler::visit(AST::IfStatement& expr) {
 
     fun_->blocks.push_back(block_);
 
-    std::map<std::string, int> tlocal_vars1 = local_vars_, tlocal_vars2 = local_vars_;
+    std::map<AST::Symbol, int> tlocal_vars1 = local_vars_, tlocal_vars2 = local_vars_;
     block_ = IR::BasicBlock();
     block_.predecessors.push_back(cond_idx);
 
-    expr.children[0]->accept(*((Visitor*)this));
+    expr.block->accept(*((Visitor*)this));
 
     last_if_idx = fun_->blocks.size();
     fun_->blocks.push_back(block_);
     tlocal_vars1 = local_vars_;
 
-    if (expr.children.size() > 1) {
+    if (expr.else_block) {
         local_vars_ = tlocal_vars2;
 
         block_ = IR::BasicBlock();
         block_.predecessors.push_back(cond_idx);
         fun_->blocks[cond_idx].successors.push_back(last_if_idx + 1);
 
-        expr.children[1]->accept(*((Visitor*)this));
+        expr.else_block->accept(*((Visitor*)this));
         last_else_idx = fun_->blocks.size();
 
         fun_->blocks.push_back(block_);
@@ -290,7 +298,7 @@ void Compiler::visit(AST::IfStatement& expr) {
     block_.predecessors.push_back(last_if_idx);
     fun_->blocks[last_if_idx].successors.push_back(next_idx);
 
-    if (expr.children.size() > 1) {
+    if (expr.else_block) {
         fun_->blocks[last_else_idx].successors.push_back(next_idx);
         block_.predecessors.push_back(last_else_idx);
     } else {
@@ -333,11 +341,11 @@ void Compiler::visit(AST::WhileLoop& expr) {  // could contain empty blocks
     block_.instructions.push_back({IR::Operation::BRANCH, IR::Operand(), opr_});
     fun_->blocks.push_back(block_);
 
-    std::map<std::string, int> tlocal_vars = local_vars_;
+    std::map<AST::Symbol, int> tlocal_vars = local_vars_;
     block_ = IR::BasicBlock();
     block_.predecessors.push_back(header_idx);
 
-    expr.children[0]->accept(*((Visitor*)this));
+    expr.block->accept(*((Visitor*)this));
     last_body_idx = fun_->blocks.size();
     block_.successors.push_back(header_idx);
     fun_->blocks[header_idx].predecessors.push_back(last_body_idx);
@@ -388,18 +396,23 @@ void Compiler::visit(AST::FunctionDeclaration& expr) {
     IR::Function* tfun = fun_;
     IR::BasicBlock tblock = block_;
     bool tscope = global_scope_;
-    std::set<string> tglobals = globals_;
-    std::set<string> tref = ref_;
+    std::set<AST::Symbol> tglobals = globals_;
+    std::set<AST::Symbol> tref = ref_;
+    std::set<AST::Symbol> tvalue_ref = value_ref_;
     int treg_cnt = reg_cnt_;
     int tret_reg = ret_reg_;
 
-    std::map<std::string, int> tlocal_vars = std::move(local_vars_);
-    std::set<std::string> tlocal_reference_vars = std::move(local_reference_vars_);
-    std::map<std::string, int> tfree_vars = std::move(free_vars_);
+    std::map<AST::Symbol, int> tlocal_vars = std::move(local_vars_);
+    std::set<AST::Symbol> tlocal_reference_vars = std::move(local_reference_vars_);
+    std::set<AST::Symbol> tlocal_value_captures = std::move(local_value_captures_);
+    std::map<AST::Symbol, int> tfree_vars = std::move(free_vars_);
+    std::set<AST::Symbol> tvalue_free_vars = std::move(value_free_vars_);
 
-    local_vars_ = std::map<std::string, int>();
-    local_reference_vars_ = std::set<std::string>();
-    free_vars_ = std::map<std::string, int>();
+    local_vars_ = std::map<AST::Symbol, int>();
+    local_reference_vars_ = std::set<AST::Symbol>();
+    local_value_captures_ = std::set<AST::Symbol>();
+    free_vars_ = std::map<AST::Symbol, int>();
+    value_free_vars_ = std::set<AST::Symbol>();
 
     fun_ = new IR::Function;
     block_ = IR::BasicBlock();
@@ -407,65 +420,69 @@ void Compiler::visit(AST::FunctionDeclaration& expr) {
     global_scope_ = false;
     fun_->parameter_count = expr.arguments.size();
 
-    for (const auto& s : tlocal_reference_vars)
+    for (const auto& s : tlocal_reference_vars) {
         ref_.insert(s);
+        value_ref_.erase(s);
+    }
+    for (const auto& s : tlocal_value_captures) {
+        ref_.insert(s);
+        value_ref_.insert(s);
+    }
 
-    FreeVariables freeVar;
-    expr.block->accept(freeVar);
-    vector<string> free_var = freeVar.getFreeVariables();
-    vector<string> cur_var = freeVar.getCurVariables();
-    vector<string> nb_var = freeVar.getNotBoundVariables();
-
-    Assigns assigns;
-    expr.block->accept(assigns);
-    vector<string> ass_var = assigns.getVariables();
-
-    Globals globals;
-    expr.block->accept(globals);
-    vector<string> glob_var = globals.getGlobals();
+    const AST::Scope& scope = expr.scope;
+    std::set<AST::Symbol> nb_var(scope.captured.begin(), scope.captured.end());
+    std::set<AST::Symbol> value_captures(scope.value_captures.begin(), scope.value_captures.end());
+    std::set<AST::Symbol> glob_var(scope.globals.begin(), scope.globals.end());
+    std::map<AST::Symbol, int> ass_cnt(scope.assigned.begin(), scope.assigned.end());
 
     // QUI INIZIA IL CASINO
 
     for (const auto& s : expr.arguments) {
         local_vars_[s] = reg_cnt_++;
-        if (count(nb_var.begin(), nb_var.end(), s))
+        if (value_captures.count(s))
+            local_value_captures_.insert(s);
+        else if (nb_var.count(s))
             local_reference_vars_.insert(s);
         if (globals_.count(s))
             globals_.erase(s);
-        if (ref_.count(s))
-            ref_.erase(s);
+        ref_.erase(s);
+        value_ref_.erase(s);
     }
 
-    for (const auto& s : glob_var) {
+    for (const auto& s : scope.globals) {
         globals_.insert(s);
         if (!names_.contains(s))
             names_[s] = names_cnt_++;
-        if (ref_.count(s))
-            ref_.erase(s);
+        ref_.erase(s);
+        value_ref_.erase(s);
     }
 
-    std::set<std::string> new_ass;
-    for (const auto& s : ass_var) {
-        if (count(glob_var.begin(), glob_var.end(), s))
+    std::set<AST::Symbol> new_ass;
+    for (const auto& p : scope.assigned) {
+        AST::Symbol s = p.first;
+        if (glob_var.count(s))
             continue;
         if (count(expr.arguments.begin(), expr.arguments.end(), s))
             continue;
-        if (new_ass.count(s))
-            continue;
 
         new_ass.insert(s);
         local_vars_[s] = reg_cnt_++;
-        if (count(nb_var.begin(), nb_var.end(), s))
+        if (value_captures.count(s))
+            local_value_captures_.insert(s);
+        else if (nb_var.count(s))
             local_reference_vars_.insert(s);
         if (globals_.count(s))
             globals_.erase(s);
-        if (ref_.count(s))
-            ref_.erase(s);
+        ref_.erase(s);
+        value_ref_.erase(s);
     }
 
-    for (const auto& s : free_var)
+    for (const auto& s : scope.free) {
         if (ref_.count(s))
             free_vars_[s] = -1;
+        if (value_ref_.count(s))
+            value_free_vars_.insert(s);
+    }
 
     IR::Operand fun_reg = {IR::Operand::OpType::VIRT_REG, treg_cnt};
     int b_idx = tblock.instructions.size();
@@ -484,10 +501,9 @@ void Compiler::visit(AST::FunctionDeclaration& expr) {
         block_.instructions.push_back(l_arg);
 
         if (local_reference_vars_.count(s)) {
-            int ass_cnt = (int) count(ass_var.begin(), ass_var.end(), s);
             int new_reg = reg_cnt_++;
             a_refs.push_back(
-                {IR::Operation::ALLOC_REF, {IR::Operand::OpType::VIRT_REG, new_reg},{IR::Operand::OpType::LOGICAL, ass_cnt}});
+                {IR::Operation::ALLOC_REF, {IR::Operand::OpType::VIRT_REG, new_reg},{IR::Operand::OpType::LOGICAL, ass_cnt[s]}});
             IR::Instruction s_ref;
             s_ref.op = IR::Operation::REF_STORE;
             s_ref.args[0] = {IR::Operand::OpType::VIRT_REG, new_reg};
@@ -509,7 +525,8 @@ void Compiler::visit(AST::FunctionDeclaration& expr) {
                                        {IR::Operand::OpType::LOGICAL, idx}});
         free_vars_[s.first] = reg_cnt_++;  // could be done later
 
-        if (tlocal_reference_vars.count(s.first)) {
+        if (tlocal_reference_vars.count(s.first) || tlocal_value_captures.count(s.first)) {
+            // the reference, or the current value of a variable captured by value
             IR::Instruction set_c;
             set_c.op = IR::Operation::SET_CAPTURE;
             set_c.args[0] = {IR::Operand::OpType::LOGICAL, idx};
@@ -535,9 +552,8 @@ void Compiler::visit(AST::FunctionDeclaration& expr) {
 
     for (const auto& var : new_ass) {
         if (local_reference_vars_.count(var)) {
-            int ass_cnt = (int) count(ass_var.begin(), ass_var.end(), var);
             block_.instructions.push_back(
-                {IR::Operation::ALLOC_REF, {IR::Operand::OpType::VIRT_REG, local_vars_[var]}, {IR::Operand::OpType::LOGICAL, ass_cnt}});
+                {IR::Operation::ALLOC_REF, {IR::Operand::OpType::VIRT_REG, local_vars_[var]}, {IR::Operand::OpType::LOGICAL, ass_cnt[var]}});
             IR::Instruction s_ref;
             s_ref.op = IR::Operation::REF_STORE;
             s_ref.args[0] = {IR::Operand::OpType::VIRT_REG, local_vars_[var]};
@@ -574,12 +590,15 @@ void Compiler::visit(AST::FunctionDeclaration& expr) {
 
     local_vars_ = tlocal_vars;
     local_reference_vars_ = tlocal_reference_vars;
+    local_value_captures_ = tlocal_value_captures;
     free_vars_ = tfree_vars;
+    value_free_vars_ = tvalue_free_vars;
     fun_ = tfun;
     block_ = tblock;
     global_scope_ = tscope;
     globals_ = tglobals;
     ref_ = tref;
+    value_ref_ = tvalue_ref;
     reg_cnt_ = treg_cnt;
     ret_reg_ = tret_reg;
 }
@@ -655,7 +674,7 @@ void Compiler::visit(AST::BinaryExpression& expr) {
 
 void Compiler::visit(AST::UnaryExpression& expr) {
     IR::Operand opr;
-    expr.children[0]->accept(*((Visitor*)this));
+    expr.child->accept(*((Visitor*)this));
     if (is_opr_)
         opr = opr_;
     else
@@ -723,12 +742,7 @@ void Compiler::visit(AST::FieldDereference& expr) {
     block_.instructions.push_back(
         {IR::Operation::ASSERT_RECORD, IR::Operand(), {IR::Operand::OpType::VIRT_REG, rec_reg}});
 
-    int idx;
-    if (!str_const_.count(expr.field)) {
-        program_->immediates.push_back(runtime::to_value(program_->ctx_ptr, expr.field));
-        str_const_[expr.field] = imm_cnt_++;
-    }
-    idx = str_const_[expr.field];
+    int idx = string_immediate(symbols_->name(expr.field));
 
     IR::Instruction load_field;
     load_field.op = IR::Operation::REC_LOAD_NAME;
@@ -768,16 +782,11 @@ void Compiler::visit(AST::Record& expr) {
 
     std::vector<std::string> std_fields;
     for (const auto &p : expr.dict) 
-        std_fields.push_back(p.first);
+        std_fields.push_back(std::string(symbols_->name(p.first)));
     sort(std_fields.begin(), std_fields.end());
     std::vector<runtime::Value> fields;
-    for (const auto &s : std_fields) {
-        if (!str_const_.count(s)) {
-            program_->immediates.push_back(runtime::to_value(program_->ctx_ptr, s));
-            str_const_[s] = imm_cnt_++;
-        }
-        fields.push_back(program_->immediates[str_const_[s]]);
-    }
+    for (const auto &s : std_fields)
+        fields.push_back(program_->immediates[string_immediate(s)]);
     
     if (!layout_map_.count(std_fields)) {
         program_->struct_layouts.push_back(fields);
@@ -789,6 +798,8 @@ void Compiler::visit(AST::Record& expr) {
     a_ref.out = {IR::Operand::OpType::VIRT_REG, rec_reg};
     a_ref.args[0] = {IR::Operand::OpType::LOGICAL, (int) expr.dict.size()};
     a_ref.args[1] = {IR::Operand::OpType::LOGICAL, layout_map_[std_fields]};//  find idx
+    // allocation site, records from it are sized for the fields the site's records reached before
+    a_ref.args[2] = {IR::Operand::OpType::LOGICAL, alloc_site_cnt_++};
     block_.instructions.push_back(a_ref);
 
     reg_cnt_++;
@@ -799,12 +810,7 @@ void Compiler::visit(AST::Record& expr) {
         if (!is_opr_)
             opr_ = {IR::Operand::OpType::VIRT_REG, ret_reg_};
 
-        int idx;
-        if (!str_const_.count(p.first)) {
-            program_->immediates.push_back(runtime::to_value(program_->ctx_ptr, p.first));
-            str_const_[p.first] = imm_cnt_++;
-        }
-        idx = str_const_[p.first];
+        int idx = string_immediate(symbols_->name(p.first));
 
         IR::Instruction store_field;
         store_field.op = IR::Operation::REC_STORE_NAME;
@@ -832,47 +838,40 @@ void Compiler::visit(AST::IntegerConstant& expr) {
 }
 
 void Compiler::visit(AST::StringConstant& expr) {
-    string s = expr.getVal();
+    is_opr_ = true;
+    opr_ = {IR::Operand::OpType::IMMEDIATE, string_immediate(expr.getVal())};
+}
+
+void Compiler::visit(AST::Name& expr) {
+    AST::Symbol s = expr.name;
     is_opr_ = false;
-    if (s[0] == '"') {
-        is_opr_ = true;
-        string str = s.substr(1, s.size() - 2);
-
-        int idx;
-        if (!str_const_.count(str)) {
-            program_->immediates.push_back(runtime::to_value(program_->ctx_ptr, str));  // str
-            str_const_[str] = imm_cnt_++;
-        }
-        idx = str_const_[str];
+    if (global_scope_ && !globals_.count(s)) {
+        if (!names_.count(s))
+            names_[s] = names_cnt_++;
+        globals_.insert(s);
+    }
 
-        opr_ = {IR::Operand::OpType::IMMEDIATE, idx};
+    if (globals_.count(s)) {
+        block_.instructions.push_back({IR::Operation::LOAD_GLOBAL,
+                                       {IR::Operand::OpType::VIRT_REG, reg_cnt_},
+                                       {IR::Operand::OpType::LOGICAL, names_[s]}});
+        ret_reg_ = reg_cnt_++;
+        return;
+    } else if (local_reference_vars_.count(s)) {
+        block_.instructions.push_back({IR::Operation::REF_LOAD,
+                                       {IR::Operand::OpType::VIRT_REG, reg_cnt_},
+                                       {IR::Operand::OpType::VIRT_REG, local_vars_[s]}});
+        ret_reg_ = reg_cnt_++;
+    } else if (value_free_vars_.count(s)) {
+        ret_reg_ = free_vars_[s];
+    } else if (free_vars_.count(s)) {
+        block_.instructions.push_back({IR::Operation::REF_LOAD,
+                                       {IR::Operand::OpType::VIRT_REG, reg_cnt_},
+                                       {IR::Operand::OpType::VIRT_REG, free_vars_[s]}});
+        ret_reg_ = reg_cnt_++;
     } else {
-        if (global_scope_ && !globals_.count(s)) {
-            if (!names_.count(s))
-                names_[s] = names_cnt_++;
-            globals_.insert(s);
-        }
-
-        if (globals_.count(s)) {
-            block_.instructions.push_back({IR::Operation::LOAD_GLOBAL,
-                                           {IR::Operand::OpType::VIRT_REG, reg_cnt_},
-                                           {IR::Operand::OpType::LOGICAL, names_[s]}});
-            ret_reg_ = reg_cnt_++;
-            return;
-        } else if (local_reference_vars_.count(s)) {
-            block_.instructions.push_back({IR::Operation::REF_LOAD,
-                                           {IR::Operand::OpType::VIRT_REG, reg_cnt_},
-                                           {IR::Operand::OpType::VIRT_REG, local_vars_[s]}});
-            ret_reg_ = reg_cnt_++;
-        } else if (free_vars_.count(s)) {
-            block_.instructions.push_back({IR::Operation::REF_LOAD,
-                                           {IR::Operand::OpType::VIRT_REG, reg_cnt_},
-                                           {IR::Operand::OpType::VIRT_REG, free_vars_[s]}});
-            ret_reg_ = reg_cnt_++;
-        } else {
-            ret_reg_ = local_vars_[s];
-        }  // should default be globals?
-    }
+        ret_reg_ = local_vars_[s];
+    }  // should default be globals?
 }
 
 void Compiler::visit(AST::BoolConstant& expr) {
@@ -4,8 +4,6 @@
 #include <set>
 #include <vector>
 #include "AST.h"
-#include "Assigns.h"
-#include "FreeVariables.h"
 #include "ir.h"
 #include "irprinter.h"
 
@@ -23,16 +21,23 @@ class Compiler : public Visitor {
     int reg_cnt_;
     int ret_reg_;
     
-    std::map<std::string, int> local_vars_;
-    std::set<std::string> local_reference_vars_;
-    std::map<std::string, int> free_vars_;
-    std::map<std::string, int> names_;
+    const AST::SymbolTable* symbols_;
+
+    std::map<AST::Symbol, int> local_vars_;
+    std::set<AST::Symbol> local_reference_vars_;
+    // captured locals copied into the closures instead of being shared through a reference
+    std::set<AST::Symbol> local_value_captures_;
+    std::map<AST::Symbol, int> free_vars_;
+    std::set<AST::Symbol> value_free_vars_;
+    std::map<AST::Symbol, int> names_;
     
-    std::set<std::string> globals_; 
-    std::set<std::string> ref_;
+    std::set<AST::Symbol> globals_; 
+    std::set<AST::Symbol> ref_;
+    std::set<AST::Symbol> value_ref_;
 
     std::map<std::vector<std::string>, int> layout_map_;
     int layout_map_cnt_;
+    int alloc_site_cnt_;
     
     int imm_cnt_;
     size_t names_cnt_;
@@ -40,7 +45,9 @@ class Compiler : public Visitor {
     std::map<int, int> int_const_;
 
     bool shape_analysis_;
-    
+
+    int string_immediate(std::string_view str);
+
    public:
     explicit Compiler(size_t heap_size);
     IR::Program* get_program();
@@ -60,6 +67,7 @@ class Compiler : public Visitor {
     void visit(AST::Record& expr);
     void visit(AST::IntegerConstant& expr);
     void visit(AST::StringConstant& expr);
+    void visit(AST::Name& expr);
     void visit(AST::BoolConstant& expr);
     void visit(AST::NoneConstant& expr);
 };
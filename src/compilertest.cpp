@@ -1,30 +1,21 @@
 #include <cassert>
-#include <fstream>
+#include <cstdlib>
 #include <iostream>
 #include <filesystem>
+#include <fstream>
+#include <unistd.h>
 
-#include "AST.h"
-#include "MITScript.h"
-#include "antlr4-runtime.h"
-#include "compiler.h"
-#include "parsercode.h"
-#include "irprinter.h"
+#include "lexer.h"
+#include "irserializer.h"
 #include "ir.h"
-#include "regalloc.h"
-#include "dead_code_remover.h"
-#include "const_propagator.h"
-#include "type_inferer.h"
 #include "codegen.h"
-#include "shape_analysis.h"
+#include "mitscript.h"
 
 struct Arguments {
     std::string filename{"../inputs/test.mit"};
-    size_t memory_limit{40 * (1 << 20)};
-    bool use_const_propagation{false};
-    bool use_dead_code_removal{false};
-    bool use_type_inference{false};
-    bool use_shape_analysis{false};
-    bool emit_ir{false};
+    size_t memory_limit{mitscript::DEFAULT_HEAP_SIZE};
+    codegen::CompileOptions options;
+    bool cache_ir{false};
 
     Arguments(int argc, const char* argv[]) {
         int i = 1;
@@ -32,24 +23,58 @@ struct Arguments {
             std::string arg{argv[i]};
             i += 1;
             if (arg == "--opt=all") {
-                use_const_propagation = true;
-                use_dead_code_removal = true;
-                use_type_inference = true;
-                use_shape_analysis = true;
+                options.use_inlining = true;
+                options.use_const_propagation = true;
+                options.use_dead_code_removal = true;
+                options.use_type_inference = true;
+                options.use_shape_analysis = true;
+                options.use_escape_analysis = true;
+                options.use_gvn = true;
+                options.use_licm = true;
+                options.use_unboxing = true;
+                options.use_branch_fusion = true;
+                options.use_graph_coloring = true;
+            } else if (arg == "--opt=inline") {
+                options.use_inlining = true;
             } else if (arg == "--opt=constant-prop") {
-                use_const_propagation = true;
+                options.use_const_propagation = true;
             } else if (arg == "--opt=dead-code-rm") {
-                use_dead_code_removal = true;
+                options.use_dead_code_removal = true;
             } else if (arg == "--opt=shape-analysis") {
-                use_shape_analysis = true;
+                options.use_shape_analysis = true;
+            } else if (arg == "--opt=escape-analysis") {
+                options.use_escape_analysis = true;
             } else if (arg == "--opt=type-inference") {
-                use_type_inference = true;
+                options.use_type_inference = true;
+            } else if (arg == "--opt=gvn") {
+                options.use_gvn = true;
+            } else if (arg == "--opt=licm") {
+                options.use_licm = true;
+            } else if (arg == "--opt=unbox") {
+                options.use_unboxing = true;
+            } else if (arg == "--opt=fuse-branches") {
+                options.use_branch_fusion = true;
+            } else if (arg == "--opt=graph-coloring") {
+                options.use_graph_coloring = true;
+            } else if (arg == "--no-tiering") {
+                options.use_tiering = false;
+            } else if (arg == "--no-speculation") {
+                options.use_speculation = false;
+            } else if (arg == "--aot") {
+                // fully optimized code, saved as an image for later runs of the same source and options
+                options.aot = true;
+            } else if (arg == "--cache-ir") {
+                // optimized IR is saved for later runs of the same source and options, so optimize up front
+                cache_ir = true;
+                options.use_tiering = false;
             } else if (arg == "-mem") {
                 assert(i < argc);
                 memory_limit = (std::stol(argv[i]) - 1) * (1 << 20);
                 i += 1;
             } else if (arg == "--emit-code") {
-                emit_ir = true;
+                // print the IR after every pass and all generated code, so compile everything up front
+                options.emit_code = true;
+                options.use_tiering = false;
             } else if (arg == "-s") {
                 assert(i < argc);
                 filename = argv[i];
@@ -62,97 +87,103 @@ struct Arguments {
     }
 };
 
-auto main(int argc, const char* argv[]) -> int {
-    Arguments args(argc, argv);
-    std::ifstream file(args.filename);
-
-    if (!file.is_open()) {
-        std::cout << "Failed to open file" << std::endl;
-        return 1;
-    }
-
-    antlr4::ANTLRInputStream input(file);
-    lexer::MITScript lexer(&input);
-    antlr4::CommonTokenStream tokens(&lexer);
-
-    tokens.fill();
-
-    AST::Program* program = Program(tokens);
-    if (program == nullptr) {
-        std::cout << "Parsing failed" << std::endl;
-        return 1;
-    }
-    
-    Compiler compiler(args.memory_limit);
-    program->accept(compiler);
-   	IR::Program* prog = compiler.get_program();
-
-    if (args.emit_ir) {
-        std::cout << *prog << std::endl;
-    }
-
-    if (args.use_const_propagation) {
-        ConstPropagator c_prop(prog);
-        prog = c_prop.optimize();
+// images and optimized IR are cached in $XDG_CACHE_HOME/mitscriptc, named by their key
+auto cache_path(uint64_t key, const char* extension) -> std::filesystem::path {
+    std::filesystem::path dir;
+    if (const char* cache_home = std::getenv("XDG_CACHE_HOME"); cache_home != nullptr && *cache_home != 0) {
+        dir = cache_home;
+    } else if (const char* home = std::getenv("HOME"); home != nullptr && *home != 0) {
+        dir = std::filesystem::path(home) / ".cache";
+    } else {
+        dir = std::filesystem::temp_directory_path();
     }
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016lx.%s", key, extension);
+    return dir / "mitscriptc" / name;
+}
 
-    if (args.emit_ir) {
-        std::cout << *prog << std::endl;
+// the cache is only an optimization, a file that cannot be written is simply compiled again next time.
+// Written to a temporary file first, so that concurrent runs never see a partial file
+void write_cache_file(const std::filesystem::path& path, const std::string& data) {
+    std::error_code err;
+    std::filesystem::create_directories(path.parent_path(), err);
+    std::filesystem::path tmp_path = path;
+    tmp_path += "." + std::to_string(getpid());
+    {
+        std::ofstream file(tmp_path, std::ios::binary);
+        file.write(data.data(), (std::streamsize) data.size());
+        if (!file) {
+            file.close();
+            std::filesystem::remove(tmp_path, err);
+            return;
+        }
     }
+    std::filesystem::rename(tmp_path, path, err);
+}
 
-    if (args.use_dead_code_removal) {
-        DeadCodeRemover dc_opt(prog);
-        prog = dc_opt.optimize();
+auto run(codegen::Executable& executable) -> int {
+    try {
+        executable.run();
+    } catch (codegen::ExecutionError& err) {
+        std::cout << err.what() << std::endl;
+        return 1;
     }
+    return 0;
+}
 
-    if (args.emit_ir) {
-        std::cout << *prog << std::endl;
+// compiles and runs the program, leaving its image and optimized IR in the cache as requested
+auto compile_and_run(IR::Program program, const codegen::CompileOptions& options, bool save_ir, uint64_t key)
+    -> int {
+    codegen::Executable compiled(std::move(program), options);
+    if (options.aot) {
+        write_cache_file(cache_path(key, "image"), compiled.save_image(key));
     }
-
-    if (args.use_type_inference) {
-        TypeInferer ti_opt(prog);
-        prog = ti_opt.optimize();
+    if (save_ir) {
+        write_cache_file(cache_path(key, "ir"), IR::write_program(compiled.get_program(), key));
     }
+    return run(compiled);
+}
 
-    if (args.emit_ir) {
-        std::cout << *prog << std::endl;
-    }
+auto main(int argc, const char* argv[]) -> int {
+    Arguments args(argc, argv);
+    lexer::SourceFile source(args.filename);
 
-    if (args.use_shape_analysis) {
-        ShapeAnalysis sa_opt(prog);
-        prog = sa_opt.optimize();
+    if (!source.is_open()) {
+        std::cout << "Failed to open file" << std::endl;
+        return 1;
     }
 
-    if (args.emit_ir) {
-        std::cout << *prog << std::endl;
+    uint64_t key = 0;
+    if (args.options.aot || args.cache_ir) {
+        key = codegen::cache_key(source.text(), args.options, args.memory_limit);
     }
-
-     // std::cout << *prog << std::endl;
-
-//    pretty_print_function(std::cout, prog->functions[3]) << std::endl;
-    for (auto& func : prog->functions) {
-        IR::allocate_registers(func);
+    if (args.options.aot) {
+        lexer::SourceFile image_file(cache_path(key, "image"));
+        if (image_file.is_open()) {
+            auto script = mitscript::Script::load(std::string(image_file.text()), key, args.memory_limit);
+            if (script != nullptr) {
+                return run(*script->instantiate());
+            }
+        }
     }
-
-    if (args.emit_ir) {
-        std::cout << *prog << std::endl;
+    if (args.cache_ir) {
+        lexer::SourceFile ir_file(cache_path(key, "ir"));
+        if (ir_file.is_open()) {
+            IR::Program cached(args.memory_limit);
+            if (IR::read_program(ir_file.text(), key, cached)) {
+                codegen::CompileOptions options = args.options;
+                options.optimized_ir = true;
+                return compile_and_run(std::move(cached), options, false, key);
+            }
+        }
     }
-//    pretty_print_function(std::cout, prog->functions.back()) << std::endl;
-//    IR::allocate_registers(prog->functions.back());
-
-    // std::cout << *prog << std::endl;
-
 
-    codegen::Executable compiled(std::move(*prog), args.emit_ir);
-    try {
-        compiled.run();
-    } catch (codegen::ExecutionError& err) {
-        std::cout << err.what() << std::endl;
+    std::optional<IR::Program> program = mitscript::translate(source.text(), args.memory_limit);
+    if (!program) {
+        std::cout << "Parsing failed" << std::endl;
         return 1;
     }
 
-    // std::cout << *prog << std::endl;
-
-    delete program;
-    return 0;
+    // optimization passes and register allocation run as part of tiered compilation
+    return compile_and_run(std::move(*program), args.options, args.cache_ir, key);
 }
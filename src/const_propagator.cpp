@@ -11,6 +11,11 @@ bool ConstPropagator::propagate_instruction(IR::Instruction &ins, std::unordered
     bool can_eliminate = true;
     IR::Instruction new_ins = ins;
     for (auto& arg : new_ins.args) {
+        // the site number of ADD and EQ doesn't stop folding
+        if (arg.type == IR::Operand::LOGICAL && &arg == &new_ins.args[2] &&
+            (ins.op == IR::Operation::ADD || ins.op == IR::Operation::EQ)) {
+            continue;
+        }
         if (arg.type == IR::Operand::VIRT_REG && const_var.count(arg.index))  {
             size_t val_idx = find(prog_->immediates.begin(), prog_->immediates.end(), const_var[arg.index]) - prog_->immediates.begin();
             arg = {IR::Operand::IMMEDIATE, int32_t(val_idx)};
@@ -79,7 +84,7 @@ bool ConstPropagator::propagate_instruction(IR::Instruction &ins, std::unordered
 
 bool ConstPropagator::eliminate_assert(IR::Instruction ins, std::unordered_map<size_t, runtime::Value> &const_var) {
 
-    if (ins.op != IR::Operation::ASSERT_BOOL && ins.op != IR::Operation::ASSERT_INT && ins.op != IR::Operation::ASSERT_STRING && ins.op != IR::Operation::ASSERT_CLOSURE && ins.op != IR::Operation::ASSERT_NONZERO && ins.op != IR::Operation::ASSERT_RECORD)
+    if (ins.op != IR::Operation::ASSERT_BOOL && ins.op != IR::Operation::ASSERT_INT && ins.op != IR::Operation::GUARD_INT && ins.op != IR::Operation::ASSERT_STRING && ins.op != IR::Operation::ASSERT_CLOSURE && ins.op != IR::Operation::ASSERT_NONZERO && ins.op != IR::Operation::ASSERT_RECORD)
         return false;
 
     runtime::Value imm;
@@ -97,6 +102,7 @@ bool ConstPropagator::eliminate_assert(IR::Instruction ins, std::unordered_map<s
                 return true;
             break;
         case IR::Operation::ASSERT_INT:
+        case IR::Operation::GUARD_INT:
             if (runtime::value_get_type(imm) == runtime::ValueType::Int)
                return true;
             break;
@@ -129,7 +135,10 @@ IR::Program* ConstPropagator::optimize() {
 }
 
 void ConstPropagator::propagate_const() {
-    for (auto& fun : prog_->functions) {
+    for (size_t fun_idx = 0; fun_idx < prog_->functions.size(); fun_idx++) {
+        if (!prog_->optimizes(fun_idx))
+            continue;
+        IR::Function& fun = prog_->functions[fun_idx];
         std::unordered_map<size_t, runtime::Value> const_var;
         for (size_t idx = 0; idx < fun.blocks.size(); idx++) {
             IR::BasicBlock new_block;
@@ -177,5 +186,18 @@ void ConstPropagator::propagate_const() {
 
             fun.blocks[idx] = new_block;
         }
+
+        auto propagate_operand = [&](IR::Operand& op) {
+            if (op.type == IR::Operand::VIRT_REG && const_var.count(op.index)) {
+                size_t val_idx = find(prog_->immediates.begin(), prog_->immediates.end(), const_var[op.index]) - prog_->immediates.begin();
+                op = {IR::Operand::IMMEDIATE, int32_t(val_idx)};
+            }
+        };
+        for (auto& state : fun.deopt_states) {
+            for (auto& value : state.values)
+                propagate_operand(value.second);
+            for (auto& op : state.operands)
+                propagate_operand(op);
+        }
     }
 }
\ No newline at end of file
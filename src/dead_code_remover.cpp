@@ -9,7 +9,10 @@
 const std::set<IR::Operation> dc_ins = {
     IR::Operation::ADD, IR::Operation::ADD_INT, IR::Operation::SUB, IR::Operation::MUL,
     IR::Operation::DIV, IR::Operation::EQ,      IR::Operation::GT,  IR::Operation::GEQ,
-    IR::Operation::AND, IR::Operation::OR,      IR::Operation::NOT, IR::Operation::MOV};
+    IR::Operation::AND, IR::Operation::OR,      IR::Operation::NOT, IR::Operation::MOV,
+    IR::Operation::ADD_UNBOXED, IR::Operation::SUB_UNBOXED, IR::Operation::MUL_UNBOXED,
+    IR::Operation::DIV_UNBOXED, IR::Operation::GT_UNBOXED,  IR::Operation::GEQ_UNBOXED,
+    IR::Operation::BOX_INT,     IR::Operation::UNBOX_INT};
 
 DeadCodeRemover::DeadCodeRemover(IR::Program* prog) : prog_(prog){};
 
@@ -23,8 +26,20 @@ bool DeadCodeRemover::is_dc_op(const IR::Operation op) {
 }
 
 void DeadCodeRemover::rm_dead_code() {
-    for (auto& fun : prog_->functions) {
+    for (size_t fun_idx = 0; fun_idx < prog_->functions.size(); fun_idx++) {
+        if (!prog_->optimizes(fun_idx))
+            continue;
+        IR::Function& fun = prog_->functions[fun_idx];
         std::unordered_set<size_t> used_var;
+        // values restored when leaving optimized code at a failing guard
+        for (const auto& state : fun.deopt_states) {
+            for (const auto& value : state.values)
+                if (value.second.type == IR::Operand::VIRT_REG)
+                    used_var.insert(value.second.index);
+            for (const auto& op : state.operands)
+                if (op.type == IR::Operand::VIRT_REG)
+                    used_var.insert(op.index);
+        }
         for (int idx = fun.blocks.size() - 1; idx >= 0; idx--) {
             IR::BasicBlock new_block;
 
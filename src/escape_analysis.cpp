@@ -0,0 +1,462 @@
+#include "value.h"
+#include "ir.h"
+#include "escape_analysis.h"
+#include <algorithm>
+#include <cassert>
+#include <unordered_set>
+#include <utility>
+
+EscapeAnalysis::EscapeAnalysis(IR::Program* prog) : prog_(prog){}
+
+static bool is_load(IR::Operation op) {
+    return op == IR::Operation::REC_LOAD_NAME || op == IR::Operation::REC_LOAD_STATIC;
+}
+
+static bool is_store(IR::Operation op) {
+    return op == IR::Operation::REC_STORE_NAME || op == IR::Operation::REC_STORE_STATIC;
+}
+
+// static field of a load or store, -1 if the field is not part of the layout
+int EscapeAnalysis::field_index(const IR::Instruction& ins, int layout) {
+    if (ins.op == IR::Operation::REC_LOAD_STATIC || ins.op == IR::Operation::REC_STORE_STATIC)
+        return ins.args[1].index;
+    if (ins.args[1].type != IR::Operand::IMMEDIATE)
+        return -1;
+    const auto& fields = prog_->struct_layouts[layout];
+    auto iter = std::find(fields.begin(), fields.end(), prog_->immediates[ins.args[1].index]);
+    return iter == fields.end() ? -1 : (int) (iter - fields.begin());
+}
+
+// whether argument k of the instruction may refer to a record that is not in memory: asserting its type,
+// moving it to another register or accessing a field of its layout
+bool EscapeAnalysis::keeps_virtual(const IR::Instruction& ins, size_t k, int layout) {
+    if (k != 0)
+        return false;
+    if (ins.op == IR::Operation::ASSERT_RECORD || ins.op == IR::Operation::MOV)
+        return true;
+    return (is_load(ins.op) || is_store(ins.op)) && field_index(ins, layout) != -1;
+}
+
+// the record allocated by ALLOC_REC each register refers to, directly or through MOVs, or -1. Records merged in
+// a phi or needed by baseline code after a deopt are dropped, every other use is handled by replace_record
+std::vector<int> EscapeAnalysis::find_aliases(IR::Function& fun, std::vector<int>& layouts) {
+    std::vector<int> alias(fun.virt_reg_count, -1);
+    for (const auto& block : fun.blocks) {
+        for (const auto& ins : block.instructions) {
+            if (ins.op == IR::Operation::ALLOC_REC && ins.out.type == IR::Operand::VIRT_REG) {
+                alias[ins.out.index] = ins.out.index;
+                layouts[ins.out.index] = ins.args[1].index;
+            }
+        }
+    }
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (const auto& block : fun.blocks) {
+            for (const auto& ins : block.instructions) {
+                if (ins.op == IR::Operation::MOV && ins.args[0].type == IR::Operand::VIRT_REG &&
+                    alias[ins.args[0].index] != -1 && alias[ins.out.index] == -1) {
+                    alias[ins.out.index] = alias[ins.args[0].index];
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    std::vector<bool> escaped(fun.virt_reg_count, false);
+    auto escape = [&](const IR::Operand& op) {
+        if (op.type == IR::Operand::VIRT_REG && alias[op.index] != -1)
+            escaped[alias[op.index]] = true;
+    };
+    for (const auto& block : fun.blocks)
+        for (const auto& pn : block.phi_nodes)
+            for (const auto& arg : pn.args)
+                escape(arg.second);
+    for (const auto& state : fun.deopt_states) {
+        for (const auto& value : state.values)
+            escape(value.second);
+        for (const auto& operand : state.operands)
+            escape(operand);
+    }
+    for (auto& root : alias)
+        if (root != -1 && escaped[root])
+            root = -1;
+    return alias;
+}
+
+static std::vector<std::vector<int>> dominance_frontiers(const IR::Function& fun, const std::vector<int>& idom) {
+    size_t n = fun.blocks.size();
+    std::vector<std::vector<int>> preds(n);
+    for (size_t j = 0; j < n; j++)
+        for (int succ : fun.blocks[j].successors)
+            preds[succ].push_back((int) j);
+    std::vector<std::vector<int>> frontiers(n);
+    for (size_t j = 0; j < n; j++) {
+        if (preds[j].size() < 2 || idom[j] == -1)
+            continue;
+        for (int pred : preds[j]) {
+            for (int runner = pred; runner != idom[j] && idom[runner] != -1; runner = idom[runner]) {
+                if (std::find(frontiers[runner].begin(), frontiers[runner].end(), (int) j) == frontiers[runner].end())
+                    frontiers[runner].push_back((int) j);
+                if (runner == 0)
+                    break;
+            }
+        }
+    }
+    return frontiers;
+}
+
+// places phi nodes on the iterated dominance frontier of the given blocks, in the blocks accepted by the filter.
+// Returns the index of the phi node in each block, or -1
+template <typename Filter>
+static std::vector<int> place_phis(IR::Function& fun, std::vector<int> work,
+                                   const std::vector<std::vector<int>>& frontiers, Filter filter,
+                                   std::vector<int>& new_phis) {
+    size_t n = fun.blocks.size();
+    std::vector<int> phi_index(n, -1);
+    std::vector<bool> placed(n, false);
+    std::vector<bool> queued(n, false);
+    for (int block : work)
+        queued[block] = true;
+    while (!work.empty()) {
+        int block = work.back();
+        work.pop_back();
+        for (int front : frontiers[block]) {
+            if (placed[front])
+                continue;
+            placed[front] = true;
+            if (filter(front)) {
+                phi_index[front] = (int) fun.blocks[front].phi_nodes.size();
+                fun.blocks[front].phi_nodes.push_back({{IR::Operand::VIRT_REG, fun.virt_reg_count}, {}});
+                new_phis.push_back(fun.virt_reg_count++);
+            }
+            if (!queued[front]) {
+                queued[front] = true;
+                work.push_back(front);
+            }
+        }
+    }
+    return phi_index;
+}
+
+// where the record is needed and where it may be in memory. A use that needs it in memory allocates it, storing
+// the current field values, and later accesses on that path go to memory. Unless allocate_at_merges is false, a
+// block passing the record to a block where some other path already allocated it, and which still uses it,
+// allocates it at its end, so that a phi node can merge the allocations
+void EscapeAnalysis::memory_flow(IR::Function& fun, int rec, int layout, const std::vector<int>& alias,
+                                 bool allocate_at_merges, std::vector<bool>& live_in, std::vector<bool>& in_memory,
+                                 std::vector<bool>& out_memory) {
+    size_t n = fun.blocks.size();
+    int alloc_block = -1;
+    std::vector<bool> has_use(n, false);
+    std::vector<bool> has_escape(n, false);
+    for (size_t j = 0; j < n; j++) {
+        for (const auto& ins : fun.blocks[j].instructions) {
+            if (ins.op == IR::Operation::ALLOC_REC && ins.out.index == rec) {
+                alloc_block = (int) j;
+                continue;
+            }
+            for (size_t k = 0; k < ins.args.size(); k++) {
+                if (ins.args[k].type != IR::Operand::VIRT_REG || alias[ins.args[k].index] != rec)
+                    continue;
+                if (!keeps_virtual(ins, k, layout))
+                    has_escape[j] = true;
+                if (is_load(ins.op) || is_store(ins.op) || !keeps_virtual(ins, k, layout))
+                    has_use[j] = true;
+            }
+        }
+    }
+
+    // live_in: whether a path from the start of the block uses the record before it is allocated again
+    live_in.assign(n, false);
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t j = n; j-- > 0;) {
+            bool live = has_use[j];
+            for (int succ : fun.blocks[j].successors)
+                live = live || live_in[succ];
+            if ((int) j != alloc_block && live && !live_in[j]) {
+                live_in[j] = true;
+                changed = true;
+            }
+        }
+    }
+    in_memory.assign(n, false);
+    out_memory.assign(n, false);
+    changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t j = 0; j < n; j++) {
+            bool out = ((int) j != alloc_block && in_memory[j]) || has_escape[j];
+            if (allocate_at_merges)
+                for (int succ : fun.blocks[j].successors)
+                    out = out || (in_memory[succ] && live_in[succ]);
+            if (out && !out_memory[j]) {
+                out_memory[j] = true;
+                changed = true;
+            }
+            if (!out_memory[j])
+                continue;
+            for (int succ : fun.blocks[j].successors) {
+                if (!in_memory[succ]) {
+                    in_memory[succ] = true;
+                    changed = true;
+                }
+            }
+        }
+    }
+}
+
+// a block branching to a merge where the record is in memory would otherwise allocate it on all its outgoing
+// paths, so such edges get a block of their own to allocate in. Returns whether any edge was split
+bool EscapeAnalysis::split_merge_edges(IR::Function& fun, int rec, int layout, const std::vector<int>& alias) {
+    std::vector<bool> live_in, in_memory, out_memory;
+    bool split = false;
+    while (true) {
+        memory_flow(fun, rec, layout, alias, false, live_in, in_memory, out_memory);
+        std::pair<int, int> edge{-1, -1};
+        for (size_t j = 0; j < fun.blocks.size() && edge.first == -1; j++) {
+            if (out_memory[j] || fun.blocks[j].successors.size() < 2)
+                continue;
+            // edges back to a loop header are left alone, the header is then in memory on every iteration anyway
+            for (int succ : fun.blocks[j].successors)
+                if (succ > (int) j && in_memory[succ] && live_in[succ])
+                    edge = {(int) j, succ};
+        }
+        if (edge.first == -1)
+            return split;
+        fun.split_forward_edge(edge.first, edge.second);
+        split = true;
+    }
+}
+
+// turns each field of the record into SSA values, with phi nodes on the iterated dominance frontier of the
+// blocks storing to it. The record only exists in blocks dominated by its allocation, so phi nodes are not
+// needed anywhere else. Where it has to be in memory, see memory_flow, it is allocated only then
+void EscapeAnalysis::replace_record(IR::Function& fun, int rec, int layout, const std::vector<int>& alias,
+                                    const std::vector<int>& idom, const std::vector<std::vector<int>>& frontiers,
+                                    std::vector<IR::Operand>& replace, std::vector<int>& new_phis) {
+    size_t n = fun.blocks.size();
+    size_t field_count = prog_->struct_layouts[layout].size();
+    auto aliases_rec = [&](const IR::Operand& op) {
+        return op.type == IR::Operand::VIRT_REG && alias[op.index] == rec;
+    };
+    auto escapes = [&](const IR::Instruction& ins) {
+        for (size_t k = 0; k < ins.args.size(); k++)
+            if (aliases_rec(ins.args[k]) && !keeps_virtual(ins, k, layout))
+                return true;
+        return false;
+    };
+
+    int alloc_block = -1;
+    IR::Instruction alloc;
+    std::vector<std::vector<int>> store_blocks(field_count);
+    for (size_t j = 0; j < n; j++) {
+        for (const auto& ins : fun.blocks[j].instructions) {
+            if (ins.op == IR::Operation::ALLOC_REC && ins.out.index == rec) {
+                alloc_block = (int) j;
+                alloc = ins;
+            } else if (is_store(ins.op) && aliases_rec(ins.args[0]) && !escapes(ins)) {
+                store_blocks[field_index(ins, layout)].push_back((int) j);
+            }
+        }
+    }
+    auto dominates = [&](int a, int b) {
+        while (b != a && b != 0 && idom[b] != -1)
+            b = idom[b];
+        return b == a;
+    };
+    std::vector<bool> live_in, in_memory, out_memory;
+    memory_flow(fun, rec, layout, alias, true, live_in, in_memory, out_memory);
+
+    // index of the phi node for each field in each block, or -1
+    auto in_scope = [&](int block) { return block != alloc_block && dominates(alloc_block, block); };
+    std::vector<std::vector<int>> phi_index(field_count);
+    for (size_t k = 0; k < field_count; k++) {
+        std::vector<int> work = store_blocks[k];
+        work.push_back(alloc_block);
+        phi_index[k] = place_phis(fun, work, frontiers, in_scope, new_phis);
+    }
+    // phi nodes merging the allocations, in the blocks where the record is in memory and still used
+    std::vector<int> allocating;
+    for (size_t j = 0; j < n; j++)
+        if (out_memory[j] && ((int) j == alloc_block || !in_memory[j]))
+            allocating.push_back((int) j);
+    std::vector<int> memory_phi = place_phis(
+        fun, allocating, frontiers, [&](int block) { return in_scope(block) && in_memory[block] && live_in[block]; },
+        new_phis);
+
+    std::vector<std::vector<int>> dom_children(n);
+    for (size_t j = 0; j < n; j++)
+        if ((int) j != alloc_block && idom[j] != -1 && j > 0 && dominates(alloc_block, (int) j))
+            dom_children[idom[j]].push_back((int) j);
+
+    // allocates the record with the given field values, fields that were never stored already hold None
+    auto materialize = [&](std::vector<IR::Instruction>& new_ins, const std::vector<IR::Operand>& fields) {
+        IR::Operand mem{IR::Operand::VIRT_REG, fun.virt_reg_count++};
+        new_ins.push_back({IR::Operation::ALLOC_REC, mem, alloc.args});
+        for (size_t k = 0; k < field_count; k++)
+            if (fields[k] != IR::Operand{IR::Operand::IMMEDIATE, 0})
+                new_ins.push_back({IR::Operation::REC_STORE_STATIC, {}, {mem, {IR::Operand::LOGICAL, (int) k}, fields[k]}});
+        return mem;
+    };
+
+    // the field values while the record is not in memory, then the register holding it once it is
+    struct State {
+        int block;
+        std::vector<IR::Operand> fields;
+        IR::Operand mem;
+    };
+    std::vector<State> stack{{alloc_block, std::vector<IR::Operand>(field_count, {IR::Operand::IMMEDIATE, 0}), {}}};
+    while (!stack.empty()) {
+        auto [block_idx, current, mem] = stack.back();
+        stack.pop_back();
+        IR::BasicBlock& block = fun.blocks[block_idx];
+        for (size_t k = 0; k < field_count; k++)
+            if (phi_index[k][block_idx] != -1)
+                current[k] = block.phi_nodes[phi_index[k][block_idx]].out;
+        if (memory_phi[block_idx] != -1)
+            mem = block.phi_nodes[memory_phi[block_idx]].out;
+
+        std::vector<IR::Instruction> new_ins;
+        for (auto ins : block.instructions) {
+            if (ins.op == IR::Operation::ALLOC_REC && ins.out.index == rec)
+                continue;
+            if ((ins.op == IR::Operation::ASSERT_RECORD || ins.op == IR::Operation::MOV) && aliases_rec(ins.args[0]))
+                continue;
+            if (escapes(ins) || (mem.type != IR::Operand::NONE && aliases_rec(ins.args[0]))) {
+                if (mem.type == IR::Operand::NONE)
+                    mem = materialize(new_ins, current);
+                for (auto& arg : ins.args)
+                    if (aliases_rec(arg))
+                        arg = mem;
+                new_ins.push_back(ins);
+                continue;
+            }
+            if (is_load(ins.op) && aliases_rec(ins.args[0])) {
+                replace[ins.out.index] = current[field_index(ins, layout)];
+                continue;
+            }
+            if (is_store(ins.op) && aliases_rec(ins.args[0])) {
+                current[field_index(ins, layout)] = ins.args[2];
+                continue;
+            }
+            new_ins.push_back(ins);
+        }
+        bool needed = false;
+        for (int succ : block.successors)
+            needed = needed || (in_memory[succ] && live_in[succ]);
+        if (needed && mem.type == IR::Operand::NONE) {
+            // before the branch to the successors
+            std::vector<IR::Instruction> branch;
+            if (!new_ins.empty() && (new_ins.back().op == IR::Operation::BRANCH ||
+                                     new_ins.back().op == IR::Operation::CMP_BRANCH)) {
+                branch.push_back(new_ins.back());
+                new_ins.pop_back();
+            }
+            mem = materialize(new_ins, current);
+            new_ins.insert(new_ins.end(), branch.begin(), branch.end());
+        }
+        block.instructions = new_ins;
+
+        for (int succ : block.successors) {
+            for (size_t k = 0; k < field_count; k++)
+                if (phi_index[k][succ] != -1)
+                    fun.blocks[succ].phi_nodes[phi_index[k][succ]].args.push_back({block_idx, current[k]});
+            if (memory_phi[succ] != -1) {
+                assert(mem.type != IR::Operand::NONE);
+                fun.blocks[succ].phi_nodes[memory_phi[succ]].args.push_back({block_idx, mem});
+            }
+        }
+        for (int child : dom_children[block_idx])
+            stack.push_back({child, current, mem});
+    }
+}
+
+void EscapeAnalysis::optimize_function(IR::Function& fun) {
+    std::vector<int> layouts(fun.virt_reg_count, -1);
+    std::vector<int> alias = find_aliases(fun, layouts);
+    std::vector<int> records;
+    for (size_t v = 0; v < alias.size(); v++)
+        if (alias[v] == (int) v)
+            records.push_back((int) v);
+    if (records.empty())
+        return;
+
+    std::vector<IR::Operand> replace(fun.virt_reg_count);
+    std::vector<int> new_phis;
+    std::vector<int> idom = fun.compute_dominators();
+    std::vector<std::vector<int>> frontiers = dominance_frontiers(fun, idom);
+    for (int rec : records) {
+        // registers added for the records before are not aliases
+        alias.resize(fun.virt_reg_count, -1);
+        if (split_merge_edges(fun, rec, layouts[rec], alias)) {
+            idom = fun.compute_dominators();
+            frontiers = dominance_frontiers(fun, idom);
+        }
+        replace_record(fun, rec, layouts[rec], alias, idom, frontiers, replace, new_phis);
+    }
+
+    for (auto& block : fun.blocks) {
+        for (auto& pn : block.phi_nodes)
+            for (auto& arg : pn.args)
+                arg.second = IR::resolve(replace, arg.second);
+        for (auto& ins : block.instructions)
+            for (auto& arg : ins.args)
+                arg = IR::resolve(replace, arg);
+    }
+    for (auto& state : fun.deopt_states) {
+        for (auto& value : state.values)
+            value.second = IR::resolve(replace, value.second);
+        for (auto& operand : state.operands)
+            operand = IR::resolve(replace, operand);
+    }
+
+    // most fields are not read after every merge, drop the phi nodes nothing uses
+    std::unordered_set<int> added(new_phis.begin(), new_phis.end());
+    std::unordered_set<int> live;
+    std::vector<int> work;
+    auto use = [&](const IR::Operand& op) {
+        if (op.type == IR::Operand::VIRT_REG && added.contains(op.index) && !live.contains(op.index)) {
+            live.insert(op.index);
+            work.push_back(op.index);
+        }
+    };
+    std::vector<const IR::PhiNode*> phi_of(fun.virt_reg_count, nullptr);
+    for (const auto& block : fun.blocks) {
+        for (const auto& pn : block.phi_nodes) {
+            phi_of[pn.out.index] = &pn;
+            if (!added.contains(pn.out.index))
+                for (const auto& arg : pn.args)
+                    use(arg.second);
+        }
+        for (const auto& ins : block.instructions)
+            for (const auto& arg : ins.args)
+                use(arg);
+    }
+    for (const auto& state : fun.deopt_states) {
+        for (const auto& value : state.values)
+            use(value.second);
+        for (const auto& operand : state.operands)
+            use(operand);
+    }
+    while (!work.empty()) {
+        const IR::PhiNode* pn = phi_of[work.back()];
+        work.pop_back();
+        for (const auto& arg : pn->args)
+            use(arg.second);
+    }
+    for (auto& block : fun.blocks) {
+        std::erase_if(block.phi_nodes, [&](const IR::PhiNode& pn) {
+            return added.contains(pn.out.index) && !live.contains(pn.out.index);
+        });
+    }
+}
+
+IR::Program* EscapeAnalysis::optimize() {
+    for (size_t i = 0; i < prog_->functions.size(); i++)
+        if (prog_->optimizes(i))
+            optimize_function(prog_->functions[i]);
+    return prog_;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "value.h"
+#include "ir.h"
+#include <vector>
+
+class EscapeAnalysis {
+private:
+    IR::Program* prog_;
+public:
+    EscapeAnalysis(IR::Program* prog);
+    // keeps the fields of records in virtual registers, allocating them only on the paths where they escape
+    IR::Program* optimize();
+
+    int field_index(const IR::Instruction& ins, int layout);
+    bool keeps_virtual(const IR::Instruction& ins, size_t k, int layout);
+    std::vector<int> find_aliases(IR::Function& fun, std::vector<int>& layouts);
+    void memory_flow(IR::Function& fun, int rec, int layout, const std::vector<int>& alias, bool allocate_at_merges,
+                     std::vector<bool>& live_in, std::vector<bool>& in_memory, std::vector<bool>& out_memory);
+    bool split_merge_edges(IR::Function& fun, int rec, int layout, const std::vector<int>& alias);
+    void replace_record(IR::Function& fun, int rec, int layout, const std::vector<int>& alias,
+                        const std::vector<int>& idom, const std::vector<std::vector<int>>& frontiers,
+                        std::vector<IR::Operand>& replace, std::vector<int>& new_phis);
+    void optimize_function(IR::Function& fun);
+};
@@ -0,0 +1,296 @@
+#include "value.h"
+#include "ir.h"
+#include "inliner.h"
+#include <set>
+
+Inliner::Inliner(IR::Program* prog) : prog_(prog){}
+
+static bool has_return(const IR::BasicBlock& block) {
+    for (const auto& ins : block.instructions)
+        if (ins.op == IR::Operation::RETURN)
+            return true;
+    return false;
+}
+
+std::map<int, int> Inliner::get_known_globals() { // globals only ever assigned closures of a single function
+    std::map<int, int> known_glob;
+    std::set<int> unknown_glob(prog_->ref_globals.begin(), prog_->ref_globals.end());
+    for (const auto& fun : prog_->functions) {
+        std::map<int, int> closures;
+        for (const auto& block : fun.blocks) {
+            for (const auto& ins : block.instructions) {
+                if (ins.op == IR::Operation::ALLOC_CLOSURE)
+                    closures[ins.out.index] = ins.args[0].index;
+                if (ins.op != IR::Operation::STORE_GLOBAL)
+                    continue;
+                int glob = ins.args[0].index;
+                if (ins.args[1].type != IR::Operand::VIRT_REG || !closures.count(ins.args[1].index) ||
+                    (known_glob.count(glob) && known_glob[glob] != closures[ins.args[1].index]))
+                    unknown_glob.insert(glob);
+                else
+                    known_glob[glob] = closures[ins.args[1].index];
+            }
+        }
+    }
+    for (int glob : unknown_glob)
+        known_glob.erase(glob);
+    return known_glob;
+}
+
+std::vector<int> Inliner::get_known_callees(const IR::Function& fun, const std::map<int, int>& known_glob) {
+    std::vector<int> known_fun(fun.virt_reg_count, -1);
+    auto get_fun = [&](const IR::Operand& op) {
+        return op.type == IR::Operand::VIRT_REG ? known_fun[op.index] : -1;
+    };
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (const auto& block : fun.blocks) {
+            for (const auto& pn : block.phi_nodes) {
+                int fn = get_fun(pn.args[0].second);
+                for (const auto& arg : pn.args)
+                    if (get_fun(arg.second) != fn)
+                        fn = -1;
+                if (fn != -1 && known_fun[pn.out.index] != fn) {
+                    known_fun[pn.out.index] = fn;
+                    changed = true;
+                }
+            }
+            for (const auto& ins : block.instructions) {
+                int fn = -1;
+                if (ins.op == IR::Operation::ALLOC_CLOSURE)
+                    fn = ins.args[0].index;
+                else if (ins.op == IR::Operation::LOAD_GLOBAL && known_glob.count(ins.args[0].index))
+                    fn = known_glob.at(ins.args[0].index);
+                else if (ins.op == IR::Operation::MOV)
+                    fn = get_fun(ins.args[0]);
+                if (fn != -1 && known_fun[ins.out.index] != fn) {
+                    known_fun[ins.out.index] = fn;
+                    changed = true;
+                }
+            }
+        }
+    }
+    return known_fun;
+}
+
+bool Inliner::can_inline(size_t fun_idx) {
+    const IR::Function& fun = prog_->functions[fun_idx];
+    size_t ins_count = 0;
+    bool returns = false;
+    for (size_t j = 0; j < fun.blocks.size(); j++) {
+        const IR::BasicBlock& block = fun.blocks[j];
+        if (block.is_loop_header)
+            return false;
+        for (int succ : block.successors)
+            if ((size_t) succ <= j)
+                return false;
+        for (const auto& ins : block.instructions) {
+            ins_count++;
+            if (ins.op == IR::Operation::EXEC_CALL || ins.op == IR::Operation::LOAD_FREE_REF)
+                return false;
+            if (ins.op == IR::Operation::RETURN) {
+                returns = true;
+                break;
+            }
+        }
+        // edges out of a block that returned are dropped, the target must still be reachable
+        if (j > 0) {
+            bool reachable = false;
+            for (int pred : block.predecessors)
+                reachable = reachable || !has_return(fun.blocks[pred]);
+            if (!reachable)
+                return false;
+        }
+    }
+    return returns && ins_count <= INLINE_MAX_INSTRUCTIONS;
+}
+
+// splices the callee between the part of the block before INIT_CALL and the part after EXEC_CALL, returns the
+// index of the block holding the part after the call
+size_t Inliner::inline_call(IR::Function& fun, size_t block_idx, size_t init_idx, size_t call_idx, size_t callee) {
+    const IR::Function body = prog_->functions[callee];
+    const IR::BasicBlock block = fun.blocks[block_idx];
+    const IR::Instruction call = block.instructions[call_idx];
+    std::vector<IR::Operand> args;
+    for (size_t k = init_idx + 1; k < call_idx; k++)
+        args.push_back(block.instructions[k].args[1]);
+
+    std::vector<std::pair<size_t, IR::Operand>> returns;
+    for (size_t j = 0; j < body.blocks.size(); j++)
+        for (const auto& ins : body.blocks[j].instructions)
+            if (ins.op == IR::Operation::RETURN) {
+                returns.push_back({j, ins.args[0]});
+                break;
+            }
+
+    // block_idx keeps the part before the call, followed by the callee blocks, the blocks merging the return
+    // values and the part after the call
+    size_t body_start = block_idx + 1;
+    size_t merge_start = body_start + body.blocks.size();
+    size_t post_idx = merge_start + returns.size() - 1;
+    size_t shift = post_idx - block_idx;
+    auto remap = [&](int idx, size_t self) {
+        if ((size_t) idx < block_idx)
+            return (size_t) idx;
+        if ((size_t) idx == block_idx)
+            return self;
+        return idx + shift;
+    };
+
+    for (auto& other : fun.blocks) {
+        for (auto& succ : other.successors)
+            succ = (int) remap(succ, block_idx);
+        for (auto& pred : other.predecessors)
+            pred = (int) remap(pred, post_idx);
+        for (auto& pn : other.phi_nodes)
+            for (auto& arg : pn.args)
+                arg.first = (int) remap(arg.first, post_idx);
+        other.final_loop_block = (int) remap(other.final_loop_block, post_idx);
+    }
+
+    int reg_base = fun.virt_reg_count;
+    fun.virt_reg_count += body.virt_reg_count;
+    auto rename = [&](IR::Operand op) {
+        if (op.type == IR::Operand::VIRT_REG)
+            op.index += reg_base;
+        return op;
+    };
+
+    std::vector<IR::BasicBlock> new_blocks;
+    IR::BasicBlock pre = fun.blocks[block_idx];
+    pre.instructions.assign(block.instructions.begin(), block.instructions.begin() + init_idx);
+    pre.successors = {(int) body_start};
+    new_blocks.push_back(pre);
+
+    for (size_t j = 0; j < body.blocks.size(); j++) {
+        const IR::BasicBlock& body_block = body.blocks[j];
+        IR::BasicBlock new_block;
+        for (int pred : body_block.predecessors)
+            if (!has_return(body.blocks[pred]))
+                new_block.predecessors.push_back((int) (body_start + pred));
+        if (j == 0)
+            new_block.predecessors = {(int) block_idx};
+        std::vector<IR::Instruction> movs;
+        for (const auto& pn : body_block.phi_nodes) {
+            IR::PhiNode new_pn{rename(pn.out), {}};
+            for (const auto& arg : pn.args)
+                if (!has_return(body.blocks[arg.first]))
+                    new_pn.args.push_back({(int) (body_start + arg.first), rename(arg.second)});
+            // only one edge into the block is left
+            if (new_pn.args.size() == 1)
+                movs.push_back({IR::Operation::MOV, new_pn.out, {new_pn.args[0].second}});
+            else
+                new_block.phi_nodes.push_back(new_pn);
+        }
+        new_block.instructions = movs;
+        for (auto ins : body_block.instructions) {
+            if (ins.op == IR::Operation::RETURN)
+                break;
+            // not a speculation site of the caller
+            if (ins.op == IR::Operation::GUARD_INT)
+                continue;
+            if (ins.op == IR::Operation::ADD || ins.op == IR::Operation::EQ)
+                ins.args[2] = {};
+            ins.out = rename(ins.out);
+            for (auto& arg : ins.args)
+                arg = rename(arg);
+            if (ins.op == IR::Operation::LOAD_ARG)
+                ins = {IR::Operation::MOV, ins.out, {args[ins.args[0].index]}};
+            new_block.instructions.push_back(ins);
+        }
+        if (!has_return(body_block))
+            for (int succ : body_block.successors)
+                new_block.successors.push_back((int) (body_start + succ));
+        new_blocks.push_back(new_block);
+    }
+
+    IR::BasicBlock post;
+    post.successors = block.successors;
+    for (auto& succ : post.successors)
+        succ = (int) remap(succ, block_idx);
+    if (returns.size() == 1) {
+        post.predecessors = {(int) (body_start + returns[0].first)};
+        new_blocks[1 + returns[0].first].successors = {(int) post_idx};
+        post.instructions.push_back({IR::Operation::MOV, call.out, {rename(returns[0].second)}});
+    } else {
+        // phi nodes take two values, so merge the return values pairwise
+        IR::Operand merged = rename(returns[0].second);
+        int merged_from = (int) (body_start + returns[0].first);
+        new_blocks[1 + returns[0].first].successors = {(int) merge_start};
+        for (size_t r = 1; r < returns.size(); r++) {
+            int merge_idx = (int) (merge_start + r - 1);
+            int ret_block = (int) (body_start + returns[r].first);
+            new_blocks[1 + returns[r].first].successors = {merge_idx};
+            IR::BasicBlock merge;
+            merge.predecessors = {merged_from, ret_block};
+            IR::Operand out = r + 1 == returns.size() ? call.out : IR::Operand{IR::Operand::VIRT_REG, fun.virt_reg_count++};
+            merge.phi_nodes.push_back({out, {{merged_from, merged}, {ret_block, rename(returns[r].second)}}});
+            merge.successors = {merge_idx + 1};
+            new_blocks.push_back(merge);
+            merged = out;
+            merged_from = merge_idx;
+        }
+        post.predecessors = {merged_from};
+    }
+    post.instructions.insert(post.instructions.end(), block.instructions.begin() + call_idx + 1, block.instructions.end());
+    new_blocks.push_back(post);
+
+    fun.blocks.erase(fun.blocks.begin() + block_idx);
+    fun.blocks.insert(fun.blocks.begin() + block_idx, new_blocks.begin(), new_blocks.end());
+    return post_idx;
+}
+
+IR::Program* Inliner::optimize() {
+    std::map<int, int> known_glob = get_known_globals();
+    std::vector<bool> inlinable(prog_->functions.size());
+    for (size_t i = 0; i < prog_->functions.size(); i++)
+        inlinable[i] = can_inline(i);
+
+    for (size_t i = 0; i < prog_->functions.size(); i++) {
+        if (!prog_->optimizes(i))
+            continue;
+        IR::Function& fun = prog_->functions[i];
+        std::vector<int> known_fun = get_known_callees(fun, known_glob);
+        size_t ins_count = 0;
+        for (const auto& block : fun.blocks)
+            ins_count += block.instructions.size();
+
+        for (size_t j = 0; j < fun.blocks.size(); j++) {
+            size_t init_idx = 0;
+            for (size_t k = 0; k < fun.blocks[j].instructions.size(); k++) {
+                IR::Instruction& ins = fun.blocks[j].instructions[k];
+                if (ins.op == IR::Operation::INIT_CALL)
+                    init_idx = k;
+                if (ins.op != IR::Operation::EXEC_CALL || ins.args[0].type != IR::Operand::VIRT_REG ||
+                    (size_t) ins.args[0].index >= known_fun.size() || known_fun[ins.args[0].index] == -1)
+                    continue;
+                int callee = known_fun[ins.args[0].index];
+                // a wrong number of arguments fails in the generic call
+                if (prog_->functions[callee].parameter_count != fun.blocks[j].instructions[init_idx].args[0].index)
+                    continue;
+                if (inlinable[callee] && ins_count < INLINE_MAX_CALLER_INSTRUCTIONS) {
+                    for (const auto& block : prog_->functions[callee].blocks)
+                        ins_count += block.instructions.size();
+                    // continue with the part after the call
+                    j = inline_call(fun, j, init_idx, k, callee) - 1;
+                    break;
+                }
+                ins.args[2] = {IR::Operand::LOGICAL, callee};
+            }
+        }
+
+        // the callee is already known to be a closure
+        for (auto& block : fun.blocks) {
+            std::vector<IR::Instruction> new_ins;
+            for (const auto& ins : block.instructions) {
+                if (ins.op == IR::Operation::ASSERT_CLOSURE && ins.args[0].type == IR::Operand::VIRT_REG &&
+                    (size_t) ins.args[0].index < known_fun.size() && known_fun[ins.args[0].index] != -1)
+                    continue;
+                new_ins.push_back(ins);
+            }
+            block.instructions = new_ins;
+        }
+    }
+    return prog_;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "value.h"
+#include "ir.h"
+#include <map>
+
+// callees with at most this many instructions are inlined, if they make no calls and have no loops
+const size_t INLINE_MAX_INSTRUCTIONS = 24;
+// no more inlining into a function once it has grown to this many instructions
+const size_t INLINE_MAX_CALLER_INSTRUCTIONS = 4096;
+
+class Inliner {
+private:
+    IR::Program* prog_;
+public:
+    Inliner(IR::Program* prog);
+    IR::Program* optimize();
+
+    std::map<int, int> get_known_globals();
+    std::vector<int> get_known_callees(const IR::Function& fun, const std::map<int, int>& known_globals);
+    bool can_inline(size_t fun_idx);
+    size_t inline_call(IR::Function& fun, size_t block_idx, size_t init_idx, size_t call_idx, size_t callee);
+};
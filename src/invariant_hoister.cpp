@@ -0,0 +1,250 @@
+#include "value.h"
+#include "ir.h"
+#include "invariant_hoister.h"
+#include <algorithm>
+#include <unordered_set>
+
+InvariantHoister::InvariantHoister(IR::Program* prog) : prog_(prog){}
+
+// neither fails nor has side effects once the operands passed their assertions, so it may move above any
+// other instruction. LOAD_GLOBAL only once the global is set
+static bool can_reorder(IR::Operation op) {
+    switch (op) {
+        case IR::Operation::ADD_INT:
+        case IR::Operation::SUB:
+        case IR::Operation::MUL:
+        case IR::Operation::DIV:
+        case IR::Operation::EQ:
+        case IR::Operation::EQ_INT:
+        case IR::Operation::GT:
+        case IR::Operation::GEQ:
+        case IR::Operation::AND:
+        case IR::Operation::OR:
+        case IR::Operation::NOT:
+        case IR::Operation::LOAD_ARG:
+        case IR::Operation::LOAD_FREE_REF:
+        case IR::Operation::REF_LOAD:
+        case IR::Operation::REC_LOAD_NAME:
+        case IR::Operation::REC_LOAD_INDX:
+        case IR::Operation::REC_LOAD_STATIC:
+        case IR::Operation::LOAD_GLOBAL:
+        case IR::Operation::MOV:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// the assertion every value computed by the operation passes
+static std::optional<IR::Operation> result_fact(IR::Operation op) {
+    switch (op) {
+        case IR::Operation::ADD_INT:
+        case IR::Operation::SUB:
+        case IR::Operation::MUL:
+        case IR::Operation::DIV:
+            return IR::Operation::ASSERT_INT;
+        case IR::Operation::EQ:
+        case IR::Operation::EQ_INT:
+        case IR::Operation::GT:
+        case IR::Operation::GEQ:
+        case IR::Operation::AND:
+        case IR::Operation::OR:
+        case IR::Operation::NOT:
+            return IR::Operation::ASSERT_BOOL;
+        case IR::Operation::ALLOC_REC:
+            return IR::Operation::ASSERT_RECORD;
+        case IR::Operation::ALLOC_CLOSURE:
+            return IR::Operation::ASSERT_CLOSURE;
+        default:
+            return std::nullopt;
+    }
+}
+
+bool InvariantHoister::is_known(const IR::Operand& op, IR::Operation assertion, const Facts& facts) {
+    if (op.type == IR::Operand::VIRT_REG)
+        return facts.contains({assertion, op.index});
+    if (op.type != IR::Operand::IMMEDIATE)
+        return false;
+    runtime::Value value = prog_->immediates[op.index];
+    switch (assertion) {
+        case IR::Operation::ASSERT_INT:
+            return runtime::value_get_type(value) == runtime::ValueType::Int;
+        case IR::Operation::ASSERT_BOOL:
+            return runtime::value_get_type(value) == runtime::ValueType::Bool;
+        case IR::Operation::ASSERT_NONZERO:
+            return runtime::value_get_type(value) == runtime::ValueType::Int && runtime::value_get_int32(value) != 0;
+        default:
+            return false;
+    }
+}
+
+// The loop consists of the blocks from the header to its final block. Everything moved out goes to the end of
+// the single block entering the loop, which then runs it once instead of on every iteration. The block after it
+// is always the header, so an assertion may only move if it is at the start of the header, before anything that
+// can fail or be observed. Other instructions move from anywhere in the loop, but only where their operands are
+// already known to pass the assertions they need, since they would otherwise run on values they never see.
+// Loading a global fails while it is not set, so a load leaves the loop body only if the global is known to be
+// set before the loop.
+void InvariantHoister::hoist_loop(IR::Function& fun, size_t header, const std::vector<int>& idom) {
+    size_t final_block = fun.blocks[header].final_loop_block;
+    auto in_loop = [&](int block) { return (size_t) block >= header && (size_t) block <= final_block; };
+
+    int preheader = -1;
+    for (int pred : fun.blocks[header].predecessors) {
+        if (in_loop(pred))
+            continue;
+        if (preheader != -1)
+            return;
+        preheader = pred;
+    }
+    if (preheader == -1 || fun.blocks[preheader].successors.size() != 1 || idom[preheader] == -1)
+        return;
+
+    std::unordered_set<int> defined;
+    bool has_call = false, ref_store = false, rec_store = false;
+    std::unordered_set<int> stored_globals;
+    for (size_t j = header; j <= final_block; j++) {
+        for (const auto& pn : fun.blocks[j].phi_nodes)
+            defined.insert(pn.out.index);
+        for (const auto& ins : fun.blocks[j].instructions) {
+            if (ins.out.type == IR::Operand::VIRT_REG)
+                defined.insert(ins.out.index);
+            if (ins.op == IR::Operation::EXEC_CALL)
+                has_call = true;
+            else if (ins.op == IR::Operation::REF_STORE)
+                ref_store = true;
+            else if (ins.op == IR::Operation::REC_STORE_NAME || ins.op == IR::Operation::REC_STORE_INDX ||
+                     ins.op == IR::Operation::REC_STORE_STATIC)
+                rec_store = true;
+            else if (ins.op == IR::Operation::STORE_GLOBAL)
+                stored_globals.insert(ins.args[0].index);
+        }
+    }
+
+    // what holds at the end of the preheader, from the assertions of the blocks dominating it and from the
+    // operations defining each register
+    Facts facts;
+    // globals a dominating load or store shows to be set
+    std::unordered_set<int> set_globals;
+    for (int block = preheader;; block = idom[block]) {
+        for (const auto& ins : fun.blocks[block].instructions) {
+            if (IR::is_assert(ins.op) && ins.args[0].type == IR::Operand::VIRT_REG)
+                facts.insert({ins.op, ins.args[0].index});
+            else if (ins.op == IR::Operation::GUARD_INT && ins.args[0].type == IR::Operand::VIRT_REG)
+                facts.insert({IR::Operation::ASSERT_INT, ins.args[0].index});
+            else if (ins.op == IR::Operation::LOAD_GLOBAL || ins.op == IR::Operation::STORE_GLOBAL)
+                set_globals.insert(ins.args[0].index);
+        }
+        if (block == 0)
+            break;
+    }
+    for (const auto& block : fun.blocks) {
+        for (const auto& ins : block.instructions) {
+            auto fact = result_fact(ins.op);
+            if (fact && ins.out.type == IR::Operand::VIRT_REG)
+                facts.insert({*fact, ins.out.index});
+            // the receiver of a static access is always a record with a known layout, see ShapeAnalysis
+            if ((ins.op == IR::Operation::REC_LOAD_STATIC || ins.op == IR::Operation::REC_STORE_STATIC) &&
+                ins.args[0].type == IR::Operand::VIRT_REG)
+                facts.insert({IR::Operation::ASSERT_RECORD, ins.args[0].index});
+        }
+    }
+
+    auto invariant = [&](const IR::Instruction& ins) {
+        return std::all_of(ins.args.begin(), ins.args.end(), [&](const IR::Operand& arg) {
+            return arg.type != IR::Operand::VIRT_REG || !defined.contains(arg.index);
+        });
+    };
+    auto hoistable = [&](const IR::Instruction& ins, bool header_prefix) {
+        if (!invariant(ins))
+            return false;
+        if (IR::is_assert(ins.op))
+            return header_prefix;
+        if (ins.out.type != IR::Operand::VIRT_REG)
+            return false;
+        auto ints = [&]() {
+            return is_known(ins.args[0], IR::Operation::ASSERT_INT, facts) &&
+                   is_known(ins.args[1], IR::Operation::ASSERT_INT, facts);
+        };
+        switch (ins.op) {
+            case IR::Operation::LOAD_FREE_REF:
+                return true;
+            case IR::Operation::ADD_INT:
+            case IR::Operation::SUB:
+            case IR::Operation::MUL:
+            case IR::Operation::EQ_INT:
+            case IR::Operation::GT:
+            case IR::Operation::GEQ:
+                return ints();
+            case IR::Operation::DIV:
+                return ints() && is_known(ins.args[1], IR::Operation::ASSERT_NONZERO, facts);
+            case IR::Operation::AND:
+            case IR::Operation::OR:
+                return is_known(ins.args[0], IR::Operation::ASSERT_BOOL, facts) &&
+                       is_known(ins.args[1], IR::Operation::ASSERT_BOOL, facts);
+            case IR::Operation::NOT:
+                return is_known(ins.args[0], IR::Operation::ASSERT_BOOL, facts);
+            case IR::Operation::LOAD_GLOBAL:
+                // fails if the global is not set yet, which the loop may never get to unless it is at the start
+                if (!header_prefix && !set_globals.contains(ins.args[0].index))
+                    return false;
+                // callees can only store to globals they declare with `global`
+                return !stored_globals.contains(ins.args[0].index) &&
+                       !(has_call && prog_->ref_globals.contains(ins.args[0].index));
+            case IR::Operation::REF_LOAD:
+                return !ref_store && !has_call;
+            case IR::Operation::REC_LOAD_NAME:
+            case IR::Operation::REC_LOAD_INDX:
+            case IR::Operation::REC_LOAD_STATIC:
+                return !rec_store && !has_call && is_known(ins.args[0], IR::Operation::ASSERT_RECORD, facts);
+            default:
+                return false;
+        }
+    };
+
+    std::vector<IR::Instruction> hoisted;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t j = header; j <= final_block; j++) {
+            bool header_prefix = j == header;
+            std::vector<IR::Instruction> remaining;
+            for (const auto& ins : fun.blocks[j].instructions) {
+                if (hoistable(ins, header_prefix)) {
+                    hoisted.push_back(ins);
+                    if (IR::is_assert(ins.op))
+                        facts.insert({ins.op, ins.args[0].index});
+                    else
+                        defined.erase(ins.out.index);
+                    if (ins.op == IR::Operation::LOAD_GLOBAL)
+                        set_globals.insert(ins.args[0].index);
+                    changed = true;
+                    continue;
+                }
+                if (!can_reorder(ins.op) ||
+                    (ins.op == IR::Operation::LOAD_GLOBAL && !set_globals.contains(ins.args[0].index)))
+                    header_prefix = false;
+                remaining.push_back(ins);
+            }
+            fun.blocks[j].instructions = remaining;
+        }
+    }
+    auto& pre_ins = fun.blocks[preheader].instructions;
+    pre_ins.insert(pre_ins.end(), hoisted.begin(), hoisted.end());
+}
+
+void InvariantHoister::hoist_function(IR::Function& fun) {
+    std::vector<int> idom = fun.compute_dominators();
+    // inner loops come after the header of the loop around them, so their invariants are moved to a
+    // block in the outer loop first and may then leave that one as well
+    for (size_t j = fun.blocks.size(); j-- > 0;)
+        if (fun.blocks[j].is_loop_header && idom[j] != -1)
+            hoist_loop(fun, j, idom);
+}
+
+IR::Program* InvariantHoister::optimize() {
+    for (size_t i = 0; i < prog_->functions.size(); i++)
+        if (prog_->optimizes(i))
+            hoist_function(prog_->functions[i]);
+    return prog_;
+}
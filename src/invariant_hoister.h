@@ -0,0 +1,22 @@
+#pragma once
+
+#include "value.h"
+#include "ir.h"
+#include <set>
+#include <utility>
+
+class InvariantHoister {
+private:
+    IR::Program* prog_;
+public:
+    // a value is known to pass an assertion, keyed by the assertion and the register
+    using Facts = std::set<std::pair<IR::Operation, int>>;
+
+    InvariantHoister(IR::Program* prog);
+    // moves loop invariant computations, loads and assertions out of loops into the block before the header
+    IR::Program* optimize();
+
+    bool is_known(const IR::Operand& op, IR::Operation assertion, const Facts& facts);
+    void hoist_loop(IR::Function& fun, size_t header, const std::vector<int>& idom);
+    void hoist_function(IR::Function& fun);
+};
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cassert>
 #include <memory>
 
 #include "ir.h"
@@ -17,6 +19,12 @@ Program::Program(Program&& other) noexcept {
     this->functions = std::move(other.functions);
     this->immediates = std::move(other.immediates);
     this->struct_layouts = std::move(other.struct_layouts);
+    this->ref_globals = std::move(other.ref_globals);
+    this->only_function = other.only_function;
+}
+
+auto Program::optimizes(size_t fun_idx) const -> bool {
+    return this->only_function == -1 || (size_t) this->only_function == fun_idx;
 }
 
 auto Function::split_edge(int32_t from, int32_t to) -> BasicBlock& {
@@ -42,4 +50,123 @@ auto Function::split_edge(int32_t from, int32_t to) -> BasicBlock& {
     return this->blocks.back();
 }
 
+auto Function::split_forward_edge(int from, int to) -> int {
+    assert(from < to);
+    auto remap = [to](int idx) { return idx >= to ? idx + 1 : idx; };
+    for (auto& block : this->blocks) {
+        for (int& succ : block.successors) {
+            succ = remap(succ);
+        }
+        for (int& pred : block.predecessors) {
+            pred = remap(pred);
+        }
+        for (auto& phi_node : block.phi_nodes) {
+            for (auto& [pred, op] : phi_node.args) {
+                pred = remap(pred);
+            }
+        }
+        block.final_loop_block = remap(block.final_loop_block);
+    }
+    this->blocks.insert(this->blocks.begin() + to, {{}, {}, {from}, {to + 1}});
+    for (int& succ : this->blocks[from].successors) {
+        if (succ == to + 1) {
+            succ = to;
+        }
+    }
+    for (int& pred : this->blocks[to + 1].predecessors) {
+        if (pred == from) {
+            pred = to;
+        }
+    }
+    for (auto& phi_node : this->blocks[to + 1].phi_nodes) {
+        for (auto& [pred, op] : phi_node.args) {
+            if (pred == from) {
+                pred = to;
+            }
+        }
+    }
+    return to;
+}
+
+auto Function::compute_dominators() const -> std::vector<int> {
+    size_t n = this->blocks.size();
+    std::vector<int> order;
+    std::vector<bool> visited(n, false);
+    std::vector<std::pair<int, size_t>> stack{{0, 0}};
+    visited[0] = true;
+    while (!stack.empty()) {
+        int block = stack.back().first;
+        size_t next = stack.back().second++;
+        if (next < this->blocks[block].successors.size()) {
+            int succ = this->blocks[block].successors[next];
+            if (!visited[succ]) {
+                visited[succ] = true;
+                stack.push_back({succ, 0});
+            }
+        } else {
+            order.push_back(block);
+            stack.pop_back();
+        }
+    }
+    std::reverse(order.begin(), order.end());
+    std::vector<int> rpo_index(n, -1);
+    for (size_t i = 0; i < order.size(); i++)
+        rpo_index[order[i]] = (int) i;
+
+    // edges out of returning blocks are kept, they only make the dominators more conservative
+    std::vector<std::vector<int>> preds(n);
+    for (size_t j = 0; j < n; j++)
+        for (int succ : this->blocks[j].successors)
+            preds[succ].push_back((int) j);
+
+    std::vector<int> idom(n, -1);
+    idom[0] = 0;
+    auto intersect = [&](int a, int b) {
+        while (a != b) {
+            while (rpo_index[a] > rpo_index[b])
+                a = idom[a];
+            while (rpo_index[b] > rpo_index[a])
+                b = idom[b];
+        }
+        return a;
+    };
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 1; i < order.size(); i++) {
+            int block = order[i];
+            int new_idom = -1;
+            for (int pred : preds[block])
+                if (idom[pred] != -1)
+                    new_idom = new_idom == -1 ? pred : intersect(pred, new_idom);
+            if (idom[block] != new_idom) {
+                idom[block] = new_idom;
+                changed = true;
+            }
+        }
+    }
+    return idom;
+}
+
+auto is_assert(Operation op) -> bool {
+    switch (op) {
+        case Operation::ASSERT_BOOL:
+        case Operation::ASSERT_INT:
+        case Operation::ASSERT_STRING:
+        case Operation::ASSERT_RECORD:
+        case Operation::ASSERT_CLOSURE:
+        case Operation::ASSERT_NONZERO:
+            return true;
+        default:
+            return false;
+    }
+}
+
+auto resolve(const std::vector<Operand>& replace, Operand op) -> Operand {
+    while (op.type == Operand::VIRT_REG && (size_t) op.index < replace.size() &&
+           replace[op.index].type != Operand::NONE)
+        op = replace[op.index];
+    return op;
+}
+
 };
\ No newline at end of file
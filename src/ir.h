@@ -41,12 +41,23 @@ enum class Operation {
     MUL,
     DIV,
     EQ,
+    EQ_INT,
     GT,
     GEQ,
     AND,
     OR,
     NOT,
 
+    // versions of ADD_INT, SUB, MUL, DIV, GT and GEQ on untagged ints, see runtime::to_unboxed
+    ADD_UNBOXED,
+    SUB_UNBOXED,
+    MUL_UNBOXED,
+    DIV_UNBOXED,    // also checks for a zero divisor
+    GT_UNBOXED,
+    GEQ_UNBOXED,
+    BOX_INT,        // BOX_INT (VIRT_REG id) <- (VIRT_REG id), tags an untagged int
+    UNBOX_INT,      // UNBOX_INT (VIRT_REG id) <- (VIRT_REG id), the operand must be an int
+
     LOAD_ARG,  // LOAD_ARG (VIRT_REG id) <- (LOGICAL index)
 
     LOAD_FREE_REF,  // LOAD_FREE_REF (VIRT_REG id) <- (LOGICAL index)
@@ -79,6 +90,7 @@ enum class Operation {
     ASSERT_RECORD,
     ASSERT_CLOSURE,
     ASSERT_NONZERO,
+    GUARD_INT,      // GUARD_INT NONE <- (VIRT_REG id) (LOGICAL site) (LOGICAL deopt map), leaves optimized code if not an int
 
     PRINT,
     INPUT,
@@ -86,6 +98,7 @@ enum class Operation {
     
     SWAP,
     BRANCH,         // BRANCH NONE <- (PARAM) (if true branch to block 0, else block 1)
+    CMP_BRANCH,     // CMP_BRANCH NONE <- (PARAM) (PARAM) (LOGICAL compare op), BRANCH on the result of GT, GEQ, EQ_INT or their untagged versions
     INIT_CALL,      // INIT_CALL NONE <- (LOGICAL num_params)
 
     GC,
@@ -139,14 +152,37 @@ struct BasicBlock {
     int final_loop_block{0};
 };
 
+// values a baseline frame needs to resume at a speculation site. In baseline code virtual register i
+// lives in stack slot i, so each value is paired with the slot it goes to
+struct DeoptState {
+    bool speculated{false};
+    std::vector<std::pair<int, Operand>> values;
+    // operands of the ADD or EQ at the site, passed in RSI and RDX
+    std::array<Operand, 2> operands;
+    // values and operands optimized code holds untagged, tagged again when leaving it
+    std::vector<bool> unboxed_values;
+    std::array<bool, 2> unboxed_operands{};
+};
+
 struct Function {
     std::vector<BasicBlock> blocks;
     int virt_reg_count;
     int parameter_count;
 
     int stack_slots;
-    
+    // stack slots holding live values at each safepoint (GC and EXEC_CALL), indexed by args[1]
+    std::vector<std::vector<int>> stack_maps;
+    // indexed by the site number in args[2] of ADD and EQ
+    std::vector<DeoptState> deopt_states;
+    // deopt states with the locations at each GUARD_INT after register allocation, indexed by args[2]
+    std::vector<DeoptState> deopt_maps;
+
     auto split_edge(int from, int to) -> BasicBlock&;
+    // like split_edge for an edge to a later block, but the new block goes right before `to`, so that the blocks
+    // of each loop stay between its header and final block. Returns the index of the new block
+    auto split_forward_edge(int from, int to) -> int;
+    // immediate dominator of each block, -1 for blocks not reachable from the entry
+    auto compute_dominators() const -> std::vector<int>;
 };
 
 struct Program {
@@ -157,12 +193,22 @@ struct Program {
     
     int num_globals{0};
     runtime::ProgramContext* ctx_ptr{nullptr};
+    // the only function the optimization passes rewrite, or -1 for all of them. Interprocedural analyses
+    // still look at every function
+    int only_function{-1};
 
     explicit Program(size_t heap_size);
     ~Program();
 
     Program(const Program& other) = delete;
     Program(Program&& other) noexcept;
+
+    auto optimizes(size_t fun_idx) const -> bool;
 };
 
+// ASSERT_* operations, which either fail or leave their operand unchanged. GUARD_INT is not one of them
+auto is_assert(Operation op) -> bool;
+// the operand a register was replaced with by an optimization pass, following chains of replacements
+auto resolve(const std::vector<Operand>& replace, Operand op) -> Operand;
+
 }; 
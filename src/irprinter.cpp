@@ -14,11 +14,20 @@ std::string op_str[] = {
     "MUL",
     "DIV",
     "EQ",
+    "EQ_INT",
     "GT",
     "GEQ",
     "AND",
     "OR",
     "NOT",
+    "ADD_UNBOXED",
+    "SUB_UNBOXED",
+    "MUL_UNBOXED",
+    "DIV_UNBOXED",
+    "GT_UNBOXED",
+    "GEQ_UNBOXED",
+    "BOX_INT",
+    "UNBOX_INT",
     "LOAD_ARG",         
     "LOAD_FREE_REF",      
     "REF_LOAD",           
@@ -45,11 +54,13 @@ std::string op_str[] = {
     "ASSERT_RECORD",
     "ASSERT_CLOSURE",
     "ASSERT_NONZERO",
+    "GUARD_INT",
     "PRINT",
     "INPUT",
     "INTCAST",
 	"SWAP",
     "BRANCH",
+    "CMP_BRANCH",
     "INIT_CALL",
     "GC",
     "ALLOC_STRUCT",
@@ -0,0 +1,193 @@
+#include "irserializer.h"
+
+#include "serialize.h"
+
+namespace IR {
+
+const std::string_view IR_MAGIC{"mitscriptc ir"};
+
+static void write_operand(serialize::Writer& out, const Operand& op) {
+    out.put<uint8_t>(op.type);
+    out.put<int32_t>(op.index);
+}
+
+static void write_values(serialize::Writer& out, const std::vector<std::pair<int, Operand>>& values) {
+    out.put<uint32_t>(values.size());
+    for (const auto& [index, op] : values) {
+        out.put<int32_t>(index);
+        write_operand(out, op);
+    }
+}
+
+static void write_ints(serialize::Writer& out, const std::vector<int>& ints) {
+    out.put<uint32_t>(ints.size());
+    for (int i : ints) {
+        out.put<int32_t>(i);
+    }
+}
+
+static void write_function(serialize::Writer& out, const Function& func) {
+    out.put<int32_t>(func.virt_reg_count);
+    out.put<int32_t>(func.parameter_count);
+    out.put<uint32_t>(func.blocks.size());
+    for (const BasicBlock& block : func.blocks) {
+        out.put<uint32_t>(block.phi_nodes.size());
+        for (const PhiNode& phi : block.phi_nodes) {
+            write_operand(out, phi.out);
+            write_values(out, phi.args);
+        }
+        out.put<uint32_t>(block.instructions.size());
+        for (const Instruction& instr : block.instructions) {
+            out.put<uint8_t>(static_cast<uint8_t>(instr.op));
+            write_operand(out, instr.out);
+            for (const Operand& arg : instr.args) {
+                write_operand(out, arg);
+            }
+        }
+        write_ints(out, block.predecessors);
+        write_ints(out, block.successors);
+        out.put<uint8_t>(block.is_loop_header);
+        out.put<int32_t>(block.final_loop_block);
+    }
+    out.put<uint32_t>(func.deopt_states.size());
+    for (const DeoptState& state : func.deopt_states) {
+        out.put<uint8_t>(state.speculated);
+        write_values(out, state.values);
+        for (const Operand& op : state.operands) {
+            write_operand(out, op);
+        }
+        out.put<uint32_t>(state.unboxed_values.size());
+        for (bool unboxed : state.unboxed_values) {
+            out.put<uint8_t>(unboxed);
+        }
+        for (bool unboxed : state.unboxed_operands) {
+            out.put<uint8_t>(unboxed);
+        }
+    }
+}
+
+auto write_program(const Program& program, uint64_t key) -> std::string {
+    serialize::Writer out;
+    out.put_bytes(IR_MAGIC);
+    out.put(key);
+    out.put<int32_t>(program.num_globals);
+    out.put<uint32_t>(program.ref_globals.size());
+    for (int global : program.ref_globals) {
+        out.put<int32_t>(global);
+    }
+    out.put<uint32_t>(program.immediates.size());
+    for (runtime::Value val : program.immediates) {
+        out.put_value(program.ctx_ptr, val);
+    }
+    out.put<uint32_t>(program.struct_layouts.size());
+    for (const auto& fields : program.struct_layouts) {
+        out.put<uint32_t>(fields.size());
+        for (runtime::Value field : fields) {
+            out.put_value(program.ctx_ptr, field);
+        }
+    }
+    out.put<uint32_t>(program.functions.size());
+    for (const Function& func : program.functions) {
+        write_function(out, func);
+    }
+    return out.data();
+}
+
+static auto read_operand(serialize::Reader& in) -> Operand {
+    auto type = in.get<uint8_t>();
+    if (type > Operand::STACK_SLOT) {
+        in.fail();
+    }
+    return {static_cast<Operand::OpType>(type), in.get<int32_t>()};
+}
+
+static void read_values(serialize::Reader& in, std::vector<std::pair<int, Operand>>& values) {
+    values.resize(in.get_count());
+    for (auto& [index, op] : values) {
+        index = in.get<int32_t>();
+        op = read_operand(in);
+    }
+}
+
+static void read_ints(serialize::Reader& in, std::vector<int>& ints) {
+    ints.resize(in.get_count());
+    for (int& i : ints) {
+        i = in.get<int32_t>();
+    }
+}
+
+static void read_function(serialize::Reader& in, Function& func) {
+    func.virt_reg_count = in.get<int32_t>();
+    func.parameter_count = in.get<int32_t>();
+    func.stack_slots = 0;
+    func.blocks.resize(in.get_count());
+    for (BasicBlock& block : func.blocks) {
+        block.phi_nodes.resize(in.get_count());
+        for (PhiNode& phi : block.phi_nodes) {
+            phi.out = read_operand(in);
+            read_values(in, phi.args);
+        }
+        block.instructions.resize(in.get_count());
+        for (Instruction& instr : block.instructions) {
+            auto op = in.get<uint8_t>();
+            if (op > static_cast<uint8_t>(Operation::GC)) {
+                in.fail();
+            }
+            instr.op = static_cast<Operation>(op);
+            instr.out = read_operand(in);
+            for (Operand& arg : instr.args) {
+                arg = read_operand(in);
+            }
+        }
+        read_ints(in, block.predecessors);
+        read_ints(in, block.successors);
+        block.is_loop_header = in.get<uint8_t>() != 0;
+        block.final_loop_block = in.get<int32_t>();
+    }
+    func.deopt_states.resize(in.get_count());
+    for (DeoptState& state : func.deopt_states) {
+        state.speculated = in.get<uint8_t>() != 0;
+        read_values(in, state.values);
+        for (Operand& op : state.operands) {
+            op = read_operand(in);
+        }
+        state.unboxed_values.resize(in.get_count());
+        for (size_t i = 0; i < state.unboxed_values.size(); ++i) {
+            state.unboxed_values[i] = in.get<uint8_t>() != 0;
+        }
+        for (bool& unboxed : state.unboxed_operands) {
+            unboxed = in.get<uint8_t>() != 0;
+        }
+    }
+}
+
+auto read_program(std::string_view data, uint64_t key, Program& program) -> bool {
+    serialize::Reader in(data);
+    if (in.get_bytes(IR_MAGIC.size()) != IR_MAGIC || in.get<uint64_t>() != key) {
+        return false;
+    }
+    program.num_globals = in.get<int32_t>();
+    uint32_t num_ref_globals = in.get_count();
+    for (uint32_t i = 0; i < num_ref_globals; ++i) {
+        program.ref_globals.insert(in.get<int32_t>());
+    }
+    // the strings are created in the static region, as by the compiler
+    program.immediates.resize(in.get_count());
+    for (runtime::Value& val : program.immediates) {
+        val = serialize::to_value(program.ctx_ptr, in.get_value());
+    }
+    program.struct_layouts.resize(in.get_count());
+    for (auto& fields : program.struct_layouts) {
+        fields.resize(in.get_count());
+        for (runtime::Value& field : fields) {
+            field = serialize::to_value(program.ctx_ptr, in.get_value());
+        }
+    }
+    program.functions.resize(in.get_count());
+    for (Function& func : program.functions) {
+        read_function(in, func);
+    }
+    return in.done() && !program.functions.empty();
+}
+
+};
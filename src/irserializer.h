@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "ir.h"
+
+namespace IR {
+
+// compact binary form of a program after the optimization passes and before register allocation, so the
+// results of register allocation (stack slots, stack maps and deopt maps) are not part of it. The key
+// identifies what the program was compiled from
+auto write_program(const Program& program, uint64_t key) -> std::string;
+// reads a program written with the same key into a freshly created program, whose context gets the
+// strings among the immediates and layouts. Returns false if the data is not such a program
+auto read_program(std::string_view data, uint64_t key, Program& program) -> bool;
+
+};
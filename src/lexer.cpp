@@ -0,0 +1,215 @@
+#include "lexer.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace lexer {
+
+static bool is_name_start(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static TokenType keyword_or_name(std::string_view text) {
+    switch (text.size()) {
+        case 2:
+            if (text == "if")
+                return IF;
+            break;
+        case 3:
+            if (text == "fun")
+                return FUNCTION;
+            break;
+        case 4:
+            if (text == "else")
+                return ELSE;
+            if (text == "true")
+                return BOOLCONST;
+            if (text == "None")
+                return NONECONST;
+            break;
+        case 5:
+            if (text == "while")
+                return WHILE;
+            if (text == "false")
+                return BOOLCONST;
+            break;
+        case 6:
+            if (text == "return")
+                return RETURN;
+            if (text == "global")
+                return GLOBAL;
+            break;
+        default:
+            break;
+    }
+    return NAME;
+}
+
+// length of the string constant starting at pos, 0 if it is not terminated or has an unknown escape
+static size_t string_length(std::string_view source, size_t pos) {
+    size_t end = pos + 1;
+    while (end < source.size()) {
+        char c = source[end];
+        if (c == '"')
+            return end + 1 - pos;
+        if (c == '\\') {
+            if (end + 1 >= source.size())
+                return 0;
+            char escaped = source[end + 1];
+            if (escaped != 'n' && escaped != 't' && escaped != '"' && escaped != '\\')
+                return 0;
+            end += 2;
+        } else {
+            end++;
+        }
+    }
+    return 0;
+}
+
+// follows the rules of grammar/MITScript.g: the longest match wins, and keywords win over names of the
+// same length. Characters no rule matches become single character ERROR tokens, which the parser rejects
+TokenStream::TokenStream(std::string_view source) {
+    tokens_.reserve(source.size() / 3 + 1);
+    size_t pos = 0;
+    while (pos < source.size()) {
+        char c = source[pos];
+        size_t len = 1;
+        TokenType type = ERROR;
+        switch (c) {
+            case ' ':
+            case '\t':
+            case '\r':
+            case '\n':
+            case '\f':
+                pos++;
+                continue;
+            case '/':
+                if (pos + 1 < source.size() && source[pos + 1] == '/') {
+                    while (pos < source.size() && source[pos] != '\n' && source[pos] != '\r')
+                        pos++;
+                    continue;
+                }
+                type = DIV;
+                break;
+            case '*':
+                type = MUL;
+                break;
+            case '+':
+                type = PLUS;
+                break;
+            case '-':
+                type = MINUS;
+                break;
+            case '(':
+                type = BROPEN;
+                break;
+            case ')':
+                type = BRCLOSE;
+                break;
+            case '[':
+                type = SQBROPEN;
+                break;
+            case ']':
+                type = SQBRCLOSE;
+                break;
+            case '{':
+                type = CBROPEN;
+                break;
+            case '}':
+                type = CBRCLOSE;
+                break;
+            case '&':
+                type = AND;
+                break;
+            case '|':
+                type = OR;
+                break;
+            case '!':
+                type = NOT;
+                break;
+            case ';':
+                type = SEMICOLON;
+                break;
+            case ':':
+                type = COLON;
+                break;
+            case ',':
+                type = COMMA;
+                break;
+            case '.':
+                type = POINT;
+                break;
+            case '=':
+                if (pos + 1 < source.size() && source[pos + 1] == '=') {
+                    type = REL;
+                    len = 2;
+                } else {
+                    type = ASSIGN;
+                }
+                break;
+            case '<':
+            case '>':
+                type = REL;
+                if (pos + 1 < source.size() && source[pos + 1] == '=')
+                    len = 2;
+                break;
+            case '"':
+                if (size_t str_len = string_length(source, pos)) {
+                    type = STRCONST;
+                    len = str_len;
+                }
+                break;
+            default:
+                if (is_digit(c)) {
+                    while (pos + len < source.size() && is_digit(source[pos + len]))
+                        len++;
+                    type = INT;
+                } else if (is_name_start(c)) {
+                    while (pos + len < source.size() &&
+                           (is_name_start(source[pos + len]) || is_digit(source[pos + len])))
+                        len++;
+                    type = keyword_or_name(source.substr(pos, len));
+                }
+                break;
+        }
+        tokens_.push_back({type, source.substr(pos, len)});
+        pos += len;
+    }
+    tokens_.push_back({END, source.substr(source.size())});
+}
+
+SourceFile::SourceFile(const std::string& filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode)) {
+        size_ = info.st_size;
+        // mapping an empty file fails, it is simply an empty source
+        if (size_ == 0) {
+            open_ = true;
+        } else {
+            void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                data_ = static_cast<const char*>(data);
+                open_ = true;
+            } else {
+                size_ = 0;
+            }
+        }
+    }
+    close(fd);
+}
+
+SourceFile::~SourceFile() {
+    if (data_ != nullptr)
+        munmap(const_cast<char*>(data_), size_);
+}
+
+};  // namespace lexer
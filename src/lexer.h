@@ -0,0 +1,90 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace lexer {
+
+// token types of grammar/MITScript.g, numbered like the tokens of the lexer generated from it
+enum TokenType : std::uint8_t {
+    INT = 1,
+    MUL,
+    DIV,
+    PLUS,
+    MINUS,
+    COMMENT,
+    WHITESPACE,
+    BROPEN,
+    BRCLOSE,
+    SQBROPEN,
+    SQBRCLOSE,
+    CBROPEN,
+    CBRCLOSE,
+    ASSIGN,
+    REL,
+    AND,
+    OR,
+    NOT,
+    SEMICOLON,
+    COLON,
+    COMMA,
+    POINT,
+    IF,
+    ELSE,
+    WHILE,
+    RETURN,
+    GLOBAL,
+    FUNCTION,
+    BOOLCONST,
+    NONECONST,
+    NAME,
+    STRCONST,
+    ERROR,
+    // always the last token
+    END,
+};
+
+struct Token {
+    TokenType type;
+    // points into the source, which has to outlive the tokens
+    std::string_view text;
+
+    auto getType() const -> TokenType { return type; }
+    auto getText() const -> std::string { return std::string(text); }
+};
+
+// the whole source lexed up front into one array, comments and whitespace are dropped
+class TokenStream {
+    std::vector<Token> tokens_;
+    size_t index_{0};
+
+   public:
+    explicit TokenStream(std::string_view source);
+
+    auto index() const -> size_t { return index_; }
+    // positions past the end read the END token
+    auto get(size_t index) const -> const Token* { return &tokens_[std::min(index, tokens_.size() - 1)]; }
+    void consume() { index_ = std::min(index_ + 1, tokens_.size() - 1); }
+};
+
+// contents of a source file, mapped into memory instead of read into a copy
+class SourceFile {
+    const char* data_{nullptr};
+    size_t size_{0};
+    bool open_{false};
+
+   public:
+    explicit SourceFile(const std::string& filename);
+    ~SourceFile();
+    SourceFile(const SourceFile&) = delete;
+    auto operator=(const SourceFile&) -> SourceFile& = delete;
+
+    auto is_open() const -> bool { return open_; }
+    auto text() const -> std::string_view { return {data_, size_}; }
+};
+
+};  // namespace lexer
@@ -0,0 +1,58 @@
+#include "mitscript.h"
+
+#include "AST.h"
+#include "compiler.h"
+#include "parsercode.h"
+
+namespace mitscript {
+
+auto translate(std::string_view source, size_t heap_size) -> std::optional<IR::Program> {
+    AST::Program* ast = parse(source);
+    if (ast == nullptr) {
+        return std::nullopt;
+    }
+    Compiler compiler(heap_size);
+    ast->accept(compiler);
+    IR::Program* program = compiler.get_program();
+    std::optional<IR::Program> result{std::move(*program)};
+    delete program;
+    delete ast;
+    return result;
+}
+
+Script::Script(std::string data1, size_t heap_size1) : heap_size(heap_size1), data(std::move(data1)) {}
+
+auto Script::compile(std::string_view source, codegen::CompileOptions options, size_t heap_size)
+    -> std::unique_ptr<Script> {
+    std::optional<IR::Program> program = translate(source, heap_size);
+    if (!program) {
+        return nullptr;
+    }
+    options.aot = true;
+    uint64_t key = codegen::cache_key(source, options, heap_size);
+    // the context the program was compiled in is only used for compiling
+    codegen::Executable compiled(std::move(*program), options);
+    return load(compiled.save_image(key), key, heap_size);
+}
+
+auto Script::load(std::string data, uint64_t key, size_t heap_size) -> std::unique_ptr<Script> {
+    std::unique_ptr<Script> script(new Script(std::move(data), heap_size));
+    if (!script->image.read(script->data) || script->image.key != key) {
+        return nullptr;
+    }
+    return script;
+}
+
+auto Script::get_image() const -> const std::string& {
+    return data;
+}
+
+auto Script::get_key() const -> uint64_t {
+    return image.key;
+}
+
+auto Script::instantiate() const -> std::unique_ptr<codegen::Executable> {
+    return std::make_unique<codegen::Executable>(image, heap_size);
+}
+
+};  // namespace mitscript
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "codegen.h"
+#include "ir.h"
+
+// interface for embedding the compiler, built as the libmitscript library. mitscriptc is a driver on top
+namespace mitscript {
+
+// heap size of a run unless another one is given, as in mitscriptc
+const size_t DEFAULT_HEAP_SIZE = 40 * (1 << 20);
+
+// parses the source and translates it into IR, with the string constants in a new context with the given
+// heap size. Empty if the source does not parse
+auto translate(std::string_view source, size_t heap_size) -> std::optional<IR::Program>;
+
+/*
+ * A program compiled once and run any number of times. The code records every address of its context
+ * (see codegen::Relocation), so each run gets a fresh context and a copy of the code patched for it.
+ * Runs share no state, and starting one compiles nothing.
+ */
+class Script {
+    size_t heap_size;
+    // the image and the parsed image, which points into it
+    std::string data;
+    codegen::Image image;
+
+    Script(std::string data1, size_t heap_size1);
+
+   public:
+    // optimizes the whole program up front, nullptr if the source does not parse
+    static auto compile(std::string_view source, codegen::CompileOptions options,
+                        size_t heap_size = DEFAULT_HEAP_SIZE) -> std::unique_ptr<Script>;
+    // from an image saved by this or an earlier process, see get_image. nullptr if it is damaged or its
+    // key is not the given one, see codegen::cache_key
+    static auto load(std::string data, uint64_t key, size_t heap_size = DEFAULT_HEAP_SIZE)
+        -> std::unique_ptr<Script>;
+
+    Script(const Script& other) = delete;
+
+    auto get_image() const -> const std::string&;
+    auto get_key() const -> uint64_t;
+    // a new run, which may outlive the script
+    auto instantiate() const -> std::unique_ptr<codegen::Executable>;
+};
+
+};  // namespace mitscript
@@ -1,68 +1,69 @@
 #include "AST.h"
-#include "MITScript.h"
-#include "antlr4-runtime.h"
+#include "lexer.h"
 #include "parsercode.h"
 #include "utils.h"
+#include <string>
+#include <string_view>
+#include <vector>
 
 #define check(x)                              \
     {                                         \
         token = tokens.get(tokens.index());   \
-        if (token->getType() != lexer::MITScript::x) \
+        if (token->getType() != lexer::x)     \
             return NULL;                      \
         tokens.consume();                     \
     }
 
 
-AST::Program* parse(std::ifstream& file) {
-    antlr4::ANTLRInputStream input(file);
-    lexer::MITScript lexer(&input);
-    antlr4::CommonTokenStream tokens(&lexer);
-
-    tokens.fill();
-
+AST::Program* parse(std::string_view source) {
+    lexer::TokenStream tokens(source);
     return Program(tokens);
 }
 
-AST::Program* Program(antlr4::CommonTokenStream& tokens) {
+AST::Program* Program(lexer::TokenStream& tokens) {
     AST::Program* Prog = new AST::Program;
-    antlr4::Token* token = tokens.get(tokens.index());
-    while (token->getType() != lexer::MITScript::EOF) {
-        AST::Statement* Stat = Statement(tokens);
-        if (!Stat)
+    std::vector<AST::Statement*> children;
+    const lexer::Token* token = tokens.get(tokens.index());
+    while (token->getType() != lexer::END) {
+        AST::Statement* Stat = Statement(tokens, *Prog);
+        if (!Stat) {
+            delete Prog;
             return NULL;
-        Prog->addChild(Stat);
+        }
+        children.push_back(Stat);
         token = tokens.get(tokens.index());
     }
+    Prog->children = Prog->arena.copy(children);
     return Prog;
 }
 
-AST::Statement* Statement(antlr4::CommonTokenStream& tokens) {
-    antlr4::Token* token = tokens.get(tokens.index());
+AST::Statement* Statement(lexer::TokenStream& tokens, AST::Program& prog) {
+    const lexer::Token* token = tokens.get(tokens.index());
     AST::Statement* stat;
     switch (token->getType()) {
-        case lexer::MITScript::GLOBAL:
-            stat = (AST::Statement*)Global(tokens);
+        case lexer::GLOBAL:
+            stat = (AST::Statement*)Global(tokens, prog);
             break;
-        case lexer::MITScript::IF:
-            stat = (AST::Statement*)IfStatement(tokens);
+        case lexer::IF:
+            stat = (AST::Statement*)IfStatement(tokens, prog);
             break;
-        case lexer::MITScript::WHILE:
-            stat = (AST::Statement*)WhileLoop(tokens);
+        case lexer::WHILE:
+            stat = (AST::Statement*)WhileLoop(tokens, prog);
             break;
-        case lexer::MITScript::RETURN:
-            stat = (AST::Statement*)Return(tokens);
+        case lexer::RETURN:
+            stat = (AST::Statement*)Return(tokens, prog);
             break;
         default:
-            AST::Expression* Lhs = LHS(tokens);
+            AST::Expression* Lhs = LHS(tokens, prog);
             if (!Lhs)
                 return NULL;
 
             token = tokens.get(tokens.index());
 
-            if (token->getType() == lexer::MITScript::BROPEN)
-                stat = (AST::Statement*)CallStatement(tokens, Lhs);
+            if (token->getType() == lexer::BROPEN)
+                stat = (AST::Statement*)CallStatement(tokens, prog, Lhs);
             else
-                stat = (AST::Statement*)Assignment(tokens, Lhs);
+                stat = (AST::Statement*)Assignment(tokens, prog, Lhs);
             break;
     }
     if (!stat)
@@ -70,29 +71,31 @@ AST::Statement* Statement(antlr4::CommonTokenStream& tokens) {
     return stat;
 }
 
-AST::Block* Block(antlr4::CommonTokenStream& tokens) {
-    AST::Block* Blk = new AST::Block;
-    antlr4::Token* token = tokens.get(tokens.index());
+AST::Block* Block(lexer::TokenStream& tokens, AST::Program& prog) {
+    AST::Block* Blk = prog.arena.make<AST::Block>();
+    std::vector<AST::Statement*> children;
+    const lexer::Token* token = tokens.get(tokens.index());
     check(CBROPEN);
     token = tokens.get(tokens.index());
-    while (token->getType() != lexer::MITScript::CBRCLOSE) {
-        AST::Statement* Stat = Statement(tokens);
+    while (token->getType() != lexer::CBRCLOSE) {
+        AST::Statement* Stat = Statement(tokens, prog);
         if (!Stat)
             return NULL;
-        Blk->addChild(Stat);
+        children.push_back(Stat);
         token = tokens.get(tokens.index());
     }
     tokens.consume();
+    Blk->children = prog.arena.copy(children);
     return Blk;
 }
 
-AST::Assignment* Assignment(antlr4::CommonTokenStream& tokens, AST::Expression* Lhs) {
-    antlr4::Token* token = tokens.get(tokens.index());
-    AST::Assignment* Assg = new AST::Assignment;
+AST::Assignment* Assignment(lexer::TokenStream& tokens, AST::Program& prog, AST::Expression* Lhs) {
+    const lexer::Token* token = tokens.get(tokens.index());
+    AST::Assignment* Assg = prog.arena.make<AST::Assignment>();
 
     check(ASSIGN);
 
-    AST::Expression* Expr = Expression(tokens);
+    AST::Expression* Expr = Expression(tokens, prog);
     if (!Expr)
         return NULL;
 
@@ -102,9 +105,9 @@ AST::Assignment* Assignment(antlr4::CommonTokenStream& tokens, AST::Expression*
     return Assg;
 }
 
-AST::Statement* CallStatement(antlr4::CommonTokenStream& tokens, AST::Expression* Lhs) {
-    antlr4::Token* token = tokens.get(tokens.index());
-    AST::Call* Cl = Call(tokens, Lhs);
+AST::Statement* CallStatement(lexer::TokenStream& tokens, AST::Program& prog, AST::Expression* Lhs) {
+    const lexer::Token* token = tokens.get(tokens.index());
+    AST::Call* Cl = Call(tokens, prog, Lhs);
 
     if (!Cl)
         return NULL;
@@ -113,92 +116,92 @@ AST::Statement* CallStatement(antlr4::CommonTokenStream& tokens, AST::Expression
     return (AST::Statement*)Cl;
 }
 
-AST::Global* Global(antlr4::CommonTokenStream& tokens) {
-    antlr4::Token* token = tokens.get(tokens.index());
-    AST::Global* Glob = new AST::Global;
+AST::Global* Global(lexer::TokenStream& tokens, AST::Program& prog) {
+    const lexer::Token* token = tokens.get(tokens.index());
+    AST::Global* Glob = prog.arena.make<AST::Global>();
     check(GLOBAL);
 
     token = tokens.get(tokens.index());
-    if (token->getType() != lexer::MITScript::NAME)
+    if (token->getType() != lexer::NAME)
         return NULL;
-    Glob->addName(token->getText());
+    Glob->addName(prog.symbols.intern(token->text));
     tokens.consume();
 
     check(SEMICOLON);
     return Glob;
 }
 
-AST::IfStatement* IfStatement(antlr4::CommonTokenStream& tokens) {
-    antlr4::Token* token = tokens.get(tokens.index());
-    AST::IfStatement* IfStat = new AST::IfStatement;
+AST::IfStatement* IfStatement(lexer::TokenStream& tokens, AST::Program& prog) {
+    const lexer::Token* token = tokens.get(tokens.index());
+    AST::IfStatement* IfStat = prog.arena.make<AST::IfStatement>();
     check(IF);
     check(BROPEN);
-    AST::Expression* Expr = Expression(tokens);
+    AST::Expression* Expr = Expression(tokens, prog);
     if (!Expr)
         return NULL;
     check(BRCLOSE);
     IfStat->addExpr(Expr);
 
-    AST::Block* Block1 = Block(tokens);
+    AST::Block* Block1 = Block(tokens, prog);
     if (!Block1)
         return NULL;
-    IfStat->addChild(Block1);
+    IfStat->block = Block1;
     token = tokens.get(tokens.index());
-    if (token->getType() != lexer::MITScript::ELSE)
+    if (token->getType() != lexer::ELSE)
         return IfStat;
 
     check(ELSE);
-    AST::Block* Block2 = Block(tokens);
+    AST::Block* Block2 = Block(tokens, prog);
     if (!Block2)
         return NULL;
-    IfStat->addChild(Block2);
+    IfStat->else_block = Block2;
     return IfStat;
 }
 
-AST::WhileLoop* WhileLoop(antlr4::CommonTokenStream& tokens) {
-    antlr4::Token* token = tokens.get(tokens.index());
-    AST::WhileLoop* WhileL = new AST::WhileLoop;
+AST::WhileLoop* WhileLoop(lexer::TokenStream& tokens, AST::Program& prog) {
+    const lexer::Token* token = tokens.get(tokens.index());
+    AST::WhileLoop* WhileL = prog.arena.make<AST::WhileLoop>();
     check(WHILE);
     check(BROPEN);
-    AST::Expression* Expr = Expression(tokens);
+    AST::Expression* Expr = Expression(tokens, prog);
     if (!Expr)
         return NULL;
     check(BRCLOSE);
     WhileL->addExpr(Expr);
 
-    AST::Block* Block1 = Block(tokens);
+    AST::Block* Block1 = Block(tokens, prog);
     if (!Block1)
         return NULL;
-    WhileL->addChild(Block1);
+    WhileL->block = Block1;
 
     return WhileL;
 }
 
-AST::Return* Return(antlr4::CommonTokenStream& tokens) {
-    antlr4::Token* token = tokens.get(tokens.index());
+AST::Return* Return(lexer::TokenStream& tokens, AST::Program& prog) {
+    const lexer::Token* token = tokens.get(tokens.index());
     check(RETURN);
-    AST::Expression* Expr = Expression(tokens);
+    AST::Expression* Expr = Expression(tokens, prog);
     if (!Expr)
         return NULL;
     token = tokens.get(tokens.index());
     check(SEMICOLON)
-        AST::Return* ReturnSt = new AST::Return;
+        AST::Return* ReturnSt = prog.arena.make<AST::Return>();
     ReturnSt->addExpr(Expr);
     return ReturnSt;
 }
 
-AST::Expression* Expression(antlr4::CommonTokenStream& tokens) {
-    antlr4::Token* token = tokens.get(tokens.index());
+AST::Expression* Expression(lexer::TokenStream& tokens, AST::Program& prog) {
+    const lexer::Token* token = tokens.get(tokens.index());
     AST::Expression* expr;
     switch (token->getType()) {
-        case lexer::MITScript::FUNCTION:
-            expr = (AST::Expression*)Function(tokens);
+        case lexer::FUNCTION:
+            expr = (AST::Expression*)Function(tokens, prog);
             break;
-        case lexer::MITScript::CBROPEN:
-            expr = (AST::Expression*)Record(tokens);
+        case lexer::CBROPEN:
+            expr = (AST::Expression*)Record(tokens, prog);
             break;
         default:
-            expr = Boolean(tokens);
+            expr = Boolean(tokens, prog);
             break;
     }
     if (!expr)
@@ -206,54 +209,56 @@ AST::Expression* Expression(antlr4::CommonTokenStream& tokens) {
     return expr;
 }
 
-AST::FunctionDeclaration* Function(antlr4::CommonTokenStream& tokens) {
-    antlr4::Token* token = tokens.get(tokens.index());
+AST::FunctionDeclaration* Function(lexer::TokenStream& tokens, AST::Program& prog) {
+    const lexer::Token* token = tokens.get(tokens.index());
     check(FUNCTION);
     check(BROPEN);
-    AST::FunctionDeclaration* FunDec = new AST::FunctionDeclaration();
+    AST::FunctionDeclaration* FunDec = prog.arena.make<AST::FunctionDeclaration>();
+    std::vector<AST::Symbol> arguments;
     token = tokens.get(tokens.index());
-    if (token->getType() == lexer::MITScript::NAME) {
-        FunDec->addArg(token->getText());
+    if (token->getType() == lexer::NAME) {
+        arguments.push_back(prog.symbols.intern(token->text));
         tokens.consume();
         token = tokens.get(tokens.index());
-        while (token->getType() == lexer::MITScript::COMMA) {
+        while (token->getType() == lexer::COMMA) {
             check(COMMA);
 
             token = tokens.get(tokens.index());
-            if (token->getType() != lexer::MITScript::NAME)
+            if (token->getType() != lexer::NAME)
                 return NULL;
-            FunDec->addArg(token->getText());
+            arguments.push_back(prog.symbols.intern(token->text));
             tokens.consume();
 
             token = tokens.get(tokens.index());
         }
     }
     check(BRCLOSE);
-    AST::Block* Blk = Block(tokens);
+    FunDec->arguments = prog.arena.copy(arguments);
+    AST::Block* Blk = Block(tokens, prog);
     if (!Blk)
         return NULL;
     FunDec->addBody(Blk);
     return FunDec;
 }
 
-AST::Expression* Boolean(antlr4::CommonTokenStream& tokens) {
-    AST::Expression* Conj = Conjunction(tokens);
+AST::Expression* Boolean(lexer::TokenStream& tokens, AST::Program& prog) {
+    AST::Expression* Conj = Conjunction(tokens, prog);
     AST::Expression* Temp;
     if (!Conj)
         return NULL;
 
-    antlr4::Token* token = tokens.get(tokens.index());
+    const lexer::Token* token = tokens.get(tokens.index());
     token = tokens.get(tokens.index());
-    while (token->getType() == lexer::MITScript::OR) {
+    while (token->getType() == lexer::OR) {
         check(OR);
         Temp = Conj;
-        Conj = Conjunction(tokens);
+        Conj = Conjunction(tokens, prog);
         if (!Conj)
             return NULL;
 
-        AST::BinaryExpression* BinExp = new AST::BinaryExpression();
-        BinExp->addChild(Temp);
-        BinExp->addChild(Conj);
+        AST::BinaryExpression* BinExp = prog.arena.make<AST::BinaryExpression>();
+        BinExp->children[0] = Temp;
+        BinExp->children[1] = Conj;
         BinExp->addOp("|");
 
         Conj = (AST::Expression*)BinExp;
@@ -263,24 +268,24 @@ AST::Expression* Boolean(antlr4::CommonTokenStream& tokens) {
     return Conj;
 }
 
-AST::Expression* Conjunction(antlr4::CommonTokenStream& tokens) {
-    AST::Expression* BUnit = BoolUnit(tokens);
+AST::Expression* Conjunction(lexer::TokenStream& tokens, AST::Program& prog) {
+    AST::Expression* BUnit = BoolUnit(tokens, prog);
     AST::Expression* Temp;
     if (!BUnit)
         return NULL;
 
-    antlr4::Token* token = tokens.get(tokens.index());
+    const lexer::Token* token = tokens.get(tokens.index());
     token = tokens.get(tokens.index());
-    while (token->getType() == lexer::MITScript::AND) {
+    while (token->getType() == lexer::AND) {
         check(AND);
         Temp = BUnit;
-        BUnit = BoolUnit(tokens);
+        BUnit = BoolUnit(tokens, prog);
         if (!BUnit)
             return NULL;
 
-        AST::BinaryExpression* BinExp = new AST::BinaryExpression();
-        BinExp->addChild(Temp);
-        BinExp->addChild(BUnit);
+        AST::BinaryExpression* BinExp = prog.arena.make<AST::BinaryExpression>();
+        BinExp->children[0] = Temp;
+        BinExp->children[1] = BUnit;
         BinExp->addOp("&");
 
         BUnit = (AST::Expression*)BinExp;
@@ -290,73 +295,73 @@ AST::Expression* Conjunction(antlr4::CommonTokenStream& tokens) {
     return BUnit;
 }
 
-AST::Expression* BoolUnit(antlr4::CommonTokenStream& tokens) {
-    antlr4::Token* token = tokens.get(tokens.index());
+AST::Expression* BoolUnit(lexer::TokenStream& tokens, AST::Program& prog) {
+    const lexer::Token* token = tokens.get(tokens.index());
 
     bool nt = false;
-    if (token->getType() == lexer::MITScript::NOT) {
+    if (token->getType() == lexer::NOT) {
         check(NOT);
         nt = true;
     }
 
-    AST::Expression* Pred = Predicate(tokens);
+    AST::Expression* Pred = Predicate(tokens, prog);
     if (!Pred)
         return NULL;
     if (!nt)
         return Pred;
 
-    AST::UnaryExpression* UnExpr = new AST::UnaryExpression();
-    UnExpr->addChild(Pred);
+    AST::UnaryExpression* UnExpr = prog.arena.make<AST::UnaryExpression>();
+    UnExpr->child = Pred;
     UnExpr->addOp("!");
 
     return (AST::Expression*)UnExpr;
 }
 
-AST::Expression* Predicate(antlr4::CommonTokenStream& tokens) {
-    antlr4::Token* token = tokens.get(tokens.index());
-    AST::Expression* Arith = Arithmetic(tokens);
+AST::Expression* Predicate(lexer::TokenStream& tokens, AST::Program& prog) {
+    const lexer::Token* token = tokens.get(tokens.index());
+    AST::Expression* Arith = Arithmetic(tokens, prog);
 
     if (!Arith)
         return NULL;
 
     token = tokens.get(tokens.index());
 
-    if (token->getType() != lexer::MITScript::REL)
+    if (token->getType() != lexer::REL)
         return Arith;
-    string op = token->getText();
+    std::string_view op = token->text;
     tokens.consume();
 
-    AST::Expression* Arith2 = Arithmetic(tokens);
+    AST::Expression* Arith2 = Arithmetic(tokens, prog);
     if (!Arith2)
         return NULL;
 
-    AST::BinaryExpression* BinExp = new AST::BinaryExpression();
-    BinExp->addChild(Arith);
-    BinExp->addChild(Arith2);
+    AST::BinaryExpression* BinExp = prog.arena.make<AST::BinaryExpression>();
+    BinExp->children[0] = Arith;
+    BinExp->children[1] = Arith2;
     BinExp->addOp(op);
     return (AST::Expression*)BinExp;
 }
 
-AST::Expression* Arithmetic(antlr4::CommonTokenStream& tokens) {
-    AST::Expression* Prod = Product(tokens);
+AST::Expression* Arithmetic(lexer::TokenStream& tokens, AST::Program& prog) {
+    AST::Expression* Prod = Product(tokens, prog);
     AST::Expression* Temp;
     if (!Prod)
         return NULL;
 
-    antlr4::Token* token = tokens.get(tokens.index());
+    const lexer::Token* token = tokens.get(tokens.index());
     token = tokens.get(tokens.index());
-    while (token->getType() == lexer::MITScript::PLUS || token->getType() == lexer::MITScript::MINUS) {
-        string op = token->getText();
+    while (token->getType() == lexer::PLUS || token->getType() == lexer::MINUS) {
+        std::string_view op = token->text;
         tokens.consume();
 
         Temp = Prod;
-        Prod = Product(tokens);
+        Prod = Product(tokens, prog);
         if (!Prod)
             return NULL;
 
-        AST::BinaryExpression* BinExp = new AST::BinaryExpression();
-        BinExp->addChild(Temp);
-        BinExp->addChild(Prod);
+        AST::BinaryExpression* BinExp = prog.arena.make<AST::BinaryExpression>();
+        BinExp->children[0] = Temp;
+        BinExp->children[1] = Prod;
         BinExp->addOp(op);
 
         Prod = (AST::Expression*)BinExp;
@@ -366,26 +371,26 @@ AST::Expression* Arithmetic(antlr4::CommonTokenStream& tokens) {
     return Prod;
 }
 
-AST::Expression* Product(antlr4::CommonTokenStream& tokens) {
-    AST::Expression* Un = Unit(tokens);
+AST::Expression* Product(lexer::TokenStream& tokens, AST::Program& prog) {
+    AST::Expression* Un = Unit(tokens, prog);
     AST::Expression* Temp;
     if (!Un)
         return NULL;
 
-    antlr4::Token* token = tokens.get(tokens.index());
+    const lexer::Token* token = tokens.get(tokens.index());
     token = tokens.get(tokens.index());
-    while (token->getType() == lexer::MITScript::DIV || token->getType() == lexer::MITScript::MUL) {
-        string op = token->getText();
+    while (token->getType() == lexer::DIV || token->getType() == lexer::MUL) {
+        std::string_view op = token->text;
         tokens.consume();
 
         Temp = Un;
-        Un = Unit(tokens);
+        Un = Unit(tokens, prog);
         if (!Un)
             return NULL;
 
-        AST::BinaryExpression* BinExp = new AST::BinaryExpression();
-        BinExp->addChild(Temp);
-        BinExp->addChild(Un);
+        AST::BinaryExpression* BinExp = prog.arena.make<AST::BinaryExpression>();
+        BinExp->children[0] = Temp;
+        BinExp->children[1] = Un;
         BinExp->addOp(op);
 
         Un = (AST::Expression*)BinExp;
@@ -395,12 +400,12 @@ AST::Expression* Product(antlr4::CommonTokenStream& tokens) {
     return Un;
 }
 
-AST::Expression* Unit(antlr4::CommonTokenStream& tokens) {
-    antlr4::Token* token = tokens.get(tokens.index());
+AST::Expression* Unit(lexer::TokenStream& tokens, AST::Program& prog) {
+    const lexer::Token* token = tokens.get(tokens.index());
     token = tokens.get(tokens.index());
 
     bool minus = false;
-    if (token->getType() == lexer::MITScript::MINUS) {
+    if (token->getType() == lexer::MINUS) {
         check(MINUS);
         minus = true;
     }
@@ -414,48 +419,48 @@ AST::Expression* Unit(antlr4::CommonTokenStream& tokens) {
     AST::StringConstant* Con3;
 
     switch (token->getType()) {
-        case lexer::MITScript::BOOLCONST:
-            Con = new AST::BoolConstant();
-            Con->addVal(token->getText());
+        case lexer::BOOLCONST:
+            Con = prog.arena.make<AST::BoolConstant>();
+            Con->addVal(token->text == "true");
             tokens.consume();
             Expr = (AST::Expression*)Con;
             break;
-        case lexer::MITScript::NONECONST:
-            Con1 = new AST::NoneConstant();
+        case lexer::NONECONST:
+            Con1 = prog.arena.make<AST::NoneConstant>();
             tokens.consume();
             Expr = (AST::Expression*)Con1;
             break;
-        case lexer::MITScript::INT:
-            Con2 = new AST::IntegerConstant();
-            Con2->addVal(token->getText());
+        case lexer::INT:
+            Con2 = prog.arena.make<AST::IntegerConstant>();
+            Con2->addVal(token->text);
             tokens.consume();
             Expr = (AST::Expression*)Con2;
             break;
-        case lexer::MITScript::STRCONST:
-            Con3 = new AST::StringConstant();
-            Con3->addVal(utils::escape(token->getText()));
+        case lexer::STRCONST:
+            Con3 = prog.arena.make<AST::StringConstant>();
+            Con3->addVal(prog.arena.copy(utils::escape(std::string(token->text.substr(1, token->text.size() - 2)))));
             tokens.consume();
             Expr = (AST::Expression*)Con3;
             break;
-        case lexer::MITScript::BROPEN:
+        case lexer::BROPEN:
             check(BROPEN);
-            Expr = Boolean(tokens);
+            Expr = Boolean(tokens, prog);
             if (!Expr)
                 return NULL;
             check(BRCLOSE);
             break;
         default:
-            AST::Expression* Lhs = LHS(tokens);
+            AST::Expression* Lhs = LHS(tokens, prog);
             if (!Lhs)
                 return NULL;
 
             token = tokens.get(tokens.index());
-            if (token->getType() != lexer::MITScript::BROPEN) {
+            if (token->getType() != lexer::BROPEN) {
                 Expr = Lhs;
                 break;
             }
 
-            Expr = (AST::Expression*)Call(tokens, Lhs);
+            Expr = (AST::Expression*)Call(tokens, prog, Lhs);
             break;
     }
 
@@ -464,45 +469,45 @@ AST::Expression* Unit(antlr4::CommonTokenStream& tokens) {
     if (!minus)
         return Expr;
     else {
-    	AST::UnaryExpression* UnExpr = new AST::UnaryExpression();
-    	UnExpr->addChild(Expr);
+    	AST::UnaryExpression* UnExpr = prog.arena.make<AST::UnaryExpression>();
+    	UnExpr->child = Expr;
     	UnExpr->addOp("-");
 
     	return (AST::Expression*)UnExpr;
     }
 }
 
-AST::Expression* LHS(antlr4::CommonTokenStream& tokens) {
-    antlr4::Token* token = tokens.get(tokens.index());
+AST::Expression* LHS(lexer::TokenStream& tokens, AST::Program& prog) {
+    const lexer::Token* token = tokens.get(tokens.index());
     token = tokens.get(tokens.index());
-    if (token->getType() != lexer::MITScript::NAME)
+    if (token->getType() != lexer::NAME)
         return NULL;
-    AST::StringConstant* Con = new AST::StringConstant();
-    Con->addVal(token->getText());
+    AST::Name* Con = prog.arena.make<AST::Name>();
+    Con->addName(prog.symbols.intern(token->text));
     AST::Expression* BaseExpression = (AST::Expression*)Con;
     tokens.consume();
 
     token = tokens.get(tokens.index());
-    while (token->getType() == lexer::MITScript::SQBROPEN || token->getType() == lexer::MITScript::POINT) {
-        if (token->getType() == lexer::MITScript::SQBROPEN) {
+    while (token->getType() == lexer::SQBROPEN || token->getType() == lexer::POINT) {
+        if (token->getType() == lexer::SQBROPEN) {
             check(SQBROPEN);
-            AST::Expression* Index = Expression(tokens);
+            AST::Expression* Index = Expression(tokens, prog);
             if (!Index)
                 return NULL;
-            AST::IndexExpression* IExpr = new AST::IndexExpression();
+            AST::IndexExpression* IExpr = prog.arena.make<AST::IndexExpression>();
             IExpr->addIndex(Index);
             IExpr->addBaseexpr(BaseExpression);
             BaseExpression = (AST::Expression*)IExpr;
             check(SQBRCLOSE);
         }
-        if (token->getType() == lexer::MITScript::POINT) {
+        if (token->getType() == lexer::POINT) {
             check(POINT);
             token = tokens.get(tokens.index());
-            if (token->getType() != lexer::MITScript::NAME)
+            if (token->getType() != lexer::NAME)
                 return NULL;
-            AST::FieldDereference* Fdef = new AST::FieldDereference();
+            AST::FieldDereference* Fdef = prog.arena.make<AST::FieldDereference>();
             Fdef->addBaseexpr(BaseExpression);
-            Fdef->addField(token->getText());
+            Fdef->addField(prog.symbols.intern(token->text));
             tokens.consume();
             BaseExpression = (AST::Expression*)Fdef;
         }
@@ -511,51 +516,55 @@ AST::Expression* LHS(antlr4::CommonTokenStream& tokens) {
     return BaseExpression;
 }
 
-AST::Record* Record(antlr4::CommonTokenStream& tokens) {
-    antlr4::Token* token = tokens.get(tokens.index());
+AST::Record* Record(lexer::TokenStream& tokens, AST::Program& prog) {
+    const lexer::Token* token = tokens.get(tokens.index());
     check(CBROPEN);
 
-    AST::Record* Rec = new AST::Record();
+    AST::Record* Rec = prog.arena.make<AST::Record>();
+    std::vector<pair<AST::Symbol, AST::Expression*>> dict;
     token = tokens.get(tokens.index());
-    while (token->getType() == lexer::MITScript::NAME) {
-        string name = token->getText();
+    while (token->getType() == lexer::NAME) {
+        AST::Symbol name = prog.symbols.intern(token->text);
         tokens.consume();
         check(COLON);
-        AST::Expression* Expr = Expression(tokens);
+        AST::Expression* Expr = Expression(tokens, prog);
         if (!Expr)
             return NULL;
         check(SEMICOLON);
-        Rec->addMap(name, Expr);
+        dict.push_back({name, Expr});
         token = tokens.get(tokens.index());
     }
     check(CBRCLOSE);
+    Rec->dict = prog.arena.copy(dict);
     return Rec;
 }
 
-AST::Call* Call(antlr4::CommonTokenStream& tokens, AST::Expression* Lhs) {
-    antlr4::Token* token = tokens.get(tokens.index());
+AST::Call* Call(lexer::TokenStream& tokens, AST::Program& prog, AST::Expression* Lhs) {
+    const lexer::Token* token = tokens.get(tokens.index());
 
-    AST::Call* Cl = new AST::Call();
+    AST::Call* Cl = prog.arena.make<AST::Call>();
+    std::vector<AST::Expression*> arguments;
     Cl->addExpr(Lhs);
     check(BROPEN);
 
     token = tokens.get(tokens.index());
-    if (token->getType() != lexer::MITScript::BRCLOSE) {
-        AST::Expression* Arg = Expression(tokens);
+    if (token->getType() != lexer::BRCLOSE) {
+        AST::Expression* Arg = Expression(tokens, prog);
         if (!Arg)
             return NULL;
-        Cl->addArg(Arg);
+        arguments.push_back(Arg);
         token = tokens.get(tokens.index());
-        while (token->getType() == lexer::MITScript::COMMA) {
+        while (token->getType() == lexer::COMMA) {
             check(COMMA);
-            Arg = Expression(tokens);
+            Arg = Expression(tokens, prog);
             if (!Arg)
                 return NULL;
-            Cl->addArg(Arg);
+            arguments.push_back(Arg);
             token = tokens.get(tokens.index());
         }
     }
     
     check(BRCLOSE);
+    Cl->arguments = prog.arena.copy(arguments);
     return Cl;
 }
@@ -1,30 +1,31 @@
 #pragma once
 
 #include "AST.h"
-#include "antlr4-runtime.h"
-#include "MITScript.h"
+#include "lexer.h"
+#include <string_view>
 
-AST::Program* Program(antlr4::CommonTokenStream& tokens);
-AST::Statement* Statement(antlr4::CommonTokenStream& tokens);
-AST::Global* Global(antlr4::CommonTokenStream& tokens);
-AST::Assignment* Assignment(antlr4::CommonTokenStream& tokens, AST::Expression* Lhs);
-AST::Statement* CallStatement(antlr4::CommonTokenStream& tokens, AST::Expression* Lhs);
-AST::Block* Block(antlr4::CommonTokenStream& tokens);
-AST::IfStatement* IfStatement(antlr4::CommonTokenStream& tokens);
-AST::WhileLoop* WhileLoop(antlr4::CommonTokenStream& tokens);
-AST::Return* Return(antlr4::CommonTokenStream& tokens);
+AST::Program* Program(lexer::TokenStream& tokens);
+AST::Statement* Statement(lexer::TokenStream& tokens, AST::Program& prog);
+AST::Global* Global(lexer::TokenStream& tokens, AST::Program& prog);
+AST::Assignment* Assignment(lexer::TokenStream& tokens, AST::Program& prog, AST::Expression* Lhs);
+AST::Statement* CallStatement(lexer::TokenStream& tokens, AST::Program& prog, AST::Expression* Lhs);
+AST::Block* Block(lexer::TokenStream& tokens, AST::Program& prog);
+AST::IfStatement* IfStatement(lexer::TokenStream& tokens, AST::Program& prog);
+AST::WhileLoop* WhileLoop(lexer::TokenStream& tokens, AST::Program& prog);
+AST::Return* Return(lexer::TokenStream& tokens, AST::Program& prog);
 
-AST::Expression* Expression(antlr4::CommonTokenStream& tokens);
-AST::FunctionDeclaration* Function(antlr4::CommonTokenStream& tokens);
-AST::Expression* Boolean(antlr4::CommonTokenStream& tokens);
-AST::Expression* Conjunction(antlr4::CommonTokenStream& tokens);
-AST::Expression* BoolUnit(antlr4::CommonTokenStream& tokens);
-AST::Expression* Predicate(antlr4::CommonTokenStream& tokens);
-AST::Expression* Arithmetic(antlr4::CommonTokenStream& tokens);
-AST::Expression* Product(antlr4::CommonTokenStream& tokens);
-AST::Expression* Unit(antlr4::CommonTokenStream& tokens);
-AST::Expression* LHS(antlr4::CommonTokenStream& tokens);
-AST::Call* Call(antlr4::CommonTokenStream& tokens, AST::Expression* Lhs);
-AST::Record* Record(antlr4::CommonTokenStream& tokens);
+AST::Expression* Expression(lexer::TokenStream& tokens, AST::Program& prog);
+AST::FunctionDeclaration* Function(lexer::TokenStream& tokens, AST::Program& prog);
+AST::Expression* Boolean(lexer::TokenStream& tokens, AST::Program& prog);
+AST::Expression* Conjunction(lexer::TokenStream& tokens, AST::Program& prog);
+AST::Expression* BoolUnit(lexer::TokenStream& tokens, AST::Program& prog);
+AST::Expression* Predicate(lexer::TokenStream& tokens, AST::Program& prog);
+AST::Expression* Arithmetic(lexer::TokenStream& tokens, AST::Program& prog);
+AST::Expression* Product(lexer::TokenStream& tokens, AST::Program& prog);
+AST::Expression* Unit(lexer::TokenStream& tokens, AST::Program& prog);
+AST::Expression* LHS(lexer::TokenStream& tokens, AST::Program& prog);
+AST::Call* Call(lexer::TokenStream& tokens, AST::Program& prog, AST::Expression* Lhs);
+AST::Record* Record(lexer::TokenStream& tokens, AST::Program& prog);
 
-AST::Program* parse(std::ifstream& file);
\ No newline at end of file
+// the program refers to the source, which has to outlive it
+AST::Program* parse(std::string_view source);
\ No newline at end of file
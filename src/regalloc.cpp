@@ -6,6 +6,8 @@
 #include <unordered_set>
 #include <vector>
 #include <bitset>
+#include <cmath>
+#include <tuple>
 
 #include "ir.h"
 #include "regalloc.h"
@@ -60,7 +62,10 @@ size_t LiveInterval::end_pos() const {
 }
 
 size_t LiveInterval::first_use() const {
-    assert(!this->use_locations.empty());
+    // an interval split off after its last use is only live, it never needs a register
+    if (this->use_locations.empty()) {
+        return std::numeric_limits<size_t>::max();
+    }
     return this->use_locations.front();
 }
 
@@ -177,8 +182,8 @@ size_t LiveInterval::next_use_after(size_t pos) const {
             return use_pos;
         }
     }
-    assert(false && "invalid interval state, active after end");
-    return 0;
+    // live (e.g. around a loop) without further uses, the best candidate for spilling
+    return std::numeric_limits<size_t>::max();
 }
 
 size_t LiveInterval::next_alive_after(size_t pos) const {
@@ -274,9 +279,6 @@ auto compute_machine_assignments(const Function& func) -> std::vector<LiveInterv
         for (size_t j = 0; j < func.blocks[i].instructions.size(); ++j) {
             switch (func.blocks[i].instructions[j].op) {
                 case Operation::ADD:
-                case Operation::ALLOC_CLOSURE:
-                case Operation::ALLOC_REC:
-                case Operation::ALLOC_REF:
                 case Operation::REC_LOAD_NAME:
                 case Operation::REC_LOAD_INDX:
                 case Operation::REC_STORE_NAME:
@@ -298,6 +300,7 @@ auto compute_machine_assignments(const Function& func) -> std::vector<LiveInterv
                     break;
                 case Operation::DIV:
                 case Operation::MUL:
+                case Operation::DIV_UNBOXED:
                     builders[static_cast<size_t>(MachineReg::RAX)].push_range({instr_id, instr_id});
                     builders[static_cast<size_t>(MachineReg::RDX)].push_range({instr_id, instr_id});
                     break;
@@ -400,9 +403,10 @@ auto mapping_to_instructions(const std::vector<std::pair<Operand, Operand>>& map
         }
     }
 
-    // handle all permuted registers
+    // handle all permuted registers, each swap puts one value in place and leaves the value it displaced
+    // in permuted[i], so longer cycles need several swaps
     for (size_t i = 0; i < permuted.size(); ++i) {
-        if (permuted[i].first != permuted[i].second) {
+        while (permuted[i].first != permuted[i].second) {
             size_t j = 0;
             while (permuted[j].first != permuted[i].second) {
                 ++j;
@@ -476,6 +480,23 @@ auto compute_live_intervals(const Function& func,
                     live.insert(instr.args[arg_id].index);
                 }
             }
+            // a failing guard reads the whole deopt state of its site
+            if (instr.op == Operation::GUARD_INT) {
+                const DeoptState& state = func.deopt_states[instr.args[1].index];
+                auto use = [&](const Operand& value) {
+                    if (value.type == Operand::VIRT_REG) {
+                        builders[value.index].push_range({block_ranges[block_index].first, instr_id - 1});
+                        builders[value.index].use_locations.push_back(instr_id - 1);
+                        live.insert(value.index);
+                    }
+                };
+                for (const auto& [slot, value] : state.values) {
+                    use(value);
+                }
+                for (const auto& operand : state.operands) {
+                    use(operand);
+                }
+            }
         }
 
         for (const PhiNode& phi : block.phi_nodes) {
@@ -555,6 +576,10 @@ auto try_alloc_reg(
         if (current.end_pos() >= max_free) {
             // split should happen *before* an instruction
             size_t split_pos = (max_free >> 1) << 1;
+            if (split_pos <= current.start_pos()) {
+                // the register is not free for a single instruction
+                return false;
+            }
             unhandled.push(current.split_at(split_pos));
         }
         current.op.type = Operand::MACHINE_REG;
@@ -643,13 +668,31 @@ void alloc_blocked_reg(
 
 auto set_instr_machine_regs(const Instruction& instr,
                             size_t instr_id,
-                            std::vector<IntervalGroup> groups) -> Instruction {
+                            const std::vector<IntervalGroup>& groups,
+                            std::vector<std::vector<int>>& stack_maps,
+                            const std::vector<DeoptState>& deopt_states,
+                            std::vector<DeoptState>& deopt_maps) -> Instruction {
     Instruction changed{instr};
     for (auto& arg : changed.args) {
         if (arg.type == Operand::VIRT_REG) {
             arg = groups[arg.index].assignment_at(instr_id - 1).value();
         }
     }
+    if (instr.op == Operation::GUARD_INT) {
+        DeoptState map = deopt_states[instr.args[1].index];
+        for (auto& [slot, value] : map.values) {
+            if (value.type == Operand::VIRT_REG) {
+                value = groups[value.index].assignment_at(instr_id - 1).value();
+            }
+        }
+        for (auto& operand : map.operands) {
+            if (operand.type == Operand::VIRT_REG) {
+                operand = groups[operand.index].assignment_at(instr_id - 1).value();
+            }
+        }
+        changed.args[2] = Operand{Operand::LOGICAL, (int)deopt_maps.size()};
+        deopt_maps.push_back(std::move(map));
+    }
     if (instr.out.type == Operand::VIRT_REG) {
         if (auto out_reg = groups[instr.out.index].assignment_at(instr_id + 1)) {
             changed.out = *out_reg;
@@ -657,16 +700,27 @@ auto set_instr_machine_regs(const Instruction& instr,
             changed.out = Operand{};
         }
     }
-    if (instr.op == Operation::GC) {
+    if (instr.op == Operation::GC || instr.op == Operation::EXEC_CALL) {
+        // record everything live across the safepoint for the collector. Calls clobber all
+        // registers, so only stack slots can be live across them
         std::bitset<MACHINE_REG_COUNT> live_regs;
+        std::vector<int> live_slots;
         for (const auto& group : groups) {
             if (auto assign = group.assignment_at(instr_id)) {
                 if (assign->type == Operand::MACHINE_REG) {
                     live_regs.set(assign->index);
+                } else if (assign->type == Operand::STACK_SLOT) {
+                    live_slots.push_back(assign->index);
                 }
             }
         }
-        changed.args[0] = Operand{Operand::LOGICAL, (int)live_regs.to_ulong()};
+        if (instr.op == Operation::GC) {
+            changed.args[0] = Operand{Operand::LOGICAL, (int)live_regs.to_ulong()};
+        } else {
+            assert(live_regs.none());
+        }
+        changed.args[1] = Operand{Operand::LOGICAL, (int)stack_maps.size()};
+        stack_maps.push_back(std::move(live_slots));
     }
     return changed;
 }
@@ -675,22 +729,27 @@ void generate_instr_mapping(const Instruction& instr, std::vector<std::pair<Oper
     switch (instr.op) {
         case Operation::ADD:
         case Operation::REC_LOAD_INDX:
+        case Operation::EQ:
             mapping.emplace_back(instr.args[0], Operand::from(MachineReg::RSI));
             mapping.emplace_back(instr.args[1], Operand::from(MachineReg::RDX));
             break;
-        case Operation::EQ:
-            mapping.emplace_back(instr.args[0], Operand::from(MachineReg::RDI));
-            mapping.emplace_back(instr.args[1], Operand::from(MachineReg::RSI));
-            break;
         case Operation::MUL:
         case Operation::DIV:
+        case Operation::DIV_UNBOXED:
             mapping.emplace_back(instr.args[0], Operand::from(MachineReg::RAX));
             mapping.emplace_back(instr.args[1], Operand::from(MachineReg::R10));
             break;
         case Operation::ADD_INT:
         case Operation::SUB:
+        case Operation::EQ_INT:
         case Operation::GT:
         case Operation::GEQ:
+        case Operation::ADD_UNBOXED:
+        case Operation::SUB_UNBOXED:
+        case Operation::MUL_UNBOXED:
+        case Operation::GT_UNBOXED:
+        case Operation::GEQ_UNBOXED:
+        case Operation::CMP_BRANCH:
         case Operation::AND:
         case Operation::OR:
         case Operation::REF_STORE:
@@ -705,6 +764,9 @@ void generate_instr_mapping(const Instruction& instr, std::vector<std::pair<Oper
         case Operation::ASSERT_RECORD:
         case Operation::ASSERT_CLOSURE:
         case Operation::ASSERT_NONZERO:
+        case Operation::GUARD_INT:
+        case Operation::BOX_INT:
+        case Operation::UNBOX_INT:
         case Operation::BRANCH:
         case Operation::REC_LOAD_STATIC:
         case Operation::REC_LOAD_NAME: // TODO check
@@ -771,7 +833,8 @@ void rewrite_instructions(Function& func,
         new_instructions.reserve(2 * block.instructions.size());
 
         for (const auto& instr : block.instructions) {
-            Instruction new_instr = set_instr_machine_regs(instr, instr_id, groups);
+            Instruction new_instr = set_instr_machine_regs(instr, instr_id, groups, func.stack_maps,
+                                                           func.deopt_states, func.deopt_maps);
 
             std::vector<std::pair<Operand, Operand>> current_resolves;
             while (resolve_index < resolves.size() && resolves[resolve_index].first < instr_id) {
@@ -792,14 +855,19 @@ void rewrite_instructions(Function& func,
     }
 }
 
-void allocate_registers(Function& func) {
-    // compute live intervals
+auto compute_block_ranges(const Function& func) -> std::vector<std::pair<size_t, size_t>> {
     std::vector<std::pair<size_t, size_t>> block_ranges;
     size_t current_from = 0;
     for (const BasicBlock& block : func.blocks) {
         block_ranges.emplace_back(current_from, current_from + 2 * block.instructions.size() + 1);
         current_from += 2 * block.instructions.size() + 2;
     }
+    return block_ranges;
+}
+
+void allocate_registers(Function& func) {
+    // compute live intervals
+    auto block_ranges = compute_block_ranges(func);
 
     auto intervals = compute_live_intervals(func, block_ranges);
 
@@ -877,6 +945,13 @@ void allocate_registers(Function& func) {
         if (!try_alloc_reg(current, unhandled, active, inactive, machine_reg_uses)) {
             alloc_blocked_reg(current, position, unhandled, active, inactive, stack_slot,
                               machine_reg_uses);
+            // an interval starting at the current position is split off as a whole, its ranges are
+            // back in unhandled
+            std::erase_if(active, [](const LiveInterval& interval) { return interval.empty(); });
+            std::erase_if(inactive, [](const LiveInterval& interval) { return interval.empty(); });
+            if (current.empty()) {
+                continue;
+            }
         }
 
         if (current.op.type == Operand::MACHINE_REG) {
@@ -897,6 +972,13 @@ void allocate_registers(Function& func) {
     //     std::cout << interval << std::endl;
     // }
 
+    resolve_and_rewrite(func, std::move(handled), block_ranges, stack_slot);
+}
+
+void resolve_and_rewrite(Function& func,
+                         std::vector<LiveInterval> handled,
+                         const std::vector<std::pair<size_t, size_t>>& block_ranges,
+                         size_t stack_slot) {
     // group intervals by vreg_id
     std::vector<std::vector<LiveInterval>> intervals_by_vreg;
     intervals_by_vreg.resize(func.virt_reg_count);
@@ -994,4 +1076,370 @@ void allocate_registers(Function& func) {
     func.stack_slots = (int)stack_slot;
 }
 
+auto compute_loop_depths(const Function& func) -> std::vector<int> {
+    std::vector<int> depths(func.blocks.size(), 0);
+    for (size_t i = 0; i < func.blocks.size(); ++i) {
+        if (func.blocks[i].is_loop_header) {
+            for (size_t j = i; j <= func.blocks[i].final_loop_block; ++j) {
+                depths[j]++;
+            }
+        }
+    }
+    return depths;
+}
+
+void allocate_registers_coloring(Function& func) {
+    auto block_ranges = compute_block_ranges(func);
+    auto intervals = compute_live_intervals(func, block_ranges);
+    auto machine_reg_uses = compute_machine_assignments(func);
+    auto depths = compute_loop_depths(func);
+
+    // an access inside a loop is assumed to run ten times as often as one outside of it
+    auto weight_at = [&](size_t pos) {
+        auto iter = std::upper_bound(block_ranges.begin(), block_ranges.end(), pos,
+                                     [](size_t p, const auto& range) { return p < range.first; });
+        size_t block = std::max<ptrdiff_t>(iter - block_ranges.begin() - 1, 0);
+        return std::pow(10.0, std::min(depths[block], 6));
+    };
+
+    size_t node_count = intervals.size();
+    std::vector<int> node_of(func.virt_reg_count, -1);
+    for (size_t i = 0; i < node_count; ++i) {
+        node_of[intervals[i].reg_id] = (int)i;
+    }
+
+    // a register is forbidden while an instruction needs it for its operands or clobbers it, calls clobber
+    // all of them
+    std::vector<std::bitset<MACHINE_REG_COUNT>> forbidden(node_count);
+    std::vector<double> spill_cost(node_count, 0);
+    for (size_t i = 0; i < node_count; ++i) {
+        for (size_t reg = 0; reg < MACHINE_REG_COUNT; ++reg) {
+            if (intervals[i].next_intersection(machine_reg_uses[reg])) {
+                forbidden[i].set(reg);
+            }
+        }
+        for (size_t use : intervals[i].use_locations) {
+            spill_cost[i] += weight_at(use);
+        }
+    }
+
+    std::vector<std::unordered_set<int>> adjacent(node_count);
+    std::vector<size_t> by_start(node_count);
+    for (size_t i = 0; i < node_count; ++i) {
+        by_start[i] = i;
+    }
+    std::sort(by_start.begin(), by_start.end(),
+              [&](size_t lhs, size_t rhs) { return intervals[lhs] < intervals[rhs]; });
+    for (size_t i = 0; i < node_count; ++i) {
+        const LiveInterval& current = intervals[by_start[i]];
+        for (size_t j = i + 1; j < node_count; ++j) {
+            const LiveInterval& other = intervals[by_start[j]];
+            if (other.start_pos() > current.end_pos()) {
+                break;
+            }
+            if (current.next_intersection(other)) {
+                adjacent[by_start[i]].insert((int)by_start[j]);
+                adjacent[by_start[j]].insert((int)by_start[i]);
+            }
+        }
+    }
+
+    // registers copied into each other by moves and phis, the most frequently executed copies first
+    std::vector<std::tuple<double, int, int>> copies;
+    for (size_t i = 0; i < func.blocks.size(); ++i) {
+        double weight = std::pow(10.0, std::min(depths[i], 6));
+        for (const auto& phi : func.blocks[i].phi_nodes) {
+            for (const auto& [pred, arg] : phi.args) {
+                if (arg.type == Operand::VIRT_REG && node_of[arg.index] != -1 && node_of[phi.out.index] != -1) {
+                    copies.emplace_back(weight, node_of[phi.out.index], node_of[arg.index]);
+                }
+            }
+        }
+        for (const auto& instr : func.blocks[i].instructions) {
+            if (instr.op == Operation::MOV && instr.out.type == Operand::VIRT_REG &&
+                instr.args[0].type == Operand::VIRT_REG && node_of[instr.out.index] != -1 &&
+                node_of[instr.args[0].index] != -1) {
+                copies.emplace_back(weight, node_of[instr.out.index], node_of[instr.args[0].index]);
+            }
+        }
+    }
+    std::stable_sort(copies.begin(), copies.end(),
+                     [](const auto& lhs, const auto& rhs) { return std::get<0>(lhs) > std::get<0>(rhs); });
+
+    std::vector<int> parent(node_count);
+    for (size_t i = 0; i < node_count; ++i) {
+        parent[i] = (int)i;
+    }
+    auto find = [&](int node) {
+        while (parent[node] != node) {
+            node = parent[node] = parent[parent[node]];
+        }
+        return node;
+    };
+    auto colors = [&](int node) { return (int)(MACHINE_REG_COUNT - forbidden[node].count()); };
+
+    // conservative coalescing (Briggs): merge the two sides of a copy if the merged node has fewer
+    // neighbors that are hard to color than it has registers to choose from, so merging never causes
+    // a spill. Nodes that cannot be in a register at all share a stack slot instead
+    for (const auto& [weight, first, second] : copies) {
+        int lhs = find(first);
+        int rhs = find(second);
+        if (lhs == rhs || adjacent[lhs].contains(rhs)) {
+            continue;
+        }
+        std::bitset<MACHINE_REG_COUNT> merged_forbidden = forbidden[lhs] | forbidden[rhs];
+        int merged_colors = (int)(MACHINE_REG_COUNT - merged_forbidden.count());
+        if (merged_colors == 0) {
+            if (colors(lhs) != 0 || colors(rhs) != 0) {
+                continue;
+            }
+        } else {
+            std::unordered_set<int> neighbors = adjacent[lhs];
+            neighbors.insert(adjacent[rhs].begin(), adjacent[rhs].end());
+            int significant = 0;
+            for (int neighbor : neighbors) {
+                significant += (int)adjacent[neighbor].size() >= colors(neighbor);
+            }
+            if (significant >= merged_colors) {
+                continue;
+            }
+        }
+        parent[rhs] = lhs;
+        forbidden[lhs] = merged_forbidden;
+        spill_cost[lhs] += spill_cost[rhs];
+        for (int neighbor : adjacent[rhs]) {
+            adjacent[neighbor].erase(rhs);
+            adjacent[neighbor].insert(lhs);
+            adjacent[lhs].insert(neighbor);
+        }
+        adjacent[rhs].clear();
+    }
+
+    // simplify: remove nodes that can always be colored, otherwise the one cheapest to spill per
+    // neighbor it frees up, and color them in reverse order of removal. Nodes removed as spill
+    // candidates may still find a register (Briggs' optimistic coloring)
+    std::vector<int> degree(node_count, 0);
+    std::vector<bool> removed(node_count, true);
+    for (size_t i = 0; i < node_count; ++i) {
+        if (find((int)i) == (int)i) {
+            degree[i] = (int)adjacent[i].size();
+            removed[i] = false;
+        }
+    }
+    std::vector<int> select_stack;
+    auto remove = [&](int node) {
+        removed[node] = true;
+        select_stack.push_back(node);
+        for (int neighbor : adjacent[node]) {
+            degree[neighbor]--;
+        }
+    };
+    // values live across a call never get a register and only make their neighbors look harder to color
+    for (size_t i = 0; i < node_count; ++i) {
+        if (!removed[i] && colors((int)i) == 0) {
+            remove((int)i);
+        }
+    }
+    bool remaining = true;
+    while (remaining) {
+        remaining = false;
+        int cheapest = -1;
+        bool simplified = false;
+        for (size_t i = 0; i < node_count; ++i) {
+            if (removed[i]) {
+                continue;
+            }
+            remaining = true;
+            if (degree[i] < colors((int)i)) {
+                remove((int)i);
+                simplified = true;
+            } else if (cheapest == -1 ||
+                       spill_cost[i] / (degree[i] + 1) < spill_cost[cheapest] / (degree[cheapest] + 1)) {
+                cheapest = (int)i;
+            }
+        }
+        if (remaining && !simplified) {
+            remove(cheapest);
+        }
+    }
+
+    std::vector<std::vector<int>> copy_partners(node_count);
+    for (const auto& [weight, first, second] : copies) {
+        int lhs = find(first);
+        int rhs = find(second);
+        if (lhs != rhs) {
+            copy_partners[lhs].push_back(rhs);
+            copy_partners[rhs].push_back(lhs);
+        }
+    }
+
+    size_t stack_slot{0};
+    std::vector<Operand> location(node_count);
+    for (size_t i = select_stack.size(); i > 0; --i) {
+        int node = select_stack[i - 1];
+        std::bitset<MACHINE_REG_COUNT> taken = forbidden[node];
+        for (int neighbor : adjacent[node]) {
+            if (location[neighbor].type == Operand::MACHINE_REG) {
+                taken.set(location[neighbor].index);
+            }
+        }
+        if (taken.all()) {
+            location[node] = Operand{Operand::STACK_SLOT, (int)stack_slot++};
+            continue;
+        }
+        // a copy whose sides did not merge is still free if both end up in the same register
+        int reg = -1;
+        for (int partner : copy_partners[node]) {
+            if (location[partner].type == Operand::MACHINE_REG && !taken.test(location[partner].index)) {
+                reg = location[partner].index;
+                break;
+            }
+        }
+        for (size_t candidate = 0; reg == -1 && candidate < MACHINE_REG_COUNT; ++candidate) {
+            if (!taken.test(candidate)) {
+                reg = (int)candidate;
+            }
+        }
+        location[node] = Operand{Operand::MACHINE_REG, reg};
+    }
+
+    // copies between two spilled nodes would move from memory to memory, let them share a slot when no
+    // two nodes in the merged slot interfere
+    std::vector<std::vector<int>> slot_nodes(stack_slot);
+    for (size_t i = 0; i < node_count; ++i) {
+        if (find((int)i) == (int)i && location[i].type == Operand::STACK_SLOT) {
+            slot_nodes[location[i].index].push_back((int)i);
+        }
+    }
+    for (const auto& [weight, first, second] : copies) {
+        Operand lhs = location[find(first)];
+        Operand rhs = location[find(second)];
+        if (lhs.type != Operand::STACK_SLOT || rhs.type != Operand::STACK_SLOT || lhs == rhs) {
+            continue;
+        }
+        auto& into = slot_nodes[lhs.index];
+        auto& from = slot_nodes[rhs.index];
+        bool interferes = std::any_of(into.begin(), into.end(), [&](int node) {
+            return std::any_of(from.begin(), from.end(), [&](int other) { return adjacent[node].contains(other); });
+        });
+        if (interferes) {
+            continue;
+        }
+        for (int node : from) {
+            location[node] = lhs;
+        }
+        into.insert(into.end(), from.begin(), from.end());
+        from.clear();
+    }
+    std::vector<int> slot_index(stack_slot, -1);
+    stack_slot = 0;
+    for (auto& op : location) {
+        if (op.type == Operand::STACK_SLOT) {
+            if (slot_index[op.index] == -1) {
+                slot_index[op.index] = (int)stack_slot++;
+            }
+            op.index = slot_index[op.index];
+        }
+    }
+
+    for (size_t i = 0; i < node_count; ++i) {
+        intervals[i].op = location[find((int)i)];
+    }
+    resolve_and_rewrite(func, std::move(intervals), block_ranges, stack_slot);
+}
+
+void assign_stack_slots(Function& func) {
+    // virtual register i lives in stack slot i for the whole function, machine registers only hold
+    // operands for the duration of a single instruction
+    auto to_slot = [](const Operand& op) {
+        return op.type == Operand::VIRT_REG ? Operand{Operand::STACK_SLOT, op.index} : op;
+    };
+    int stack_slot = func.virt_reg_count;
+
+    // the collector must not see stale slots, so liveness is still needed for the stack maps
+    auto block_ranges = compute_block_ranges(func);
+    std::vector<size_t> safepoints;
+    size_t instr_id = 0;
+    for (const auto& block : func.blocks) {
+        instr_id += 2;
+        for (const auto& instr : block.instructions) {
+            if (instr.op == Operation::GC || instr.op == Operation::EXEC_CALL) {
+                safepoints.push_back(instr_id);
+            }
+            instr_id += 2;
+        }
+    }
+    std::vector<std::vector<int>> live_slots(safepoints.size());
+    for (const auto& interval : compute_live_intervals(func, block_ranges)) {
+        for (auto [begin, end] : interval.ranges) {
+            auto iter = std::lower_bound(safepoints.begin(), safepoints.end(), begin);
+            for (; iter != safepoints.end() && *iter <= end; ++iter) {
+                live_slots[iter - safepoints.begin()].push_back((int)interval.reg_id);
+            }
+        }
+    }
+
+    size_t initial_blocks = func.blocks.size();
+    for (size_t pred = 0; pred < initial_blocks; ++pred) {
+        for (size_t i = 0; i < func.blocks[pred].successors.size(); ++i) {
+            size_t succ = func.blocks[pred].successors[i];
+            std::vector<std::pair<Operand, Operand>> phi_moves;
+            for (const auto& phi : func.blocks[succ].phi_nodes) {
+                for (const auto& [phi_pred, operand] : phi.args) {
+                    if (phi_pred == pred && to_slot(operand) != to_slot(phi.out)) {
+                        phi_moves.emplace_back(to_slot(operand), to_slot(phi.out));
+                    }
+                }
+            }
+            if (phi_moves.empty()) {
+                continue;
+            }
+            // phis reading each other's outputs form cycles, which would need stack to stack swaps.
+            // Copy all inputs to fresh slots first in that case
+            bool overlapping = false;
+            for (const auto& [from, to] : phi_moves) {
+                for (const auto& [other_from, other_to] : phi_moves) {
+                    overlapping = overlapping || from == other_to;
+                }
+            }
+            auto& instructions = func.split_edge(pred, succ).instructions;
+            if (overlapping) {
+                for (auto& [from, to] : phi_moves) {
+                    Operand temp{Operand::STACK_SLOT, stack_slot++};
+                    instructions.push_back(Instruction{Operation::MOV, temp, from});
+                    from = temp;
+                }
+            }
+            for (const auto& [from, to] : phi_moves) {
+                instructions.push_back(Instruction{Operation::MOV, to, from});
+            }
+        }
+    }
+
+    for (auto& block : func.blocks) {
+        std::vector<Instruction> new_instructions;
+        new_instructions.reserve(2 * block.instructions.size());
+        for (const auto& instr : block.instructions) {
+            Instruction new_instr{instr.op, to_slot(instr.out), {}};
+            for (size_t i = 0; i < instr.args.size(); ++i) {
+                new_instr.args[i] = to_slot(instr.args[i]);
+            }
+            if (instr.op == Operation::GC || instr.op == Operation::EXEC_CALL) {
+                if (instr.op == Operation::GC) {
+                    new_instr.args[0] = Operand{Operand::LOGICAL, 0};
+                }
+                new_instr.args[1] = Operand{Operand::LOGICAL, (int)func.stack_maps.size()};
+                func.stack_maps.push_back(std::move(live_slots[func.stack_maps.size()]));
+            }
+            std::vector<std::pair<Operand, Operand>> mapping;
+            generate_instr_mapping(new_instr, mapping);
+            mapping_to_instructions(mapping, new_instructions);
+            new_instructions.push_back(new_instr);
+        }
+        block.phi_nodes.clear();
+        block.instructions = std::move(new_instructions);
+    }
+    func.stack_slots = stack_slot;
+}
+
 };  // namespace IR
@@ -60,6 +60,13 @@ struct IntervalGroup {
 
 
 void allocate_registers(Function& func);
+// optimizing tier alternative to the linear scan in allocate_registers, colors the interference graph of
+// whole live intervals (Chaitin-Briggs with conservative coalescing). Spill costs are weighted by loop depth,
+// so values used in loops keep their register for the whole loop instead of being split around other uses
+void allocate_registers_coloring(Function& func);
+// baseline tier, gives every virtual register its own stack slot. Live intervals are only computed for the
+// stack maps of the safepoints, not to share slots or registers
+void assign_stack_slots(Function& func);
 
 void rewrite_instructions(
     Function& func, 
@@ -67,6 +74,20 @@ void rewrite_instructions(
     std::vector<std::pair<size_t, std::pair<Operand, Operand>>> resolves
 );
 
+// assigns the locations of the allocated intervals to the instructions and inserts the moves between them
+void resolve_and_rewrite(
+    Function& func,
+    std::vector<LiveInterval> handled,
+    const std::vector<std::pair<size_t, size_t>>& block_ranges,
+    size_t stack_slot
+);
+
+// number of loops around each block
+auto compute_loop_depths(const Function& func) -> std::vector<int>;
+
+// instruction positions of each block, as used by the live intervals
+auto compute_block_ranges(const Function& func) -> std::vector<std::pair<size_t, size_t>>;
+
 auto compute_live_intervals(
     const Function& func, 
     const std::vector<std::pair<size_t, size_t>>& block_ranges
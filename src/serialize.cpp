@@ -0,0 +1,78 @@
+#include "serialize.h"
+
+namespace serialize {
+
+void Writer::put_bytes(std::string_view bytes) {
+    out += bytes;
+}
+
+void Writer::put_string(std::string_view str) {
+    put<uint32_t>(str.size());
+    out += str;
+}
+
+void Writer::put_value(runtime::ProgramContext* ctx, runtime::Value val) {
+    if (runtime::value_get_type(val) != runtime::ValueType::HeapString) {
+        put(SavedValue::RAW);
+        put(val);
+        return;
+    }
+    put(runtime::value_get_string_ptr(val)->interned ? SavedValue::INTERNED_STRING : SavedValue::STRING);
+    put_string(runtime::value_get_std_string(ctx, val));
+}
+
+auto Writer::data() const -> const std::string& {
+    return out;
+}
+
+auto Reader::get_bytes(size_t size) -> std::string_view {
+    if (failed || data.size() - pos < size) {
+        failed = true;
+        return {};
+    }
+    pos += size;
+    return data.substr(pos - size, size);
+}
+
+auto Reader::get_string() -> std::string_view {
+    return get_bytes(get_count());
+}
+
+auto Reader::get_value() -> SavedValue {
+    SavedValue val{get<SavedValue::Kind>(), 0, {}};
+    if (val.kind == SavedValue::RAW) {
+        val.value = get<runtime::Value>();
+    } else if (val.kind == SavedValue::STRING || val.kind == SavedValue::INTERNED_STRING) {
+        val.text = get_string();
+    } else {
+        failed = true;
+    }
+    return val;
+}
+
+auto Reader::get_count() -> uint32_t {
+    auto count = get<uint32_t>();
+    if (count > data.size() - pos) {
+        failed = true;
+        return 0;
+    }
+    return count;
+}
+
+void Reader::fail() {
+    failed = true;
+}
+
+auto Reader::done() const -> bool {
+    return !failed && pos == data.size();
+}
+
+auto to_value(runtime::ProgramContext* ctx, const SavedValue& val) -> runtime::Value {
+    if (val.kind == SavedValue::RAW) {
+        return val.value;
+    }
+    runtime::Value str = runtime::to_value(ctx, std::string(val.text));
+    return val.kind == SavedValue::INTERNED_STRING ? ctx->intern(str) : str;
+}
+
+};  // namespace serialize
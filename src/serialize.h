@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include "value.h"
+
+// byte formats of the files a run leaves for later runs of the same program, native images and
+// optimized IR. Fields are written in the byte order of the machine, as files are only ever read by the
+// build of the compiler that wrote them
+namespace serialize {
+
+// value of a program context as it is saved. Heap strings are saved by their text, since their address
+// is only valid in the context that created them
+struct SavedValue {
+    enum Kind : uint8_t {
+        RAW,
+        STRING,
+        INTERNED_STRING,
+    };
+
+    Kind kind;
+    runtime::Value value;
+    std::string_view text;
+};
+
+class Writer {
+    std::string out;
+
+   public:
+    template <typename T>
+    void put(T val) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        out.append(reinterpret_cast<const char*>(&val), sizeof(T));
+    }
+
+    void put_bytes(std::string_view bytes);
+    // with its length in front
+    void put_string(std::string_view str);
+    void put_value(runtime::ProgramContext* ctx, runtime::Value val);
+
+    auto data() const -> const std::string&;
+};
+
+// reads the fields of a file in order, failing once the data runs out
+class Reader {
+    std::string_view data;
+    size_t pos{0};
+    bool failed{false};
+
+   public:
+    explicit Reader(std::string_view data1) : data(data1) {}
+
+    template <typename T>
+    auto get() -> T {
+        T val{};
+        std::string_view bytes = get_bytes(sizeof(T));
+        if (!failed) {
+            std::memcpy(&val, bytes.data(), sizeof(T));
+        }
+        return val;
+    }
+
+    // strings and the text of saved values point into the data
+    auto get_bytes(size_t size) -> std::string_view;
+    auto get_string() -> std::string_view;
+    auto get_value() -> SavedValue;
+    // counts are checked against the remaining data, so that a damaged file cannot cause huge allocations
+    auto get_count() -> uint32_t;
+
+    void fail();
+    auto done() const -> bool;
+};
+
+// strings are allocated in ctx, and interned again if they were interned when saved
+auto to_value(runtime::ProgramContext* ctx, const SavedValue& val) -> runtime::Value;
+
+};  // namespace serialize
@@ -101,25 +101,31 @@ void ShapeAnalysis::infer_structs() {
                         known_regs[{i, cur_ins.out.index}] = cur_ins.args[1].index;
                     
                     if (cur_ins.op == IR::Operation::REC_STORE_NAME && cur_ins.args[0].type == IR::Operand::VIRT_REG && known_regs.count({i, cur_ins.args[0].index})) {
-                        cur_ins.op = IR::Operation::REC_STORE_STATIC;
                         runtime::Value field = prog_->immediates[cur_ins.args[1].index];
                         int rec_idx = known_regs[{i, cur_ins.args[0].index}];
                         int field_idx = (int) (find(prog_->struct_layouts[rec_idx].begin(), prog_->struct_layouts[rec_idx].end(), field) - prog_->struct_layouts[rec_idx].begin());
-                        cur_ins.args[1] = {IR::Operand::LOGICAL, field_idx};
+                        // fields added after allocation go through a layout transition at runtime
+                        if (field_idx < (int) prog_->struct_layouts[rec_idx].size()) {
+                            cur_ins.op = IR::Operation::REC_STORE_STATIC;
+                            cur_ins.args[1] = {IR::Operand::LOGICAL, field_idx};
+                        }
                     }
         
                     if (cur_ins.op == IR::Operation::REC_LOAD_NAME && cur_ins.args[0].type == IR::Operand::VIRT_REG && known_regs.count({i, cur_ins.args[0].index})) {
-                        cur_ins.op = IR::Operation::REC_LOAD_STATIC;
                         runtime::Value field = prog_->immediates[cur_ins.args[1].index];
                         int rec_idx = known_regs[{i, cur_ins.args[0].index}];
                         int field_idx = (int) (find(prog_->struct_layouts[rec_idx].begin(), prog_->struct_layouts[rec_idx].end(), field) - prog_->struct_layouts[rec_idx].begin());
-                        cur_ins.args[1] = {IR::Operand::LOGICAL, field_idx};
+                        if (field_idx < (int) prog_->struct_layouts[rec_idx].size()) {
+                            cur_ins.op = IR::Operation::REC_LOAD_STATIC;
+                            cur_ins.args[1] = {IR::Operand::LOGICAL, field_idx};
+                        }
                     }
 
                     new_ins.push_back(cur_ins);
                 }
 
-                prog_->functions[i].blocks[j].instructions = new_ins;
+                if (prog_->optimizes(i))
+                    prog_->functions[i].blocks[j].instructions = new_ins;
             }
 
             int ret_rec = return_recs[0];
@@ -0,0 +1,178 @@
+#include "value.h"
+#include "ir.h"
+#include "regalloc.h"
+#include "speculator.h"
+#include <algorithm>
+#include <unordered_set>
+
+Speculator::Speculator(IR::Program* prog) : prog_(prog){}
+
+static bool is_site(const IR::Instruction& ins) {
+    return (ins.op == IR::Operation::ADD || ins.op == IR::Operation::EQ) && ins.args[2].type == IR::Operand::LOGICAL;
+}
+
+std::vector<size_t> Speculator::number_sites() {
+    std::vector<size_t> site_counts;
+    for (auto& fun : prog_->functions) {
+        int sites = 0;
+        for (auto& block : fun.blocks)
+            for (auto& ins : block.instructions)
+                if (ins.op == IR::Operation::ADD || ins.op == IR::Operation::EQ)
+                    ins.args[2] = {IR::Operand::LOGICAL, sites++};
+        site_counts.push_back(sites);
+    }
+    return site_counts;
+}
+
+IR::Program* Speculator::insert_guards(const std::vector<std::vector<uint8_t>>& feedback) {
+    for (size_t i = 0; i < prog_->functions.size(); i++) {
+        if (!prog_->optimizes(i))
+            continue;
+        IR::Function& fun = prog_->functions[i];
+        fun.deopt_states.assign(feedback[i].size(), {});
+
+        // positions as used by the live intervals, see compute_block_ranges
+        std::vector<size_t> positions;
+        std::vector<int> sites;
+        size_t instr_id = 0;
+        for (const auto& block : fun.blocks) {
+            instr_id += 2;
+            for (const auto& ins : block.instructions) {
+                if (is_site(ins) && feedback[i][ins.args[2].index] == runtime::FEEDBACK_INT) {
+                    bool int_operands = true;
+                    for (size_t k = 0; k < 2; k++)
+                        if (ins.args[k].type == IR::Operand::IMMEDIATE)
+                            int_operands = int_operands && runtime::value_get_type(prog_->immediates[ins.args[k].index]) == runtime::ValueType::Int;
+                    if (int_operands) {
+                        positions.push_back(instr_id);
+                        sites.push_back(ins.args[2].index);
+                        fun.deopt_states[ins.args[2].index].speculated = true;
+                        fun.deopt_states[ins.args[2].index].operands = {ins.args[0], ins.args[1]};
+                    }
+                }
+                instr_id += 2;
+            }
+        }
+        if (sites.empty())
+            continue;
+
+        // baseline code resumes after the site, so everything live across it has to be restored
+        for (const auto& interval : IR::compute_live_intervals(fun, IR::compute_block_ranges(fun))) {
+            for (auto [begin, end] : interval.ranges) {
+                auto iter = std::lower_bound(positions.begin(), positions.end(), begin);
+                for (; iter != positions.end() && *iter <= end; ++iter) {
+                    IR::DeoptState& state = fun.deopt_states[sites[iter - positions.begin()]];
+                    state.values.push_back({(int) interval.reg_id, {IR::Operand::VIRT_REG, (int) interval.reg_id}});
+                }
+            }
+        }
+
+        for (auto& block : fun.blocks) {
+            std::vector<IR::Instruction> new_ins;
+            for (const auto& ins : block.instructions) {
+                if (is_site(ins) && fun.deopt_states[ins.args[2].index].speculated) {
+                    for (size_t k = 0; k < 2; k++)
+                        if (ins.args[k].type == IR::Operand::VIRT_REG && (k == 0 || ins.args[1] != ins.args[0]))
+                            new_ins.push_back({IR::Operation::GUARD_INT, {}, {ins.args[k], {IR::Operand::LOGICAL, ins.args[2].index}, {}}});
+                }
+                new_ins.push_back(ins);
+            }
+            block.instructions = new_ins;
+        }
+    }
+    return prog_;
+}
+
+bool Speculator::is_int(const IR::Operand& op, const std::vector<bool>& int_regs) {
+    if (op.type == IR::Operand::IMMEDIATE)
+        return runtime::value_get_type(prog_->immediates[op.index]) == runtime::ValueType::Int;
+    return op.type == IR::Operand::VIRT_REG && int_regs[op.index];
+}
+
+void Speculator::specialize_function(IR::Function& fun) {
+    auto speculated = [&](const IR::Instruction& ins) {
+        return is_site(ins) && (size_t) ins.args[2].index < fun.deopt_states.size() && fun.deopt_states[ins.args[2].index].speculated;
+    };
+
+    // optimistically assume all results that can be ints are, then drop the ones with a non int input until
+    // nothing changes. This way loop carried values are found as well
+    std::vector<bool> int_regs(fun.virt_reg_count, false);
+    for (const auto& block : fun.blocks) {
+        for (const auto& pn : block.phi_nodes)
+            int_regs[pn.out.index] = true;
+        for (const auto& ins : block.instructions)
+            if (ins.out.type == IR::Operand::VIRT_REG)
+                int_regs[ins.out.index] = true;
+    }
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (const auto& block : fun.blocks) {
+            for (const auto& pn : block.phi_nodes) {
+                bool int_phi = true;
+                for (const auto& arg : pn.args)
+                    int_phi = int_phi && is_int(arg.second, int_regs);
+                if (int_regs[pn.out.index] && !int_phi) {
+                    int_regs[pn.out.index] = false;
+                    changed = true;
+                }
+            }
+            for (const auto& ins : block.instructions) {
+                if (ins.out.type != IR::Operand::VIRT_REG || !int_regs[ins.out.index])
+                    continue;
+                bool int_out = false;
+                switch (ins.op) {
+                    case IR::Operation::ADD_INT:
+                    case IR::Operation::SUB:
+                    case IR::Operation::MUL:
+                    case IR::Operation::DIV:
+                        int_out = true;
+                        break;
+                    case IR::Operation::ADD:
+                        int_out = speculated(ins) || (is_int(ins.args[0], int_regs) && is_int(ins.args[1], int_regs));
+                        break;
+                    case IR::Operation::MOV:
+                        int_out = is_int(ins.args[0], int_regs);
+                        break;
+                    default:
+                        break;
+                }
+                if (!int_out) {
+                    int_regs[ins.out.index] = false;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    for (auto& block : fun.blocks) {
+        // values checked by a guard or assertion earlier in the block
+        std::unordered_set<int> checked;
+        auto known_int = [&](const IR::Operand& op) {
+            return is_int(op, int_regs) || (op.type == IR::Operand::VIRT_REG && checked.contains(op.index));
+        };
+        std::vector<IR::Instruction> new_ins;
+        for (auto ins : block.instructions) {
+            if ((ins.op == IR::Operation::GUARD_INT || ins.op == IR::Operation::ASSERT_INT) && ins.args[0].type == IR::Operand::VIRT_REG) {
+                if (known_int(ins.args[0]))
+                    continue;
+                checked.insert(ins.args[0].index);
+            }
+            if (known_int(ins.args[0]) && known_int(ins.args[1])) {
+                if (ins.op == IR::Operation::ADD)
+                    ins.op = IR::Operation::ADD_INT;
+                else if (ins.op == IR::Operation::EQ)
+                    ins.op = IR::Operation::EQ_INT;
+            }
+            new_ins.push_back(ins);
+        }
+        block.instructions = new_ins;
+    }
+}
+
+IR::Program* Speculator::specialize() {
+    for (size_t i = 0; i < prog_->functions.size(); i++)
+        if (prog_->optimizes(i))
+            specialize_function(prog_->functions[i]);
+    return prog_;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "value.h"
+#include "ir.h"
+
+class Speculator {
+private:
+    IR::Program* prog_;
+public:
+    Speculator(IR::Program* prog);
+
+    // numbers the ADD and EQ sites of every function in args[2], returns the number of sites per function
+    std::vector<size_t> number_sites();
+    // runs before the other passes, guards the operands of the sites where baseline code only saw ints
+    IR::Program* insert_guards(const std::vector<std::vector<uint8_t>>& feedback);
+    // runs after the other passes, turns ADD and EQ on guarded or otherwise known ints into the int versions
+    IR::Program* specialize();
+
+    bool is_int(const IR::Operand& op, const std::vector<bool>& int_regs);
+    void specialize_function(IR::Function& fun);
+};
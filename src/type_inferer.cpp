@@ -185,7 +185,8 @@ void TypeInferer::infer_type() {
                     new_ins.push_back(cur_ins);
                 }
 
-                prog_->functions[i].blocks[j].instructions = new_ins;
+                if (prog_->optimizes(i))
+                    prog_->functions[i].blocks[j].instructions = new_ins;
             }
 
             vt ret_rec = return_recs[0];
@@ -0,0 +1,192 @@
+#include "value.h"
+#include "ir.h"
+#include "unboxer.h"
+#include <optional>
+#include <unordered_map>
+
+Unboxer::Unboxer(IR::Program* prog) : prog_(prog){}
+
+static IR::Operation unboxed_op(IR::Operation op) {
+    switch (op) {
+        case IR::Operation::ADD_INT:
+            return IR::Operation::ADD_UNBOXED;
+        case IR::Operation::SUB:
+            return IR::Operation::SUB_UNBOXED;
+        case IR::Operation::MUL:
+            return IR::Operation::MUL_UNBOXED;
+        case IR::Operation::DIV:
+            return IR::Operation::DIV_UNBOXED;
+        case IR::Operation::GT:
+            return IR::Operation::GT_UNBOXED;
+        case IR::Operation::GEQ:
+            return IR::Operation::GEQ_UNBOXED;
+        default:
+            return op;
+    }
+}
+
+static bool is_arithmetic(IR::Operation op) {
+    return op == IR::Operation::ADD_INT || op == IR::Operation::SUB || op == IR::Operation::MUL || op == IR::Operation::DIV;
+}
+
+bool Unboxer::is_int(const IR::Operand& op, const std::vector<bool>& unboxed) {
+    if (op.type == IR::Operand::IMMEDIATE)
+        return runtime::value_get_type(prog_->immediates[op.index]) == runtime::ValueType::Int;
+    return op.type == IR::Operand::VIRT_REG && unboxed[op.index];
+}
+
+IR::Operand Unboxer::unboxed_immediate(const IR::Operand& op) {
+    int32_t val = runtime::value_get_int32(prog_->immediates[op.index]);
+    auto [iter, inserted] = unboxed_immediates_.try_emplace(val, (int) prog_->immediates.size());
+    if (inserted)
+        prog_->immediates.push_back(runtime::to_unboxed(val));
+    return {IR::Operand::IMMEDIATE, iter->second};
+}
+
+void Unboxer::unbox_function(IR::Function& fun) {
+    // results of int arithmetic are untagged. Phis and moves are untagged if all their inputs are, found
+    // optimistically like in the speculator so loop carried values stay untagged across iterations
+    std::vector<bool> unboxed(fun.virt_reg_count, false);
+    for (const auto& block : fun.blocks) {
+        for (const auto& pn : block.phi_nodes)
+            unboxed[pn.out.index] = true;
+        for (const auto& ins : block.instructions)
+            if (ins.out.type == IR::Operand::VIRT_REG && (is_arithmetic(ins.op) || ins.op == IR::Operation::MOV))
+                unboxed[ins.out.index] = true;
+    }
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (const auto& block : fun.blocks) {
+            for (const auto& pn : block.phi_nodes) {
+                bool int_phi = true;
+                for (const auto& arg : pn.args)
+                    int_phi = int_phi && is_int(arg.second, unboxed);
+                if (unboxed[pn.out.index] && !int_phi) {
+                    unboxed[pn.out.index] = false;
+                    changed = true;
+                }
+            }
+            for (const auto& ins : block.instructions) {
+                if (ins.op == IR::Operation::MOV && ins.out.type == IR::Operand::VIRT_REG && unboxed[ins.out.index] && !is_int(ins.args[0], unboxed)) {
+                    unboxed[ins.out.index] = false;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    auto is_unboxed = [&](const IR::Operand& op) {
+        return op.type == IR::Operand::VIRT_REG && unboxed[op.index];
+    };
+    auto new_reg = [&](bool untagged) {
+        unboxed.push_back(untagged);
+        return IR::Operand{IR::Operand::VIRT_REG, fun.virt_reg_count++};
+    };
+
+    for (size_t j = 0; j < fun.blocks.size(); j++) {
+        IR::BasicBlock& block = fun.blocks[j];
+        std::vector<IR::Instruction> new_ins;
+        // tagged and untagged copies made earlier in the block
+        std::unordered_map<int, IR::Operand> boxed;
+        std::unordered_map<int, IR::Operand> unboxed_copies;
+        auto box = [&](const IR::Operand& op) {
+            if (!boxed.contains(op.index)) {
+                IR::Operand out = new_reg(false);
+                new_ins.push_back({IR::Operation::BOX_INT, out, {op}});
+                boxed[op.index] = out;
+            }
+            return boxed[op.index];
+        };
+        auto unbox = [&](const IR::Operand& op) {
+            if (op.type == IR::Operand::IMMEDIATE)
+                return unboxed_immediate(op);
+            if (op.type != IR::Operand::VIRT_REG || unboxed[op.index])
+                return op;
+            if (!unboxed_copies.contains(op.index)) {
+                IR::Operand out = new_reg(true);
+                new_ins.push_back({IR::Operation::UNBOX_INT, out, {op}});
+                unboxed_copies[op.index] = out;
+            }
+            return unboxed_copies[op.index];
+        };
+
+        // inputs of untagged phis are untagged registers or int immediates
+        for (auto& pn : block.phi_nodes)
+            if (unboxed[pn.out.index])
+                for (auto& arg : pn.args)
+                    arg.second = unbox(arg.second);
+
+        for (auto ins : block.instructions) {
+            bool convert = false;
+            switch (ins.op) {
+                case IR::Operation::ADD_INT:
+                case IR::Operation::SUB:
+                case IR::Operation::MUL:
+                case IR::Operation::DIV:
+                    convert = true;
+                    break;
+                case IR::Operation::GT:
+                case IR::Operation::GEQ:
+                case IR::Operation::EQ_INT:
+                    // EQ_INT compares whole words, which works for two untagged ints as well
+                    convert = is_unboxed(ins.args[0]) || is_unboxed(ins.args[1]);
+                    break;
+                case IR::Operation::MOV:
+                    convert = is_unboxed(ins.out);
+                    break;
+                case IR::Operation::ASSERT_INT:
+                case IR::Operation::ASSERT_NONZERO:
+                case IR::Operation::GUARD_INT:
+                    // untagged values are ints, and DIV_UNBOXED checks its divisor itself
+                    if (is_unboxed(ins.args[0]))
+                        continue;
+                    break;
+                default:
+                    break;
+            }
+            if (convert) {
+                ins.op = unboxed_op(ins.op);
+                for (auto& arg : ins.args)
+                    arg = unbox(arg);
+            } else {
+                // everything else sees tagged values, these are the stores, calls, returns and other escapes
+                for (auto& arg : ins.args)
+                    if (is_unboxed(arg))
+                        arg = box(arg);
+            }
+            new_ins.push_back(ins);
+        }
+
+        // tag the inputs of tagged phis in the successors before the block ends
+        std::optional<IR::Instruction> terminator;
+        if (!new_ins.empty() && (new_ins.back().op == IR::Operation::BRANCH || new_ins.back().op == IR::Operation::RETURN)) {
+            terminator = new_ins.back();
+            new_ins.pop_back();
+        }
+        for (int succ : block.successors)
+            for (auto& pn : fun.blocks[succ].phi_nodes)
+                if (!unboxed[pn.out.index])
+                    for (auto& arg : pn.args)
+                        if (arg.first == (int) j && is_unboxed(arg.second))
+                            arg.second = box(arg.second);
+        if (terminator)
+            new_ins.push_back(*terminator);
+        block.instructions = new_ins;
+    }
+
+    for (auto& state : fun.deopt_states) {
+        state.unboxed_values.clear();
+        for (const auto& value : state.values)
+            state.unboxed_values.push_back(is_unboxed(value.second));
+        for (size_t k = 0; k < state.operands.size(); k++)
+            state.unboxed_operands[k] = is_unboxed(state.operands[k]);
+    }
+}
+
+IR::Program* Unboxer::optimize() {
+    for (size_t i = 0; i < prog_->functions.size(); i++)
+        if (prog_->optimizes(i))
+            unbox_function(prog_->functions[i]);
+    return prog_;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "value.h"
+#include "ir.h"
+#include <map>
+
+class Unboxer {
+private:
+    IR::Program* prog_;
+    // immediates already added in untagged form, by int value
+    std::map<int32_t, int> unboxed_immediates_;
+public:
+    Unboxer(IR::Program* prog);
+    // runs last, keeps the results of int arithmetic untagged and tags them only where they escape
+    IR::Program* optimize();
+
+    bool is_int(const IR::Operand& op, const std::vector<bool>& unboxed);
+    IR::Operand unboxed_immediate(const IR::Operand& op);
+    void unbox_function(IR::Function& fun);
+};
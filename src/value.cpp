@@ -6,6 +6,7 @@
 #include <vector>
 #include <algorithm>
 #include <iostream>
+#include <bit>
 
 #include "value.h"
 
@@ -49,7 +50,16 @@ Value to_value(bool b) {
 }
 
 Value to_value(int32_t i) {
-    return (static_cast<uint64_t>(i) << 4) | static_cast<uint64_t>(ValueType::Int);
+    // zero extended like the ints computed by generated code, so equal ints compare equal bitwise
+    return (static_cast<uint64_t>(static_cast<uint32_t>(i)) << 4) | static_cast<uint64_t>(ValueType::Int);
+}
+
+Value to_unboxed(int32_t i) {
+    return static_cast<uint64_t>(static_cast<uint32_t>(i)) << UNBOXED_SHIFT;
+}
+
+Value unboxed_to_value(Value val) {
+    return to_value(static_cast<int32_t>(val >> UNBOXED_SHIFT));
 }
 
 Value to_value(ProgramContext* rt, const std::string& str) {
@@ -89,27 +99,17 @@ Value to_value(Closure* closure) {
     return reinterpret_cast<uint64_t>(closure) | static_cast<uint64_t>(ValueType::Closure);
 }
 
-Value value_add_nonint(ProgramContext* rt, Value lhs, Value rhs) {
-    lhs = value_to_string(rt, lhs);
-    rhs = value_to_string(rt, rhs);
-    ValueType lhs_kind = value_get_type(lhs);
-    ValueType rhs_kind = value_get_type(rhs);
-    size_t lhs_size{0};
-    size_t rhs_size{0};
-    if (lhs_kind == ValueType::InlineString) {
-        lhs_size = (lhs >> 4) & 0b1111;
-    } else if (lhs_kind == ValueType::HeapString) {
-        lhs_size = value_get_string_ptr(lhs)->len;
-    } else {
-        assert(false);
-    }
-    if (rhs_kind == ValueType::InlineString) {
-        rhs_size = (rhs >> 4) & 0b1111;
-    } else if (rhs_kind == ValueType::HeapString) {
-        rhs_size = value_get_string_ptr(rhs)->len;
-    } else {
-        assert(false);
+static auto string_length(Value str) -> size_t {
+    if (value_get_type(str) == ValueType::InlineString) {
+        return (str >> 4) & 0b1111;
     }
+    assert(value_get_type(str) == ValueType::HeapString);
+    return value_get_string_ptr(str)->len;
+}
+
+static auto string_concat_flat(ProgramContext* rt, Value lhs, Value rhs) -> Value {
+    size_t lhs_size = string_length(lhs);
+    size_t rhs_size = string_length(rhs);
     size_t total_size = lhs_size + rhs_size;
     // allocate new inline string
     if (total_size < 8) {
@@ -125,22 +125,51 @@ Value value_add_nonint(ProgramContext* rt, Value lhs, Value rhs) {
         std::memcpy(reinterpret_cast<char*>(&out) + lhs_size + 1, reinterpret_cast<char*>(&src) + 1, rhs_size);
 
         return out;
-    } else {
-        String* str = rt->alloc_string(total_size);
-        if (lhs_kind == ValueType::InlineString) {
-            Value src = lhs;
-            std::memcpy(&str->data, reinterpret_cast<char*>(&src) + 1, lhs_size);
-        } else {  // lhs_kind == ValueKind::HeapString
-            std::memcpy(&str->data, &value_get_string_ptr(lhs)->data, lhs_size);
-        }
-        if (rhs_kind == ValueType::InlineString) {
-            Value src = rhs;
-            std::memcpy(reinterpret_cast<char*>(&str->data) + lhs_size, reinterpret_cast<char*>(&src) + 1, rhs_size);
-        } else {  // rhs_kind == ValueKind::HeapString
-            std::memcpy(reinterpret_cast<char*>(&str->data) + lhs_size, &value_get_string_ptr(rhs)->data, rhs_size);
+    }
+    String* str = rt->alloc_string(total_size);
+    string_write(lhs, str->data);
+    string_write(rhs, str->data + lhs_size);
+    return to_value(str);
+}
+
+// defers the copy, which makes repeated appends linear
+static auto string_concat_rope(ProgramContext* rt, Value lhs, Value rhs) -> Value {
+    size_t total_size = string_length(lhs) + string_length(rhs);
+    // short appends are merged into the last part of a rope, so that the rope nodes do not outweigh
+    // the characters
+    if (value_get_type(lhs) == ValueType::HeapString && value_get_string_ptr(lhs)->rope_depth != 0
+        && string_length(rhs) < ROPE_MIN_LENGTH) {
+        Value* lhs_parts = string_rope_parts(value_get_string_ptr(lhs));
+        Value last = lhs_parts[1];
+        bool last_flat = value_get_type(last) == ValueType::InlineString
+            || value_get_string_ptr(last)->rope_depth == 0;
+        if (last_flat && string_length(last) + string_length(rhs) <= ROPE_LEAF_LENGTH) {
+            rhs = string_concat_flat(rt, last, rhs);
+            lhs = lhs_parts[0];
         }
-        return to_value(str);
     }
+    uint16_t lhs_depth = value_get_type(lhs) == ValueType::HeapString ? value_get_string_ptr(lhs)->rope_depth : 0;
+    uint16_t rhs_depth = value_get_type(rhs) == ValueType::HeapString ? value_get_string_ptr(rhs)->rope_depth : 0;
+    if (rhs_depth >= ROPE_MAX_DEPTH) {
+        rhs = string_flatten(rt, rhs);
+        rhs_depth = 0;
+    }
+    String* rope = rt->alloc_string(2 * sizeof(Value));
+    rope->len = total_size;
+    rope->rope_depth = std::max<uint16_t>(lhs_depth, rhs_depth + 1);
+    string_rope_parts(rope)[0] = lhs;
+    string_rope_parts(rope)[1] = rhs;
+    return to_value(rope);
+}
+
+Value value_add_nonint(ProgramContext* rt, Value lhs, Value rhs) {
+    lhs = value_to_string(rt, lhs);
+    rhs = value_to_string(rt, rhs);
+    // constants stay flat, as static objects are not traced
+    if (string_length(lhs) + string_length(rhs) >= ROPE_MIN_LENGTH && rt->current_region != STATIC_REGION) {
+        return string_concat_rope(rt, lhs, rhs);
+    }
+    return string_concat_flat(rt, lhs, rhs);
 }
 
 Value value_add(ProgramContext* rt, Value lhs, Value rhs) {
@@ -192,16 +221,21 @@ auto value_eq_bool(Value lhs, Value rhs) -> bool {
     if (type == ValueType::HeapString) {
         auto lhs_str = value_get_string_ptr(lhs);
         auto rhs_str = value_get_string_ptr(rhs);
+        // distinct interned strings always differ
+        if (lhs_str->interned && rhs_str->interned) {
+            return false;
+        }
         size_t len = lhs_str->len;
         if (rhs_str->len != len) {
             return false;
         }
-        for (size_t i = 0; i < len; ++i) {
-            if (lhs_str->data[i] != rhs_str->data[i]) {
-                return false;
-            }
+        if (lhs_str->hash != 0 && rhs_str->hash != 0 && lhs_str->hash != rhs_str->hash) {
+            return false;
         }
-        return true;
+        if (lhs_str->rope_depth != 0 || rhs_str->rope_depth != 0) {
+            return value_get_std_string(nullptr, lhs) == value_get_std_string(nullptr, rhs);
+        }
+        return std::memcmp(lhs_str->data, rhs_str->data, len) == 0;
     }
     return false;
 }
@@ -290,8 +324,17 @@ auto value_get_std_string(ProgramContext* ctx, Value val) -> std::string {
         Record* record = value_get_record(val);
         std::string out{"{"};
         std::vector<std::pair<Value, Value>> entries;
-        if (record->dynamic_fields != nullptr) {
-            entries.insert(entries.end(), record->dynamic_fields->begin(), record->dynamic_fields->end());
+        if (FieldTable* table = record->dynamic_fields) {
+            for (size_t i = 0; i < table->capacity; ++i) {
+                if (table->entries[2 * i] != 0) {
+                    entries.emplace_back(table->entries[2 * i], table->entries[2 * i + 1]);
+                }
+            }
+        }
+        if (DenseArray* array = record->elements) {
+            for (size_t i = 0; i < array->size; ++i) {
+                entries.emplace_back(value_to_string(ctx, to_value((int32_t)i)), array->data[i]);
+            }
         }
         const std::vector<Value>& layout = ctx->layouts[record->layout_index];
         for (int i = 0; i < record->static_field_count; ++i) {
@@ -322,6 +365,11 @@ auto value_get_std_string(ProgramContext* ctx, Value val) -> std::string {
     }
     if (type == ValueType::HeapString) {
         String* str = value_get_string_ptr(val);
+        if (str->rope_depth != 0) {
+            std::string out(str->len, '\0');
+            string_write(val, out.data());
+            return out;
+        }
         return {str->data, str->len};
     }
     if (type == ValueType::Reference) {
@@ -330,20 +378,74 @@ auto value_get_std_string(ProgramContext* ctx, Value val) -> std::string {
     return "<< INVALID >>";
 }
 
-Value extern_alloc_ref(ProgramContext* rt) {
-    return to_value(rt->alloc_ref());
+// copy the characters of a flat string or rope to dst
+void string_write(Value str, char* dst) {
+    // ropes can be deep, so their parts are visited with an explicit stack
+    std::vector<Value> pending{str};
+    while (!pending.empty()) {
+        Value part = pending.back();
+        pending.pop_back();
+        if (value_get_type(part) == ValueType::InlineString) {
+            size_t len = (part >> 4) & 0b1111;
+            Value data = part >> 8;
+            std::memcpy(dst, &data, len);
+            dst += len;
+            continue;
+        }
+        String* part_str = value_get_string_ptr(part);
+        if (part_str->rope_depth == 0) {
+            std::memcpy(dst, part_str->data, part_str->len);
+            dst += part_str->len;
+        } else {
+            pending.push_back(string_rope_parts(part_str)[1]);
+            pending.push_back(string_rope_parts(part_str)[0]);
+        }
+    }
 }
 
-Value extern_alloc_string(ProgramContext* rt, size_t length) {
-    return to_value(rt->alloc_string(length));
+// flat string with the same characters as str. A rope is turned into a single flat part, so later
+// calls return that copy
+auto string_flatten(ProgramContext* ctx, Value str) -> Value {
+    if (value_get_type(str) != ValueType::HeapString) {
+        return str;
+    }
+    String* rope = value_get_string_ptr(str);
+    if (rope->rope_depth == 0) {
+        return str;
+    }
+    Value* parts = string_rope_parts(rope);
+    if (parts[1] == INLINE_STRING_TAG && value_get_type(parts[0]) == ValueType::HeapString
+        && value_get_string_ptr(parts[0])->rope_depth == 0) {
+        return parts[0];
+    }
+    String* flat = ctx->alloc_string(rope->len);
+    string_write(str, flat->data);
+    flat->hash = rope->hash;
+    Value flat_value = to_value(flat);
+    ctx->write_barrier(str, flat_value);
+    parts[0] = flat_value;
+    // empty inline string
+    parts[1] = INLINE_STRING_TAG;
+    rope->rope_depth = 1;
+    return flat_value;
 }
 
-Value extern_alloc_record(ProgramContext* rt, size_t num_static, size_t layout_index) {
-    return to_value(rt->alloc_record(num_static, layout_index));
+Value extern_eq(ProgramContext* ctx, Value lhs, Value rhs) {
+    // ropes of equal length are flattened, so comparing them again is a plain memcmp
+    if (value_get_type(lhs) == ValueType::HeapString && value_get_type(rhs) == ValueType::HeapString
+        && value_get_string_ptr(lhs)->len == value_get_string_ptr(rhs)->len) {
+        lhs = string_flatten(ctx, lhs);
+        rhs = string_flatten(ctx, rhs);
+    }
+    return value_eq(lhs, rhs);
 }
 
-Value extern_alloc_closure(ProgramContext* rt, size_t num_free) {
-    return to_value(rt->alloc_closure(num_free));
+Value extern_alloc_string(ProgramContext* rt, size_t length) {
+    return to_value(rt->alloc_string(length));
+}
+
+auto extern_alloc_traced(ProgramContext* rt, size_t data_size) -> HeapObject* {
+    return rt->alloc_traced(data_size);
 }
 
 void extern_print(ProgramContext* rt, Value val) {
@@ -368,80 +470,132 @@ auto extern_input(ProgramContext* rt) -> Value {
 }
 
 auto extern_rec_load_name(ProgramContext* ctx, Value rec, Value name) -> Value {
+    Record* rec_ptr = value_get_record(rec);
+    // the static fields were already searched by the generated code
+    return record_load_dynamic(rec_ptr, name);
+}
+
+auto extern_rec_load_name_cached(ProgramContext* ctx, Value rec, Value name, InlineCache* cache) -> Value {
     Record* rec_ptr = value_get_record(rec);
     uint32_t static_field_count = rec_ptr->static_field_count;
     const auto& layout = ctx->layouts[rec_ptr->layout_index];
-    // can start at 4 because 0 through 3 are checked in assembly
-    for (int i = 4; i < static_field_count; ++i) {
+    cache->misses += 1;
+    for (int i = 0; i < static_field_count; ++i) {
         if (name == layout[i]) {
+            cache->add(rec_ptr->layout, i);
             return rec_ptr->static_fields[i];
         }
-//        if (value_eq_bool(name, layout[i])) {
-//            return rec_ptr->static_fields[i];
-//        }
-    }
-    if (rec_ptr->dynamic_fields != nullptr) {
-        auto iter = rec_ptr->dynamic_fields->find(name);
-        if (iter != rec_ptr->dynamic_fields->end()) {
-            return iter->second;
-        }
     }
-    return 0;
+    return record_load_dynamic(rec_ptr, name);
 }
 
 void extern_rec_store_name(ProgramContext* ctx, Value rec, Value name, Value val) {
+    extern_rec_store_name_cached(ctx, rec, name, val, nullptr);
+}
+
+void extern_rec_store_name_cached(ProgramContext* ctx, Value rec, Value name, Value val, InlineCache* cache) {
     Record* rec_ptr = value_get_record(rec);
     uint32_t static_field_count = rec_ptr->static_field_count;
     const auto& layout = ctx->layouts[rec_ptr->layout_index];
+    ctx->write_barrier(rec, val);
+    if (cache != nullptr) {
+        cache->misses += 1;
+    }
     for (int i = 0; i < static_field_count; ++i) {
-        if (value_eq_bool(name, layout[i])) {
+        if (name == layout[i]) {
             rec_ptr->static_fields[i] = val;
+            if (cache != nullptr) {
+                cache->add(rec_ptr->layout, i);
+            }
             return;
         }
     }
-    if (rec_ptr->dynamic_fields == nullptr) {
-        rec_ptr->init_map(ctx);
+    // a new name moves the record to the child layout while there is room for another field. Names
+    // are canonical constants here, which the generated layout comparison relies on
+    bool is_dynamic = rec_ptr->dynamic_fields != nullptr && rec_ptr->dynamic_fields->find(name) != nullptr;
+    if (static_field_count < rec_ptr->capacity && !is_dynamic) {
+        uint32_t child = ctx->layout_transition(rec_ptr->layout_index, name);
+        if (cache != nullptr) {
+            cache->add(rec_ptr->layout, static_field_count, ctx->layout_tables[child], child);
+        }
+        rec_ptr->layout = ctx->layout_tables[child];
+        rec_ptr->layout_index = child;
+        rec_ptr->static_fields[static_field_count] = val;
+        rec_ptr->static_field_count = static_field_count + 1;
+        return;
+    }
+    // out of room, later records from the same site get enough for this field once their code is recompiled
+    if (!is_dynamic && static_field_count < MAX_RECORD_CAPACITY) {
+        if (ctx->alloc_site_fields.size() <= rec_ptr->alloc_site) {
+            ctx->alloc_site_fields.resize(rec_ptr->alloc_site + 1, 0);
+        }
+        uint32_t& wanted = ctx->alloc_site_fields[rec_ptr->alloc_site];
+        wanted = std::max(wanted, static_field_count + 1);
     }
-    rec_ptr->dynamic_fields->operator[](name) = val;
+    record_store_dynamic(ctx, rec, name, val);
 }
 
 auto extern_rec_load_index(ProgramContext* ctx, Value rec, Value index_val) -> Value {
     Record* rec_ptr = value_get_record(rec);
-    Value name = value_to_string(ctx, index_val);
+    int64_t dense_index = value_to_dense_index(index_val);
+    if (dense_index >= 0 && rec_ptr->elements != nullptr && dense_index < (int64_t)rec_ptr->elements->size) {
+        return rec_ptr->elements->data[dense_index];
+    }
+    // every field name is interned, so a string which is not can not name a field
+    Value name = ctx->find_interned(value_to_string(ctx, index_val));
+    if (name == 0) {
+        return 0;
+    }
     uint32_t static_field_count = rec_ptr->static_field_count;
     const auto& layout = ctx->layouts[rec_ptr->layout_index];
     for (int i = 0; i < static_field_count; ++i) {
-        if (value_eq_bool(name, layout[i])) {
+        if (name == layout[i]) {
             return rec_ptr->static_fields[i];
         }
     }
-    if (rec_ptr->dynamic_fields != nullptr) {
-        auto iter = rec_ptr->dynamic_fields->find(name);
-        if (iter != rec_ptr->dynamic_fields->end()) {
-            return iter->second;
-        }
-    }
-    return 0;
+    return record_load_dynamic(rec_ptr, name);
 }
 
 void extern_rec_store_index(ProgramContext* ctx, Value rec, Value index_val, Value val) {
     Record* rec_ptr = value_get_record(rec);
-    Value name = value_to_string(ctx, index_val);
+    ctx->write_barrier(rec, val);
+    int64_t dense_index = value_to_dense_index(index_val);
+    int64_t dense_size = rec_ptr->elements == nullptr ? 0 : (int64_t)rec_ptr->elements->size;
+    if (dense_index >= 0 && dense_index < dense_size) {
+        rec_ptr->elements->data[dense_index] = val;
+        return;
+    }
+    Value name = ctx->intern(value_to_string(ctx, index_val));
+    // the key may only move into the array if it is not in the field table already
+    if (dense_index == dense_size
+        && (rec_ptr->dynamic_fields == nullptr || rec_ptr->dynamic_fields->find(name) == nullptr)) {
+        record_append_dense(ctx, rec, val);
+        return;
+    }
     uint32_t static_field_count = rec_ptr->static_field_count;
     const auto& layout = ctx->layouts[rec_ptr->layout_index];
     for (int i = 0; i < static_field_count; ++i) {
-        if (value_eq_bool(name, layout[i])) {
+        if (name == layout[i]) {
             rec_ptr->static_fields[i] = val;
             return;
         }
     }
-    if (rec_ptr->dynamic_fields == nullptr) {
-        rec_ptr->init_map(ctx);
-    }
-    rec_ptr->dynamic_fields->operator[](name) = val;
+    record_store_dynamic(ctx, rec, name, val);
 }
 
 ProgramContext::ProgramContext(size_t heap_size) {
+    // the nursery is carved out of the heap budget: largest power of two below an eighth of it
+    this->nursery_size = MIN_NURSERY_SIZE;
+    while (2 * this->nursery_size <= std::min(heap_size / 8, MAX_NURSERY_SIZE)) {
+        this->nursery_size *= 2;
+    }
+    heap_size -= this->nursery_size;
+    this->nursery = static_cast<char*>(std::aligned_alloc(nursery_size, nursery_size));
+    this->nursery_end = this->nursery + this->nursery_size;
+    this->nursery_shift = std::countr_zero(this->nursery_size);
+    this->nursery_page = reinterpret_cast<uint64_t>(this->nursery) >> this->nursery_shift;
+    this->reset_nursery();
+
     // align heap size
     heap_size &= ~0b1111;
     this->heap = static_cast<char*>(malloc(heap_size + 8));
@@ -465,17 +619,29 @@ auto ProgramContext::alloc_string(size_t length) -> String* {
     HeapObject* obj = this->alloc_traced(sizeof(String) + length);
     auto* str = reinterpret_cast<String*>(&obj->data);
     str->len = length;
+    str->interned = 0;
+    str->rope_depth = 0;
+    str->hash = 0;
     return str;
 }
 
-auto ProgramContext::alloc_record(uint32_t num_static, uint32_t layout) -> Record* {
-    HeapObject* obj = this->alloc_traced(sizeof(Record) + sizeof(Value) * num_static);
+auto ProgramContext::record_site_capacity(uint32_t num_static, uint32_t alloc_site) const -> uint32_t {
+    uint32_t wanted = alloc_site < alloc_site_fields.size() ? alloc_site_fields[alloc_site] : 0;
+    return record_capacity(std::max(num_static, wanted));
+}
+
+auto ProgramContext::alloc_record(uint32_t num_static, uint32_t layout, uint32_t capacity, uint32_t alloc_site)
+    -> Record* {
+    HeapObject* obj = this->alloc_traced(sizeof(Record) + sizeof(Value) * capacity);
     auto* rec = reinterpret_cast<Record*>(&obj->data);
-    rec->layout_offset = layout_offsets[layout]; // TODO check
+    rec->layout = layout_tables[layout];
     rec->layout_index = layout;
     rec->static_field_count = num_static;
     rec->dynamic_fields = nullptr;
-    for (int i = 0; i < num_static; ++i) {
+    rec->elements = nullptr;
+    rec->capacity = capacity;
+    rec->alloc_site = alloc_site;
+    for (int i = 0; i < capacity; ++i) {
         rec->static_fields[i] = 0;
     }
     return rec;
@@ -488,15 +654,82 @@ auto ProgramContext::alloc_closure(size_t num_free) -> Closure* {
     return closure;
 }
 
+auto ProgramContext::alloc_field_table(size_t capacity) -> FieldTable* {
+    HeapObject* obj = this->alloc_traced(sizeof(FieldTable) + 2 * sizeof(Value) * capacity);
+    auto* table = reinterpret_cast<FieldTable*>(&obj->data);
+    table->capacity = capacity;
+    table->size = 0;
+    std::memset(&table->entries, 0, 2 * sizeof(Value) * capacity);
+    return table;
+}
+
+auto ProgramContext::alloc_dense_array(size_t capacity) -> DenseArray* {
+    HeapObject* obj = this->alloc_traced(sizeof(DenseArray) + sizeof(Value) * capacity);
+    auto* array = reinterpret_cast<DenseArray*>(&obj->data);
+    array->capacity = capacity;
+    array->size = 0;
+    return array;
+}
+
 auto ProgramContext::alloc_traced(size_t data_size) -> HeapObject* {
     size_t allocation_size = sizeof(HeapObject) + data_size;
-    HeapObject* ptr;
-    ptr = static_cast<HeapObject*>(alloc_raw(allocation_size));
-    ptr->region = current_region;
+    HeapObject* ptr{nullptr};
+    if (this->current_region != STATIC_REGION && !this->collecting) {
+        ptr = static_cast<HeapObject*>(alloc_young(allocation_size));
+    }
+    if (ptr != nullptr) {
+        ptr->region = NURSERY_REGION;
+    } else {
+        ptr = static_cast<HeapObject*>(alloc_raw(allocation_size));
+        ptr->region = current_region;
+        if (this->current_region != STATIC_REGION && !this->collecting) {
+            // nursery is full, make sure the next safepoint collects
+            this->nursery_limit = this->nursery;
+        }
+    }
+    ptr->remembered = 0;
+    return ptr;
+}
+
+auto ProgramContext::alloc_young(size_t num_bytes) -> void* {
+    size_t aligned_size = ((num_bytes - 1) | 0b1111) + 1;
+    if (aligned_size > static_cast<size_t>(this->nursery_end - this->nursery_head)) {
+        return nullptr;
+    }
+    void* ptr = this->nursery_head;
+    this->nursery_head += aligned_size;
     return ptr;
 }
 
+auto ProgramContext::in_nursery(Value val) const -> bool {
+    return is_heap_type(value_get_type(val)) && (val >> this->nursery_shift) == this->nursery_page;
+}
+
+auto ProgramContext::in_nursery(const void* ptr) const -> bool {
+    return (reinterpret_cast<uint64_t>(ptr) >> this->nursery_shift) == this->nursery_page;
+}
+
+void ProgramContext::write_barrier(Value target, Value val) {
+    if (in_nursery(val) && !in_nursery(target)) {
+        remember(target);
+    }
+}
+
+void ProgramContext::remember(Value target) {
+    auto* heap_obj = reinterpret_cast<HeapObject*>((target & DATA_MASK) - sizeof(HeapObject));
+    if (heap_obj->remembered == 0) {
+        heap_obj->remembered = 1;
+        this->remembered.push_back(target);
+    }
+}
+
+void ProgramContext::reset_nursery() {
+    this->nursery_head = this->nursery;
+    this->nursery_limit = this->nursery_end - this->nursery_size / 8;
+}
+
 ProgramContext::~ProgramContext() {
+    std::free(this->nursery);
     std::free(this->heap);
     std::free(this->globals);
     for (void* ptr : this->static_allocations) {
@@ -541,8 +774,129 @@ void ProgramContext::reset_globals() {
     }
 }
 
-void ProgramContext::init_layouts(std::vector<std::vector<Value>> field_layouts) {
-    this->layouts = std::move(field_layouts);
+// insert a string which is known to not be present yet
+static void intern_insert(std::vector<Value>& table, Value str) {
+    uint64_t mask = table.size() - 1;
+    uint64_t i = value_hash(str) & mask;
+    while (table[i] != 0) {
+        i = (i + 1) & mask;
+    }
+    table[i] = str;
+}
+
+auto ProgramContext::intern(Value str) -> Value {
+    if (value_get_type(str) != ValueType::HeapString) {
+        return str;
+    }
+    str = string_flatten(this, str);
+    if (Value existing = find_interned(str)) {
+        return existing;
+    }
+    // keep load factor at or below 1/2
+    if (2 * (this->interned_count + 1) > this->interned_strings.size()) {
+        std::vector<Value> old_strings = std::move(this->interned_strings);
+        this->interned_strings.assign(std::max<size_t>(2 * old_strings.size(), 64), 0);
+        for (Value old_str : old_strings) {
+            if (old_str != 0) {
+                intern_insert(this->interned_strings, old_str);
+            }
+        }
+    }
+    intern_insert(this->interned_strings, str);
+    this->interned_count += 1;
+    value_get_string_ptr(str)->interned = 1;
+    if (in_nursery(str)) {
+        this->young_interned = true;
+    }
+    return str;
+}
+
+// canonical string equal to str, or 0 if there is none
+auto ProgramContext::find_interned(Value str) -> Value {
+    if (value_get_type(str) != ValueType::HeapString) {
+        return str;
+    }
+    if (value_get_string_ptr(str)->interned) {
+        return str;
+    }
+    if (this->interned_count == 0) {
+        return 0;
+    }
+    str = string_flatten(this, str);
+    uint64_t mask = this->interned_strings.size() - 1;
+    for (uint64_t i = value_hash(str) & mask;; i = (i + 1) & mask) {
+        Value current = this->interned_strings[i];
+        if (current == 0) {
+            return 0;
+        }
+        if (value_eq_bool(current, str)) {
+            return current;
+        }
+    }
+}
+
+// called after tracing, drops the strings which did not survive and updates the moved ones
+void ProgramContext::sweep_interned(bool major) {
+    std::vector<Value> survivors;
+    survivors.reserve(this->interned_count);
+    for (Value str : this->interned_strings) {
+        if (str == 0) {
+            continue;
+        }
+        auto* heap_obj = reinterpret_cast<HeapObject*>((str & DATA_MASK) - sizeof(HeapObject));
+        if (major) {
+            if (heap_obj->region == this->current_region) {
+                survivors.push_back(heap_obj->data[0]);
+            } else if (heap_obj->region == STATIC_REGION) {
+                survivors.push_back(str);
+            }
+        } else {
+            if (heap_obj->region == FORWARDED_REGION) {
+                survivors.push_back(heap_obj->data[0]);
+            } else if (!in_nursery(str)) {
+                survivors.push_back(str);
+            }
+        }
+    }
+    // hashes are kept when strings move, so the survivors can simply be reinserted
+    std::fill(this->interned_strings.begin(), this->interned_strings.end(), 0);
+    for (Value str : survivors) {
+        intern_insert(this->interned_strings, str);
+    }
+    this->interned_count = survivors.size();
+    this->young_interned = false;
+}
+
+void ProgramContext::init_layouts(const std::vector<std::vector<Value>>& field_layouts) {
+    for (const auto& fields : field_layouts) {
+        add_layout(fields);
+    }
+}
+
+auto ProgramContext::add_layout(std::vector<Value> fields) -> uint32_t {
+    size_t table_size =
+        std::max<size_t>((fields.size() + LAYOUT_TABLE_CHUNK - 1) / LAYOUT_TABLE_CHUNK, 1) * LAYOUT_TABLE_CHUNK;
+    // one extra chunk in front for the size, so the fields stay aligned
+    auto* alloc = static_cast<Value*>(
+        std::aligned_alloc(sizeof(Value) * LAYOUT_TABLE_CHUNK, sizeof(Value) * (table_size + LAYOUT_TABLE_CHUNK)));
+    Value* table = alloc + LAYOUT_TABLE_CHUNK;
+    std::fill(table, table + table_size, 0);
+    std::copy(fields.begin(), fields.end(), table);
+    table[-1] = sizeof(Value) * table_size;
+    this->static_allocations.push_back(alloc);
+    this->layout_tables.push_back(table);
+    this->layouts.push_back(std::move(fields));
+    return this->layouts.size() - 1;
+}
+
+auto ProgramContext::layout_transition(uint32_t layout, Value name) -> uint32_t {
+    auto [iter, inserted] = this->layout_transitions.try_emplace({layout, name}, 0);
+    if (inserted) {
+        std::vector<Value> fields = this->layouts[layout];
+        fields.push_back(name);
+        iter->second = add_layout(std::move(fields));
+    }
+    return iter->second;
 }
 
 auto ProgramContext::alloc_raw(size_t num_bytes) -> void* {
@@ -553,6 +907,11 @@ auto ProgramContext::alloc_raw(size_t num_bytes) -> void* {
     } else {
         size_t aligned_size = ((num_bytes - 1) | 0b1111) + 1;
         current_alloc += aligned_size;
+        if (!this->collecting
+            && current_alloc + (this->nursery_head - this->nursery) >= this->region_size) {
+            // old space is filling up outside of the nursery, make the next safepoint collect
+            this->nursery_limit = this->nursery;
+        }
         if (this->current_region == 0) {
             ptr = reinterpret_cast<HeapObject*>(write_head);
             write_head += aligned_size;
@@ -572,18 +931,58 @@ auto ProgramContext::alloc_raw(size_t num_bytes) -> void* {
     return ptr;
 }
 
-void trace_collect(ProgramContext* ctx, const uint64_t* rbp, uint64_t* rsp) {
-    ctx->switch_region();
-    // base rbp is pointing two slots above saved rsp on stack
-    auto* base_rsp = reinterpret_cast<uint64_t*>(ctx->saved_rsp);
-    while (rsp != base_rsp) {
-        while (rsp != rbp) {
-            trace_value(ctx, rsp);
-            rsp += 1;
+void extern_remember(ProgramContext* ctx, Value target) {
+    ctx->remember(target);
+}
+
+void trace_collect(ProgramContext* ctx, uint64_t* rbp, uint64_t return_address) {
+    // a full collection is needed once promoting the entire nursery could overflow the old region
+    size_t young_size = ctx->nursery_head - ctx->nursery;
+    if (ctx->current_alloc + young_size >= ctx->region_size) {
+        collect_major(ctx, rbp, return_address);
+    } else {
+        collect_minor(ctx, rbp, return_address);
+    }
+}
+
+void trace_stack(ProgramContext* ctx, uint64_t* rbp, uint64_t return_address, void (*trace)(ProgramContext*, Value*)) {
+    // the outermost frame is the one called from the prelude, its rbp sits two slots below saved rsp
+    auto* base_rbp = reinterpret_cast<uint64_t*>(ctx->saved_rsp) - 2;
+    while (true) {
+        for (int32_t offset : ctx->stack_maps.at(return_address)) {
+            trace(ctx, rbp + offset);
         }
-        rbp = reinterpret_cast<uint64_t*>(*rsp);
-        rsp += 2;
+        if (rbp == base_rbp) {
+            break;
+        }
+        return_address = rbp[1];
+        rbp = reinterpret_cast<uint64_t*>(rbp[0]);
+    }
+}
+
+void collect_minor(ProgramContext* ctx, uint64_t* rbp, uint64_t return_address) {
+    ctx->collecting = true;
+    trace_stack(ctx, rbp, return_address, trace_young);
+    for (int i = 0; i < ctx->globals_size; ++i) {
+        trace_young(ctx, ctx->globals + i);
+    }
+    for (Value obj : ctx->remembered) {
+        auto* heap_obj = reinterpret_cast<HeapObject*>((obj & DATA_MASK) - sizeof(HeapObject));
+        heap_obj->remembered = 0;
+        trace_young_fields(ctx, obj);
     }
+    ctx->remembered.clear();
+    if (ctx->young_interned) {
+        ctx->sweep_interned(false);
+    }
+    ctx->reset_nursery();
+    ctx->collecting = false;
+}
+
+void collect_major(ProgramContext* ctx, uint64_t* rbp, uint64_t return_address) {
+    ctx->switch_region();
+    ctx->collecting = true;
+    trace_stack(ctx, rbp, return_address, trace_value);
     for (int i = 0; i < ctx->globals_size; ++i) {
         trace_value(ctx, ctx->globals + i);
     }
@@ -592,6 +991,111 @@ void trace_collect(ProgramContext* ctx, const uint64_t* rbp, uint64_t* rsp) {
     } else {
         ctx->prev_end = ctx->heap + 8;
     }
+    // every survivor now lives in the old space, so there are no old-to-young pointers left
+    ctx->remembered.clear();
+    ctx->sweep_interned(true);
+    ctx->reset_nursery();
+    ctx->collecting = false;
+}
+
+void trace_young(ProgramContext* ctx, Value* ptr) {
+    Value val = *ptr;
+    if (!ctx->in_nursery(val)) {
+        return;
+    }
+    auto* heap_obj = reinterpret_cast<HeapObject*>((val & DATA_MASK) - sizeof(HeapObject));
+    if (heap_obj->region == FORWARDED_REGION) {
+        *ptr = heap_obj->data[0];
+        return;
+    }
+    Value new_value = promote_young(ctx, val);
+    *ptr = new_value;
+    trace_young_fields(ctx, new_value);
+}
+
+// copy a young object into the old space and leave a forward behind, without tracing its fields
+auto promote_young(ProgramContext* ctx, Value val) -> Value {
+    auto* heap_obj = reinterpret_cast<HeapObject*>((val & DATA_MASK) - sizeof(HeapObject));
+    size_t data_size{0};
+    auto type = value_get_type(val);
+    if (type == ValueType::Reference) {
+        data_size = sizeof(Value);
+    } else if (type == ValueType::HeapString) {
+        String* str = value_get_string_ptr(val);
+        data_size = sizeof(String) + (str->rope_depth == 0 ? str->len : 2 * sizeof(Value));
+    } else if (type == ValueType::Record) {
+        data_size = sizeof(Record) + sizeof(Value) * value_get_record(val)->capacity;
+    } else if (type == ValueType::Closure) {
+        data_size = sizeof(Closure) + sizeof(Value) * value_get_closure(val)->n_free_vars;
+    } else {
+        assert(false);
+    }
+    // promote into the old space, a young field table is promoted along with its record below
+    HeapObject* new_obj = ctx->alloc_traced(data_size);
+    std::memcpy(&new_obj->data, &heap_obj->data, data_size);
+    Value new_value = reinterpret_cast<uint64_t>(&new_obj->data) | static_cast<uint64_t>(type);
+    // set forward
+    heap_obj->region = FORWARDED_REGION;
+    heap_obj->data[0] = new_value;
+    return new_value;
+}
+
+// ropes mostly nest through their left parts, so those are followed in a loop instead of recursively
+void trace_young_rope(ProgramContext* ctx, String* rope) {
+    while (true) {
+        Value* parts = string_rope_parts(rope);
+        trace_young(ctx, &parts[1]);
+        Value left = parts[0];
+        if (!ctx->in_nursery(left)
+            || reinterpret_cast<HeapObject*>((left & DATA_MASK) - sizeof(HeapObject))->region == FORWARDED_REGION
+            || value_get_string_ptr(left)->rope_depth == 0) {
+            trace_young(ctx, &parts[0]);
+            return;
+        }
+        parts[0] = promote_young(ctx, left);
+        rope = value_get_string_ptr(parts[0]);
+    }
+}
+
+void trace_young_fields(ProgramContext* ctx, Value val) {
+    auto type = value_get_type(val);
+    if (type == ValueType::Reference) {
+        trace_young(ctx, value_get_ref(val));
+    } else if (type == ValueType::Record) {
+        Record* record = value_get_record(val);
+        for (int i = 0; i < record->static_field_count; ++i) {
+            trace_young(ctx, &record->static_fields[i]);
+        }
+        if (record->dynamic_fields != nullptr) {
+            if (ctx->in_nursery(record->dynamic_fields)) {
+                record->dynamic_fields = copy_field_table(ctx, record->dynamic_fields);
+            }
+            // moving a string key does not change its hash, so keys can be updated in place
+            FieldTable* table = record->dynamic_fields;
+            for (size_t i = 0; i < 2 * table->capacity; ++i) {
+                trace_young(ctx, &table->entries[i]);
+            }
+        }
+        if (record->elements != nullptr) {
+            if (ctx->in_nursery(record->elements)) {
+                record->elements = copy_dense_array(ctx, record->elements);
+            }
+            DenseArray* array = record->elements;
+            for (size_t i = 0; i < array->size; ++i) {
+                trace_young(ctx, &array->data[i]);
+            }
+        }
+    } else if (type == ValueType::Closure) {
+        Closure* closure = value_get_closure(val);
+        for (int i = 0; i < closure->n_free_vars; ++i) {
+            trace_young(ctx, &closure->free_vars[i]);
+        }
+    } else if (type == ValueType::HeapString) {
+        String* str = value_get_string_ptr(val);
+        if (str->rope_depth != 0) {
+            trace_young_rope(ctx, str);
+        }
+    }
 }
 
 void trace_value(ProgramContext* ctx, Value* ptr) {
@@ -623,9 +1127,15 @@ void trace_value(ProgramContext* ctx, Value* ptr) {
             trace_value(ctx, new_ref);
         } else if (type == ValueType::HeapString) {
             String* old_string = value_get_string_ptr(*ptr);
+            if (old_string->rope_depth != 0) {
+                trace_rope(ctx, ptr);
+                return;
+            }
             size_t len = old_string->len;
             // copy data
             String* new_string = ctx->alloc_string(len);
+            new_string->interned = old_string->interned;
+            new_string->hash = old_string->hash;
             std::memcpy(&new_string->data, &old_string->data, len);
             // set forward
             heap_obj->region = ctx->current_region;
@@ -636,22 +1146,26 @@ void trace_value(ProgramContext* ctx, Value* ptr) {
         } else if (type == ValueType::Record) {
             Record* old_record = value_get_record(*ptr);
             // copy data
-            Record* new_record = ctx->alloc_record(
-                old_record->static_field_count, old_record->layout_index);
+            Record* new_record = ctx->alloc_record(old_record->static_field_count, old_record->layout_index,
+                                                   old_record->capacity, old_record->alloc_site);
             // set forward
             heap_obj->region = ctx->current_region;
             Value new_value = to_value(new_record);
             heap_obj->data[0] = new_value;
             *ptr = new_value;
-            // trace dynamic_fields of record, if they exist
+            // copy and trace dynamic_fields of record, if they exist
             if (old_record->dynamic_fields != nullptr) {
-                new_record->init_map(ctx);
-                for (auto& elem : *old_record->dynamic_fields) {
-                    Value key = elem.first;
-                    Value val = elem.second;
-                    trace_value(ctx, &key);
-                    trace_value(ctx, &val);
-                    new_record->dynamic_fields->operator[](key) = val;
+                FieldTable* table = copy_field_table(ctx, old_record->dynamic_fields);
+                new_record->dynamic_fields = table;
+                for (size_t i = 0; i < 2 * table->capacity; ++i) {
+                    trace_value(ctx, &table->entries[i]);
+                }
+            }
+            if (old_record->elements != nullptr) {
+                DenseArray* array = copy_dense_array(ctx, old_record->elements);
+                new_record->elements = array;
+                for (size_t i = 0; i < array->size; ++i) {
+                    trace_value(ctx, &array->data[i]);
                 }
             }
             for (int i = 0; i < new_record->static_field_count; ++i) {
@@ -659,7 +1173,6 @@ void trace_value(ProgramContext* ctx, Value* ptr) {
                 trace_value(ctx, &val);
                 new_record->static_fields[i] = val;
             }
-            // map allocates in gc heap and hence needs no dealloc
         } else if (type == ValueType::Closure) {
             Closure* old_closure = value_get_closure(*ptr);
             size_t num_free = old_closure->n_free_vars;
@@ -682,32 +1195,227 @@ void trace_value(ProgramContext* ctx, Value* ptr) {
 }
 
 
-std::size_t ValueHash::operator()(const Value& val) const noexcept {
-    ValueType tag = value_get_type(val);
-    if (tag == ValueType::HeapString) {
-        auto* str = reinterpret_cast<String*>(val & DATA_MASK);
-        const size_t l = str->len;
+// copies a rope which has not been moved yet. Like in trace_young_rope, left parts are followed in a loop
+void trace_rope(ProgramContext* ctx, Value* ptr) {
+    while (true) {
+        auto* heap_obj = reinterpret_cast<HeapObject*>((*ptr & DATA_MASK) - sizeof(HeapObject));
+        String* old_rope = value_get_string_ptr(*ptr);
+        String* new_rope = ctx->alloc_string(2 * sizeof(Value));
+        std::memcpy(new_rope, old_rope, sizeof(String) + 2 * sizeof(Value));
+        // set forward
+        heap_obj->region = ctx->current_region;
+        Value new_value = to_value(new_rope);
+        heap_obj->data[0] = new_value;
+        *ptr = new_value;
+
+        Value* parts = string_rope_parts(new_rope);
+        trace_value(ctx, &parts[1]);
+        ptr = &parts[0];
+        if (value_get_type(*ptr) != ValueType::HeapString) {
+            return;
+        }
+        auto* left_obj = reinterpret_cast<HeapObject*>((*ptr & DATA_MASK) - sizeof(HeapObject));
+        if (left_obj->region == STATIC_REGION || left_obj->region == ctx->current_region
+            || value_get_string_ptr(*ptr)->rope_depth == 0) {
+            trace_value(ctx, ptr);
+            return;
+        }
+    }
+}
+
+void InlineCache::add(const Value* layout, uint32_t field, const Value* new_layout, uint32_t new_layout_index) {
+    for (Entry& entry : this->entries) {
+        if (entry.layout == layout) {
+            return;
+        }
+        if (entry.layout == nullptr) {
+            entry.layout = layout;
+            entry.offset = (int64_t)(sizeof(Record) + sizeof(Value) * field) - RECORD_TAG;
+            entry.new_layout = new_layout;
+            entry.new_layout_index = new_layout_index;
+            return;
+        }
+    }
+}
+
+auto value_hash(Value val) -> uint64_t {
+    uint64_t hash = val;
+    if (value_get_type(val) == ValueType::HeapString) {
+        auto* str = value_get_string_ptr(val);
+        if (str->hash != 0) {
+            return str->hash;
+        }
+        std::string rope_data;
+        const char* data = str->data;
+        if (str->rope_depth != 0) {
+            rope_data = value_get_std_string(nullptr, val);
+            data = rope_data.data();
+        }
         const size_t p = 1000000007;
         size_t current_p = p;
-        size_t output = 0;
-        for (size_t i = 0; i < l; ++i) {
-            output += str->data[i] * current_p;
+        hash = 0;
+        for (size_t i = 0; i < str->len; ++i) {
+            hash += data[i] * current_p;
             current_p *= p;
         }
-        return output;
     }
-    return val;
+    // inline values only differ in their upper bits, spread them over the whole word
+    hash *= 0x9e3779b97f4a7c15;
+    hash ^= hash >> 32;
+    // 0 marks an uncomputed string hash
+    hash |= 1;
+    if (value_get_type(val) == ValueType::HeapString) {
+        value_get_string_ptr(val)->hash = hash;
+    }
+    return hash;
+}
+
+auto field_key_eq(Value lhs, Value rhs) -> bool {
+    if (lhs == rhs) {
+        return true;
+    }
+    if (value_get_type(lhs) != ValueType::HeapString || value_get_type(rhs) != ValueType::HeapString) {
+        return false;
+    }
+    auto* lhs_str = value_get_string_ptr(lhs);
+    auto* rhs_str = value_get_string_ptr(rhs);
+    if (lhs_str->interned && rhs_str->interned) {
+        return false;
+    }
+    return lhs_str->len == rhs_str->len && value_hash(lhs) == value_hash(rhs)
+        && std::memcmp(lhs_str->data, rhs_str->data, lhs_str->len) == 0;
+}
+
+auto FieldTable::find(Value key) -> Value* {
+    uint64_t mask = this->capacity - 1;
+    for (uint64_t i = value_hash(key) & mask;; i = (i + 1) & mask) {
+        Value current = this->entries[2 * i];
+        if (current == 0) {
+            return nullptr;
+        }
+        if (field_key_eq(current, key)) {
+            return &this->entries[2 * i + 1];
+        }
+    }
+}
+
+// insert a key which is known to not be present yet
+void field_table_insert(FieldTable* table, Value key, Value val) {
+    uint64_t mask = table->capacity - 1;
+    uint64_t i = value_hash(key) & mask;
+    while (table->entries[2 * i] != 0) {
+        i = (i + 1) & mask;
+    }
+    table->entries[2 * i] = key;
+    table->entries[2 * i + 1] = val;
+    table->size += 1;
+}
+
+auto record_load_dynamic(Record* rec, Value name) -> Value {
+    if (rec->dynamic_fields != nullptr) {
+        if (Value* field = rec->dynamic_fields->find(name)) {
+            return *field;
+        }
+    }
+    return 0;
+}
+
+void record_store_dynamic(ProgramContext* ctx, Value rec, Value name, Value val) {
+    Record* rec_ptr = value_get_record(rec);
+    FieldTable* table = rec_ptr->dynamic_fields;
+    if (table != nullptr) {
+        if (Value* field = table->find(name)) {
+            *field = val;
+            return;
+        }
+    }
+    // keep load factor at or below 3/4
+    if (table == nullptr || 4 * (table->size + 1) > 3 * table->capacity) {
+        FieldTable* new_table = ctx->alloc_field_table(
+            table == nullptr ? FIELD_TABLE_MIN_CAPACITY : 2 * table->capacity);
+        if (table != nullptr) {
+            for (size_t i = 0; i < table->capacity; ++i) {
+                if (table->entries[2 * i] != 0) {
+                    field_table_insert(new_table, table->entries[2 * i], table->entries[2 * i + 1]);
+                }
+            }
+        }
+        rec_ptr->dynamic_fields = new_table;
+        table = new_table;
+        // the table pointer is not a Value, so the write barrier has to be checked by hand
+        if (ctx->in_nursery(table) && !ctx->in_nursery(rec)) {
+            ctx->remember(rec);
+        }
+    }
+    ctx->write_barrier(rec, name);
+    field_table_insert(table, name, val);
+}
+
+auto value_to_dense_index(Value val) -> int64_t {
+    auto type = value_get_type(val);
+    if (type == ValueType::Int) {
+        int32_t index = value_get_int32(val);
+        return index >= 0 ? index : -1;
+    }
+    // strings only name an array index in canonical decimal form, as produced by value_to_string
+    const char* data;
+    size_t len;
+    Value inline_data = val >> 8;
+    if (type == ValueType::InlineString) {
+        data = reinterpret_cast<const char*>(&inline_data);
+        len = (val >> 4) & 0b1111;
+    } else if (type == ValueType::HeapString) {
+        data = value_get_string_ptr(val)->data;
+        len = value_get_string_ptr(val)->len;
+    } else {
+        return -1;
+    }
+    if (len == 0 || len > 10 || (len > 1 && data[0] == '0')) {
+        return -1;
+    }
+    int64_t index = 0;
+    for (size_t i = 0; i < len; ++i) {
+        if (data[i] < '0' || data[i] > '9') {
+            return -1;
+        }
+        index = 10 * index + (data[i] - '0');
+    }
+    return index <= INT32_MAX ? index : -1;
+}
+
+void record_append_dense(ProgramContext* ctx, Value rec, Value val) {
+    Record* rec_ptr = value_get_record(rec);
+    DenseArray* array = rec_ptr->elements;
+    if (array == nullptr || array->size == array->capacity) {
+        DenseArray* new_array = ctx->alloc_dense_array(
+            array == nullptr ? DENSE_ARRAY_MIN_CAPACITY : 2 * array->capacity);
+        if (array != nullptr) {
+            std::memcpy(&new_array->data, &array->data, sizeof(Value) * array->size);
+            new_array->size = array->size;
+        }
+        rec_ptr->elements = new_array;
+        array = new_array;
+        if (ctx->in_nursery(array) && !ctx->in_nursery(rec)) {
+            ctx->remember(rec);
+        }
+    }
+    array->data[array->size] = val;
+    array->size += 1;
 }
 
-bool ValueEq::operator()(const Value& lhs, const Value& rhs) const noexcept {
-    return value_eq_bool(lhs, rhs);
+auto copy_dense_array(ProgramContext* ctx, const DenseArray* array) -> DenseArray* {
+    // unused capacity is copied as well, so that appending can continue without growing
+    size_t data_size = sizeof(DenseArray) + sizeof(Value) * array->capacity;
+    HeapObject* obj = ctx->alloc_traced(data_size);
+    std::memcpy(&obj->data, array, sizeof(DenseArray) + sizeof(Value) * array->size);
+    return reinterpret_cast<DenseArray*>(&obj->data);
 }
 
-void Record::init_map(ProgramContext* ctx) {
-    auto* map_ptr = static_cast<Record::map_type*>(
-        ctx->alloc_raw(sizeof(Record::map_type)));
-    ::new (map_ptr) Record::map_type{ProgramAllocator<Record::alloc_type>{ctx}};
-    this->dynamic_fields = map_ptr;
+auto copy_field_table(ProgramContext* ctx, const FieldTable* table) -> FieldTable* {
+    size_t data_size = sizeof(FieldTable) + 2 * sizeof(Value) * table->capacity;
+    HeapObject* obj = ctx->alloc_traced(data_size);
+    std::memcpy(&obj->data, table, data_size);
+    return reinterpret_cast<FieldTable*>(&obj->data);
 }
 
 };  // namespace runtime
\ No newline at end of file
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <cstdint>
+#include <deque>
+#include <map>
 #include <unordered_map>
 #include <string>
 #include <iostream>
@@ -14,6 +16,13 @@ struct HeapObject;
 struct Record;
 struct Closure;
 struct String;
+struct FieldTable;
+struct DenseArray;
+struct InlineCache;
+struct FunctionEntry;
+
+const size_t MIN_NURSERY_SIZE = 1 << 16;
+const size_t MAX_NURSERY_SIZE = 1 << 20;
 
 struct ProgramContext {
     char* heap{nullptr};
@@ -30,6 +39,23 @@ struct ProgramContext {
     size_t region_size{0};
     size_t gc_threshold{0};
 
+    // young generation, aligned to its (power of two) size so that membership can be tested by
+    // comparing the high bits of a pointer against nursery_page
+    char* nursery{nullptr};
+    char* nursery_head{nullptr};
+    char* nursery_end{nullptr};
+    size_t nursery_size{0};
+    int nursery_shift{0};
+    uint64_t nursery_page{0};
+    // generated code triggers a collection once nursery_head passes this point
+    char* nursery_limit{nullptr};
+
+    // true while objects are being copied by the collector, forces allocation into the old space
+    bool collecting{false};
+
+    // old objects which have been written a pointer to a young object since the last collection
+    std::vector<Value> remembered;
+
     Value none_string{0};
     Value false_string{0};
     Value true_string{0};
@@ -40,10 +66,31 @@ struct ProgramContext {
 
     uint64_t saved_rsp{0};
 
+    // live stack words (relative to rbp) at each safepoint, keyed by its return address
+    std::unordered_map<uint64_t, std::vector<int32_t>> stack_maps;
+
     std::vector<void*> static_allocations;
     std::vector<std::vector<Value>> layouts;
-
-    std::vector<int32_t> layout_offsets;
+    // copies of the layouts padded with zeros to a multiple of LAYOUT_TABLE_CHUNK fields and aligned to
+    // the same size, these are what records point to and what generated code compares against
+    std::vector<Value*> layout_tables;
+    // child layout reached by adding a field name to a layout
+    std::map<std::pair<uint32_t, Value>, uint32_t> layout_transitions;
+    // weak set of canonical heap strings, open addressing with 0 as the empty key. Holds the string
+    // constants and every string used as a field name, so two interned strings are equal only if they
+    // are the same object
+    std::vector<Value> interned_strings;
+    size_t interned_count{0};
+    // some interned string is in the nursery, so a minor collection has to sweep the set
+    bool young_interned{false};
+    // one per REC_LOAD_NAME / REC_STORE_NAME site, a deque as generated code holds their addresses
+    std::deque<InlineCache> inline_caches;
+    // one per IR function, sized before code generation as closures hold the addresses of entries
+    std::vector<FunctionEntry> function_table;
+    // operand types seen by baseline code at each ADD and EQ site, per function and site number
+    std::vector<std::vector<uint8_t>> type_feedback;
+    // most static fields a record from each ALLOC_REC site wanted, grown when a record runs out of room
+    std::vector<uint32_t> alloc_site_fields;
 
     explicit ProgramContext(size_t heap_size);
     ~ProgramContext();
@@ -54,16 +101,33 @@ struct ProgramContext {
 
     auto alloc_ref() -> Value*;
     auto alloc_string(size_t length) -> String*;
-    auto alloc_record(uint32_t num_static, uint32_t layout) -> Record*;
+    auto alloc_record(uint32_t num_static, uint32_t layout, uint32_t capacity, uint32_t alloc_site) -> Record*;
+    auto record_site_capacity(uint32_t num_static, uint32_t alloc_site) const -> uint32_t;
     auto alloc_closure(size_t num_free) -> Closure*;
 
     auto alloc_traced(size_t data_size) -> HeapObject*;
+    auto alloc_young(size_t num_bytes) -> void*;
     auto alloc_raw(size_t num_bytes) -> void*;
 
+    auto alloc_field_table(size_t capacity) -> FieldTable*;
+    auto alloc_dense_array(size_t capacity) -> DenseArray*;
+
+    auto in_nursery(Value val) const -> bool;
+    auto in_nursery(const void* ptr) const -> bool;
+    void write_barrier(Value target, Value val);
+    void remember(Value target);
+    void reset_nursery();
+
     void init_globals(size_t num_globals);
     void reset_globals();
 
-    void init_layouts(std::vector<std::vector<Value>> field_layouts);
+    auto intern(Value str) -> Value;
+    auto find_interned(Value str) -> Value;
+    void sweep_interned(bool major);
+
+    void init_layouts(const std::vector<std::vector<Value>>& field_layouts);
+    auto add_layout(std::vector<Value> fields) -> uint32_t;
+    auto layout_transition(uint32_t layout, Value name) -> uint32_t;
 };
 
 enum class ValueType : uint64_t {
@@ -106,25 +170,36 @@ bool is_heap_type(ValueType type);
     Pointer Based   - ptr | 0000...0100
 */
 
-struct ValueHash {
-    std::size_t operator()(const Value& val) const noexcept;
-};
-
-struct ValueEq {
-    bool operator()(const Value& lhs, const Value& rhs) const noexcept;
-};
-
 // TODO CHECK IF THIS UPDATE DOESN'T BREAK ANYTHING
 const std::uint64_t TAG_MASK = 0b111;
 const std::uint64_t DATA_MASK = ~TAG_MASK;
 
 
 struct String {
-    std::uint64_t len;
+    std::uint32_t len;
+    // set once the string is in the intern table of its ProgramContext
+    std::uint16_t interned;
+    // 0 for flat strings. Otherwise this is a rope, a lazy concatenation whose data holds its left and
+    // right part, and the depth counts the nesting through right parts
+    std::uint16_t rope_depth;
+    // lazily computed by value_hash, 0 if not yet known
+    std::uint64_t hash;
     char data[];
 };
 
+// concatenations of at least this length become ropes instead of being copied
+const uint32_t ROPE_MIN_LENGTH = 256;
+// short appends to a rope are merged into its last part while that stays within this length
+const uint32_t ROPE_LEAF_LENGTH = 256;
+// the collector recurses into right parts, deeper right parts are flattened first
+const uint16_t ROPE_MAX_DEPTH = 256;
+
+inline auto string_rope_parts(String* str) -> Value* {
+    return reinterpret_cast<Value*>(str->data);
+}
+
 struct Closure {
+    // entry of the function in ProgramContext::function_table
     std::uint64_t fnptr;
     std::uint64_t n_args;
     std::uint64_t n_free_vars;
@@ -140,6 +215,8 @@ auto value_get_string_ptr(Value val) -> String*;
 auto value_get_record(Value val) -> Record*;
 auto value_get_closure(Value val) -> Closure*;
 auto value_get_std_string(ProgramContext* ctx, Value val) -> std::string;
+void string_write(Value str, char* dst);
+auto string_flatten(ProgramContext* ctx, Value str) -> Value;
 
 auto value_eq_bool(Value lhs, Value rhs) -> bool;
 
@@ -169,8 +246,26 @@ Value to_value(String* str);
 Value to_value(Record* rec_ptr);
 Value to_value(Closure* closure_ptr);
 
+// optimized code can keep ints untagged, with the int32 in the upper half of the word. The lower bits
+// stay zero, which the collector reads as None
+const int UNBOXED_SHIFT = 32;
+Value to_unboxed(int32_t i);
+Value unboxed_to_value(Value val);
+
+/*
+    region values of heap objects:
+    0, 1 - old space, semispace 0 or 1
+    2    - static allocation, never moved
+    3    - nursery (young generation)
+    4    - nursery object forwarded into the old space by a minor collection
+*/
+const uint8_t STATIC_REGION = 2;
+const uint8_t NURSERY_REGION = 3;
+const uint8_t FORWARDED_REGION = 4;
+
 struct HeapObject {
     uint8_t region;
+    uint8_t remembered;
     uint64_t data[];
 };
 
@@ -179,66 +274,130 @@ auto extern_intcast(ProgramContext* rt, Value val) -> Value;
 auto extern_input(ProgramContext* rt) -> Value;
 
 auto extern_rec_load_name(ProgramContext* ctx, Value rec, Value name) -> Value;
+auto extern_rec_load_name_cached(ProgramContext* ctx, Value rec, Value name, InlineCache* cache) -> Value;
 void extern_rec_store_name(ProgramContext* ctx, Value rec, Value name, Value val);
+void extern_rec_store_name_cached(ProgramContext* ctx, Value rec, Value name, Value val, InlineCache* cache);
 auto extern_rec_load_index(ProgramContext* ctx, Value rec, Value index_val) -> Value;
 void extern_rec_store_index(ProgramContext* ctx, Value rec, Value index_val, Value val);
 
-Value extern_alloc_ref(ProgramContext* rt);
 Value extern_alloc_string(ProgramContext* rt, size_t length);
-Value extern_alloc_record(ProgramContext* rt, size_t num_static, size_t layout_index);
-Value extern_alloc_closure(ProgramContext* rt, size_t num_free);
+Value extern_eq(ProgramContext* ctx, Value lhs, Value rhs);
+auto extern_alloc_traced(ProgramContext* rt, size_t data_size) -> HeapObject*;
+
+void extern_remember(ProgramContext* ctx, Value target);
 
 void trace_value(ProgramContext* ctx, Value* ptr);
+void trace_young(ProgramContext* ctx, Value* ptr);
+void trace_young_fields(ProgramContext* ctx, Value val);
+auto promote_young(ProgramContext* ctx, Value val) -> Value;
+void trace_young_rope(ProgramContext* ctx, String* rope);
+void trace_rope(ProgramContext* ctx, Value* ptr);
 
-void trace_collect(ProgramContext* ctx, const uint64_t* rbp, uint64_t* rsp);
+void trace_collect(ProgramContext* ctx, uint64_t* rbp, uint64_t return_address);
+void trace_stack(ProgramContext* ctx, uint64_t* rbp, uint64_t return_address, void (*trace)(ProgramContext*, Value*));
+void collect_minor(ProgramContext* ctx, uint64_t* rbp, uint64_t return_address);
+void collect_major(ProgramContext* ctx, uint64_t* rbp, uint64_t return_address);
 
-template<typename T>
-struct ProgramAllocator {
-    using value_type = T;
-    using is_always_equal = std::false_type;
+/*
+ * Open addressing table (linear probing) holding the fields added to a record at runtime. It lives in
+ * the gc heap but is not a Value, as it is owned by exactly one record it is simply copied along with
+ * it. Empty slots have key 0 (None), which is never a valid field name.
+ */
+struct FieldTable {
+    uint64_t capacity; // power of two
+    uint64_t size;
+    Value entries[]; // capacity key/value pairs
+
+    auto find(Value key) -> Value*;
+};
 
-    ProgramContext* ctx{nullptr};
+const uint64_t FIELD_TABLE_MIN_CAPACITY = 8;
 
-    explicit ProgramAllocator(ProgramContext* ctx_ptr) : ctx{ctx_ptr} {}
+/*
+ * Fields 0 through size - 1 of a record used as an array. Integer keys below size live only here,
+ * all other keys (including larger integers) live in the field table. Owned by a single record,
+ * just like FieldTable.
+ */
+struct DenseArray {
+    uint64_t capacity;
+    uint64_t size; // accessed from asm
+    Value data[];  // accessed from asm
+};
 
-    template<typename U>
-    ProgramAllocator(const ProgramAllocator<U>& alloc) noexcept : ctx{alloc.ctx} {}
+const uint64_t DENSE_ARRAY_MIN_CAPACITY = 8;
 
-    auto allocate(size_t n) -> T* {
-        size_t num_bytes = sizeof(T) * n;
-        return static_cast<T*>(ctx->alloc_raw(num_bytes));
-    }
+// layout tables are scanned one 32 or 64 byte vector at a time, the word before the first field holds
+// the padded table size in bytes
+const uint64_t LAYOUT_TABLE_CHUNK = 8;
 
-    void deallocate(T* ptr, size_t n) {}
+struct Record {
+    const Value* layout; // must be first field, is accessed from asm
+    uint32_t static_field_count;
+    uint32_t layout_index;
+    FieldTable* dynamic_fields;
+    DenseArray* elements; // accessed from asm
+    uint32_t capacity; // number of static field slots
+    uint32_t alloc_site;
+    Value static_fields[]; // must be last field, because variable length
 };
 
-template<typename T, typename U>
-bool operator==(const ProgramAllocator<T>& lhs, const ProgramAllocator<U>& rhs) {
-    return lhs.ctx == rhs.ctx;
+// records have room for their fields rounded up to a multiple of 4 (at least 4), so that fields added
+// later can move the record to a child layout instead of the field table
+inline auto record_capacity(uint32_t num_static) -> uint32_t {
+    return num_static == 0 ? 4 : ((num_static + 3) & ~3u);
 }
 
-template<typename T, typename U>
-bool operator!=(const ProgramAllocator<T>& lhs, const ProgramAllocator<U>& rhs) {
-    return lhs.ctx != rhs.ctx;
-}
+// an allocation site is never sized for more fields than this, the rest go to the field table
+const uint32_t MAX_RECORD_CAPACITY = 32;
 
+/*
+ * Closures call through the function table instead of holding code addresses, so that recompiling a
+ * function redirects every closure of it, including the ones already allocated.
+ */
+struct FunctionEntry {
+    uint64_t code;  // accessed from asm
+    // counted down by baseline code on every call and loop iteration, the function is recompiled once
+    // this reaches zero
+    int64_t hotness;  // accessed from asm
+};
 
-struct Record {
-    using alloc_type = std::pair<const Value, Value>;
-    using map_type = std::unordered_map<
-        Value,
-        Value,
-        ValueHash,
-        ValueEq,
-        ProgramAllocator<alloc_type>>;
-
-    uint64_t layout_offset; // must be first field, is accessed from asm
-    uint32_t static_field_count;
-    uint32_t layout_index;
-    map_type* dynamic_fields;
-    Value static_fields[]; // must be last field, because variable length
+// bits of the type feedback of a site
+const uint8_t FEEDBACK_INT = 1;    // both operands were ints
+const uint8_t FEEDBACK_OTHER = 2;  // some operand was not an int, or a guard on the site failed
+
+const uint64_t INLINE_CACHE_ENTRIES = 4;
 
-    void init_map(ProgramContext* ctx);
+/*
+ * Cache of a REC_LOAD_NAME / REC_STORE_NAME site, filled by the runtime on a miss and checked by the
+ * generated code first. Once a site has missed INLINE_CACHE_ENTRIES times it is megamorphic, and
+ * misses skip the runtime update and go straight to the generic lookup.
+ */
+struct InlineCache {
+    struct Entry {
+        const Value* layout; // accessed from asm
+        int64_t offset;      // of the field relative to the tagged record, accessed from asm
+        // for a store adding the field: layout after the transition, otherwise nullptr
+        const Value* new_layout;      // accessed from asm
+        uint64_t new_layout_index;    // accessed from asm
+    };
+
+    Entry entries[INLINE_CACHE_ENTRIES];
+    uint64_t misses; // accessed from asm
+
+    void add(const Value* layout, uint32_t field, const Value* new_layout = nullptr, uint32_t new_layout_index = 0);
 };
 
+auto value_hash(Value val) -> uint64_t;
+auto field_key_eq(Value lhs, Value rhs) -> bool;
+void field_table_insert(FieldTable* table, Value key, Value val);
+
+auto record_load_dynamic(Record* rec, Value name) -> Value;
+void record_store_dynamic(ProgramContext* ctx, Value rec, Value name, Value val);
+
+auto copy_field_table(ProgramContext* ctx, const FieldTable* table) -> FieldTable*;
+
+auto value_to_dense_index(Value val) -> int64_t;
+void record_append_dense(ProgramContext* ctx, Value rec, Value val);
+auto copy_dense_array(ProgramContext* ctx, const DenseArray* array) -> DenseArray*;
+
 };
@@ -0,0 +1,176 @@
+#include "value.h"
+#include "ir.h"
+#include "value_numberer.h"
+#include <utility>
+
+ValueNumberer::ValueNumberer(IR::Program* prog) : prog_(prog){}
+
+static bool is_pure(IR::Operation op) {
+    switch (op) {
+        case IR::Operation::ADD_INT:
+        case IR::Operation::SUB:
+        case IR::Operation::MUL:
+        case IR::Operation::DIV:
+        case IR::Operation::EQ_INT:
+        case IR::Operation::GT:
+        case IR::Operation::GEQ:
+        case IR::Operation::AND:
+        case IR::Operation::OR:
+        case IR::Operation::NOT:
+        case IR::Operation::LOAD_FREE_REF:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool is_commutative(IR::Operation op) {
+    return op == IR::Operation::ADD_INT || op == IR::Operation::MUL || op == IR::Operation::EQ_INT ||
+           op == IR::Operation::AND || op == IR::Operation::OR;
+}
+
+static bool is_load(IR::Operation op) {
+    return op == IR::Operation::LOAD_GLOBAL || op == IR::Operation::REF_LOAD || op == IR::Operation::REC_LOAD_NAME ||
+           op == IR::Operation::REC_LOAD_STATIC || op == IR::Operation::REC_LOAD_INDX;
+}
+
+static bool is_record_load(int op) {
+    return op == (int) IR::Operation::REC_LOAD_NAME || op == (int) IR::Operation::REC_LOAD_STATIC ||
+           op == (int) IR::Operation::REC_LOAD_INDX;
+}
+
+static ValueNumberer::Key make_key(IR::Operation op, const IR::Operand& a, const IR::Operand& b = {}) {
+    return {(int) op, a.type, a.index, b.type, b.index, IR::Operand::NONE, 0};
+}
+
+template <typename Pred>
+static void kill(ValueNumberer::Table& memory, Pred pred) {
+    for (auto iter = memory.begin(); iter != memory.end();) {
+        if (pred(iter->first))
+            iter = memory.erase(iter);
+        else
+            ++iter;
+    }
+}
+
+// pure values and asserted facts hold in all blocks dominated by this one. Loaded values only hold as long as
+// nothing on the way may have stored, so they are only passed on to a child whose single predecessor is this block
+void ValueNumberer::number_block(IR::Function& fun, size_t block_idx, const std::vector<std::vector<int>>& dom_children,
+                                 const std::vector<int>& predecessor_count, Table& pure, Table memory,
+                                 std::vector<IR::Operand>& replace) {
+    IR::BasicBlock& block = fun.blocks[block_idx];
+    std::vector<IR::Instruction> new_ins;
+    // entries of this block, removed from the pure table again once the dominated blocks are done
+    std::vector<Key> added;
+    for (auto ins : block.instructions) {
+        for (auto& arg : ins.args)
+            arg = IR::resolve(replace, arg);
+
+        if (IR::is_assert(ins.op) || ins.op == IR::Operation::GUARD_INT) {
+            // a passed guard shows the value is an int just like an assertion
+            IR::Operation fact = ins.op == IR::Operation::GUARD_INT ? IR::Operation::ASSERT_INT : ins.op;
+            Key key = make_key(fact, ins.args[0]);
+            if (pure.contains(key))
+                continue;
+            pure[key] = {};
+            added.push_back(key);
+        } else if (is_pure(ins.op) && ins.out.type == IR::Operand::VIRT_REG) {
+            IR::Operand lhs = ins.args[0];
+            IR::Operand rhs = ins.args[1];
+            if (is_commutative(ins.op) && std::make_pair(rhs.type, rhs.index) < std::make_pair(lhs.type, lhs.index))
+                std::swap(lhs, rhs);
+            Key key = make_key(ins.op, lhs, rhs);
+            if (auto iter = pure.find(key); iter != pure.end()) {
+                replace[ins.out.index] = iter->second;
+                continue;
+            }
+            pure[key] = ins.out;
+            added.push_back(key);
+        } else if (ins.op == IR::Operation::MOV && ins.out.type == IR::Operand::VIRT_REG &&
+                   ins.args[0].type == IR::Operand::VIRT_REG) {
+            replace[ins.out.index] = ins.args[0];
+            continue;
+        } else if (is_load(ins.op) && ins.out.type == IR::Operand::VIRT_REG) {
+            Key key = make_key(ins.op, ins.args[0], ins.args[1]);
+            if (auto iter = memory.find(key); iter != memory.end()) {
+                replace[ins.out.index] = iter->second;
+                continue;
+            }
+            memory[key] = ins.out;
+        } else if (ins.op == IR::Operation::EXEC_CALL) {
+            // the callee may store to anything
+            memory.clear();
+        } else if (ins.op == IR::Operation::STORE_GLOBAL) {
+            memory[make_key(IR::Operation::LOAD_GLOBAL, ins.args[0])] = ins.args[1];
+        } else if (ins.op == IR::Operation::REF_STORE) {
+            // any two references may be the same
+            kill(memory, [](const Key& key) { return key[0] == (int) IR::Operation::REF_LOAD; });
+            memory[make_key(IR::Operation::REF_LOAD, ins.args[0])] = ins.args[1];
+        } else if (ins.op == IR::Operation::REC_STORE_NAME) {
+            // any two records may be the same. Other names are other fields, but any index or layout offset
+            // may be this field
+            kill(memory, [&](const Key& key) {
+                return (key[0] == (int) IR::Operation::REC_LOAD_NAME && key[3] == ins.args[1].type && key[4] == ins.args[1].index) ||
+                       key[0] == (int) IR::Operation::REC_LOAD_STATIC || key[0] == (int) IR::Operation::REC_LOAD_INDX;
+            });
+            memory[make_key(IR::Operation::REC_LOAD_NAME, ins.args[0], ins.args[1])] = ins.args[2];
+        } else if (ins.op == IR::Operation::REC_STORE_STATIC) {
+            kill(memory, [&](const Key& key) {
+                return (key[0] == (int) IR::Operation::REC_LOAD_STATIC && key[4] == ins.args[1].index) ||
+                       key[0] == (int) IR::Operation::REC_LOAD_NAME || key[0] == (int) IR::Operation::REC_LOAD_INDX;
+            });
+            memory[make_key(IR::Operation::REC_LOAD_STATIC, ins.args[0], ins.args[1])] = ins.args[2];
+        } else if (ins.op == IR::Operation::REC_STORE_INDX) {
+            kill(memory, [](const Key& key) { return is_record_load(key[0]); });
+            memory[make_key(IR::Operation::REC_LOAD_INDX, ins.args[0], ins.args[1])] = ins.args[2];
+        }
+        new_ins.push_back(ins);
+    }
+    block.instructions = new_ins;
+
+    for (int child : dom_children[block_idx]) {
+        bool single_pred = predecessor_count[child] == 1;
+        number_block(fun, child, dom_children, predecessor_count, pure, single_pred ? memory : Table{}, replace);
+    }
+    for (const auto& key : added)
+        pure.erase(key);
+}
+
+void ValueNumberer::number_function(IR::Function& fun) {
+    std::vector<int> idom = fun.compute_dominators();
+    std::vector<std::vector<int>> dom_children(fun.blocks.size());
+    std::vector<int> predecessor_count(fun.blocks.size(), 0);
+    for (size_t j = 0; j < fun.blocks.size(); j++) {
+        for (int succ : fun.blocks[j].successors)
+            predecessor_count[succ]++;
+        if (j > 0 && idom[j] != -1)
+            dom_children[idom[j]].push_back((int) j);
+    }
+
+    std::vector<IR::Operand> replace(fun.virt_reg_count);
+    Table pure;
+    number_block(fun, 0, dom_children, predecessor_count, pure, {}, replace);
+
+    // phis on back edges and deopt states may still name removed registers
+    for (auto& block : fun.blocks) {
+        for (auto& pn : block.phi_nodes)
+            for (auto& arg : pn.args)
+                arg.second = IR::resolve(replace, arg.second);
+        for (auto& ins : block.instructions)
+            for (auto& arg : ins.args)
+                arg = IR::resolve(replace, arg);
+    }
+    for (auto& state : fun.deopt_states) {
+        for (auto& value : state.values)
+            value.second = IR::resolve(replace, value.second);
+        for (auto& operand : state.operands)
+            operand = IR::resolve(replace, operand);
+    }
+}
+
+IR::Program* ValueNumberer::optimize() {
+    for (size_t i = 0; i < prog_->functions.size(); i++)
+        if (prog_->optimizes(i))
+            number_function(prog_->functions[i]);
+    return prog_;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "value.h"
+#include "ir.h"
+#include <array>
+#include <map>
+
+class ValueNumberer {
+private:
+    IR::Program* prog_;
+public:
+    // an operation and its operands, the value computed by an earlier instruction is reused for an equal key
+    using Key = std::array<int, 7>;
+    using Table = std::map<Key, IR::Operand>;
+
+    ValueNumberer(IR::Program* prog);
+    IR::Program* optimize();
+
+    void number_block(IR::Function& fun, size_t block_idx, const std::vector<std::vector<int>>& dom_children,
+                      const std::vector<int>& predecessor_count, Table& pure, Table memory,
+                      std::vector<IR::Operand>& replace);
+    void number_function(IR::Function& fun);
+};
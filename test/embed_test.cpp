@@ -0,0 +1,99 @@
+// checks that runs of a script compiled once share no state, one after the other and on several threads
+#include <unistd.h>
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mitscript.h"
+
+// every run starts from count = 0 and an empty record. The loop is long enough for the runs on the threads
+// to overlap, runs sharing globals, records or inline caches would reset and bump each other's counts
+const char* SOURCE = R"(
+count = 0;
+state = {};
+bump = fun() {
+    global count;
+    count = count + 1;
+    state.bumps = count;
+    return count;
+};
+i = 0;
+while (i < 1000000) {
+    bump();
+    i = i + 1;
+}
+print("count = " + count + ", bumps = " + state.bumps);
+)";
+const std::string EXPECTED = "count = 1000000, bumps = 1000000";
+
+const int SEQUENTIAL_RUNS = 2;
+const int THREADS = 2;
+const int RUNS_PER_THREAD = 2;
+
+// what the runs print, concurrent runs may interleave their lines
+static auto capture_output(const mitscript::Script& script) -> std::string {
+    std::FILE* out = std::tmpfile();
+    std::cout.flush();
+    int saved_stdout = dup(STDOUT_FILENO);
+    dup2(fileno(out), STDOUT_FILENO);
+
+    for (int i = 0; i < SEQUENTIAL_RUNS; i++) {
+        script.instantiate()->run();
+    }
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; t++) {
+        threads.emplace_back([&] {
+            for (int i = 0; i < RUNS_PER_THREAD; i++) {
+                script.instantiate()->run();
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    std::cout.flush();
+    std::fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+
+    std::string res;
+    std::rewind(out);
+    for (int c; (c = std::fgetc(out)) != EOF;) {
+        res.push_back((char) c);
+    }
+    std::fclose(out);
+    return res;
+}
+
+int main() {
+    codegen::CompileOptions options;
+    options.use_inlining = options.use_const_propagation = options.use_type_inference = true;
+    auto script = mitscript::Script::compile(SOURCE, options, 8 << 20);
+    if (script == nullptr) {
+        std::cerr << "compiling the script failed" << std::endl;
+        return 1;
+    }
+    if (mitscript::Script::compile("x = ;", options) != nullptr) {
+        std::cerr << "a source that does not parse compiled" << std::endl;
+        return 1;
+    }
+
+    std::string output = capture_output(*script);
+    int runs = 0;
+    for (size_t pos; (pos = output.find(EXPECTED)) != std::string::npos;) {
+        output.erase(pos, EXPECTED.size());
+        runs++;
+    }
+    std::erase(output, '\n');
+    if (runs != SEQUENTIAL_RUNS + THREADS * RUNS_PER_THREAD || !output.empty()) {
+        std::cerr << "expected " << SEQUENTIAL_RUNS + THREADS * RUNS_PER_THREAD << " runs printing '" << EXPECTED
+                  << "', got " << runs << ", other output: '" << output << "'" << std::endl;
+        return 1;
+    }
+    std::cout << "Passed " << runs << " runs" << std::endl;
+    return 0;
+}
@@ -17,17 +17,29 @@ for filename in public/bad*.mit; do
     TOTAL=$((TOTAL+1))
 done
 
-for filename in public/good*.mit; do
-    echo $filename
-    timeout $TIMEOUT $INTERPRETER -s $filename > tmp.out
+# runs the good tests with the given compiler flags
+run_good() {
+    echo $filename $@
+    timeout $TIMEOUT $INTERPRETER $@ -s $filename > tmp.out
     CODE=$?
     if diff tmp.out public/$(basename $filename).out; then
         COUNT=$((COUNT+1))
     else
-        echo "Fail: $(basename $filename) (exit code $CODE)"
+        echo "Fail: $(basename $filename) $@ (exit code $CODE)"
     fi
     TOTAL=$((TOTAL+1))
     rm -f tmp.out
+}
+
+# every good test also runs with all passes, tiered and up front. A test for a single pass lists the flags
+# that enable it in goodNN.mit.flags
+for filename in public/good*.mit; do
+    run_good
+    run_good --opt=all
+    run_good --opt=all --no-tiering
+    if test -f $filename.flags; then
+        run_good $(cat $filename.flags)
+    fi
 done
 
 